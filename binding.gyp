@@ -37,10 +37,18 @@
         'src/heapdiff-v0-10.h',
         'src/heapdiff-v0-12.h',
         'src/heapdiff.h',
+        'src/heaphistory-inl.h',
+        'src/heaphistory.h',
+        'src/heapsnapshot-writer-inl.h',
+        'src/heapsnapshot-writer.h',
+        'src/profiler-inl.h',
         'src/profiler-v0-10.h',
         'src/profiler-v0-12.h',
+        'src/profiler.h',
         'src/strong-agent.cc',
         'src/strong-agent.h',
+        'src/util-inl.h',
+        'src/util.h',
       ],
     }
   ]
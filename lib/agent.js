@@ -76,6 +76,7 @@ function ensureConfig (key, appName) {
              userjson.appName,
     proxy: env.STRONGLOOP_PROXY || nfjson.proxy || userjson.proxy,
     endpoint: nfjson.endpoint || userjson.endpoint,
+    cpuStall: nfjson.cpuStall || userjson.cpuStall,
   };
 
   // Only return config object if we found valid properties.
@@ -139,6 +140,7 @@ Agent.prototype.profile = function (key, appName, options) {
   }
 
   this.key = config.key;
+  this.cpuStall = options.cpuStall || config.cpuStall;
 
   if (config.appName instanceof Array) {
     this.appName  = config.appName.shift();
@@ -247,6 +249,17 @@ Agent.prototype.prepareProfilers = function () {
     }
   });
 
+  // Profile automatically when the event loop stalls.  Armed with
+  // { cpuStall: true } or { cpuStall: { threshold: ms, ... } } in
+  // strongloop.json or the options to profile(), see profilers/cpu.js.
+  // lib/loop.js emits the profiles.
+  if (this.cpuStall && cpuProf.arm(this.cpuStall)) {
+    this.info('strong-agent armed the cpu stall profiler');
+  }
+  this.on('cpuStall', function (profiles) {
+    self.transport.send('cpu:stall', profiles);
+  });
+
   // Allow cpu profiling events to be triggered from server
   this.transport.on('cpu:start', function () {
     if (cpuProf.enabled) {
@@ -257,12 +270,14 @@ Agent.prototype.prepareProfilers = function () {
       console.log('strong-agent starting cpu profiler');
       self.transport.send('profile:start', 'cpu');
       self.transport.once('cpu:stop', function (rowid) {
-        var data = cpuProf.stop();
-        console.log('strong-agent sending cpu profiler result', rowid);
-
-        // we don't need to send profile:stop because the profileRun event
-        // already updates that row to "done"
-        self.transport.send('profileRun', rowid, data);
+        // Converted in slices, big profiles would block the loop otherwise.
+        cpuProf.stop(function(data) {
+          console.log('strong-agent sending cpu profiler result', rowid);
+
+          // we don't need to send profile:stop because the profileRun event
+          // already updates that row to "done"
+          self.transport.send('profileRun', rowid, data);
+        });
       });
     }
   });
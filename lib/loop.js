@@ -53,6 +53,13 @@ function start() {
     // we're also going to shoehorn it into the metric data to make our life easier
     agent.metric(null, 'queue', [slowest, sum / ticks]);
 
+    // Profiles taken by the stall profiler since the last interval, if it's
+    // armed.  See profilers/cpu.js.
+    var profiles = addon.takeStallProfiles && addon.takeStallProfiles();
+    if (profiles && profiles.length > 0) {
+      agent.emit('cpuStall', profiles);
+    }
+
     if (process.env.NODEFLY_DEBUG && /uvmon/.test(process.env.NODEFLY_DEBUG)) {
       console.error('UVMON: %s', JSON.stringify({
         count: ticks, slowest_ms: slowest, sum_ms: sum
@@ -2,9 +2,12 @@
 
 var addon = require('../addon');
 
-exports.start = function() {
+// Pass { samplingInterval: us } to sample more or less often than V8's
+// default of once per millisecond, and { samples: true } to record when
+// each sample was taken.  Only works on node v0.11 and up.
+exports.start = function(options) {
   if (addon) {
-    addon.startCpuProfiling();
+    addon.startCpuProfiling(options);
     exports.enabled = true;
     return true;
   } else {
@@ -13,7 +16,77 @@ exports.start = function() {
   }
 };
 
-exports.stop = function() {
+// Pass { format: 'flat' } to get the profile as a node table of typed arrays
+// instead of a tree of objects, it's a lot cheaper for big profiles.  Pass
+// { format: 'top', top: n, callers: m } to only get the n hottest functions
+// by self and total time, with their m biggest callers.  Pass
+// { format: 'flat', samples: true } after start({ samples: true }) to get
+// a timeline of the samples too, as node indices and time deltas in
+// microseconds; timeline.startTime is in milliseconds since the epoch.
+// { format: 'folded' } returns the profile as folded stacks, the text format
+// flamegraph tools read.  Add { collapse: 'script' } or
+// { collapse: 'package' } to get a frame per script or npm package instead
+// of per function.
+//
+// { format: 'baseline' } keeps the profile as the baseline, a later
+// { format: 'diff', top: n } returns the n functions whose share of the
+// samples grew the most since then.  Good for canary checks after a deploy.
+//
+// With a callback, the default tree format is converted a few milliseconds at
+// a time (options.sliceTime, default 5) and passed to the callback when it's
+// done, instead of blocking the event loop until the whole tree is converted.
+// Only the tree format is converted incrementally: 'flat', 'top', 'folded',
+// 'baseline' and 'diff' are still built in one go before stop() returns, the
+// callback merely receives the result asynchronously.
+exports.stop = function(options, callback) {
+  if (typeof options === 'function') {
+    callback = options;
+    options = undefined;
+  }
   exports.enabled = false;
-  return addon && addon.stopCpuProfiling();
+  if (!callback) {
+    return addon && addon.stopCpuProfiling(options);
+  }
+  if (!addon) {
+    return process.nextTick(callback);
+  }
+  addon.stopCpuProfiling(options, callback);
+};
+
+// Profiles continuously in the background, one window every options.window
+// milliseconds (default 10 seconds).  Only the options.top hottest functions
+// of the last options.windows windows are kept, with at most options.maxBytes
+// bytes for all of them together.  The profile of the window in progress is
+// held by V8 and not counted.  Use recent() to get them.
+exports.startRolling = function(options) {
+  if (!addon || !addon.startRollingProfiler) return false;
+  addon.startRollingProfiler(options);
+  exports.rolling = true;
+  return true;
+};
+
+// Returns the windows of the rolling profiler, oldest first, as
+// { start, end, samples, functions } objects.  The window in progress is
+// cut short and included.
+exports.recent = function() {
+  return exports.rolling ? addon.pollRollingProfiler(true) : [];
+};
+
+exports.stopRolling = function() {
+  exports.rolling = false;
+  return addon && addon.stopRollingProfiler ? addon.stopRollingProfiler() : [];
+};
+
+// Profiles automatically when the event loop stalls: options.count loop
+// iterations slower than options.threshold ms within options.within ms
+// start a profile of options.duration ms.  At most one profile per
+// options.cooldown ms.  See lib/loop.js for how the profiles get collected.
+exports.arm = function(options) {
+  if (!addon || !addon.armStallProfiler) return false;
+  addon.armStallProfiler(options);
+  return true;
+};
+
+exports.disarm = function() {
+  if (addon && addon.disarmStallProfiler) addon.disarmStallProfiler();
 };
@@ -7,20 +7,55 @@ function debug (format, args) {
 // Load dependencies
 var Timer = require('../timer');
 
+// Optional heap diff reports, see stopHeapDiff().
+var EXTRAS = ['strings', 'closures', 'types'];
+
 function Instances () {
   this.addon = require('../addon');
   this.agent = global.STRONGAGENT;
   this.enabled = false;
   this.instances = [];
   this.timer = null;
+  this.tracking = false;
+  this.options = {};
+  this.interval = 0;
+  this.session = 0;  // Bumped by start(), tells stale diff reports apart.
 
   // NOTE: Can not be prototype function. Difficult to bind and use with off()
   var self = this;
   this._step = function () {
     debug('instance monitoring step');
-    var state = self.addon.stopHeapDiff(true);
-    self.agent.emit('instances', { type: 'Instances', state: state });
-    self.addon.startHeapDiff();
+    if (self.tracking) {
+      var stats = self.addon.pollHeapTracking();
+      self.agent.emit('instances', { type: 'HeapTracking', state: stats });
+      return;
+    }
+    // The diff is computed off the main thread, the callback runs when
+    // it's done.  The next diff starts from there.  A status object is
+    // returned when the snapshot was over budget, there's no callback then.
+    var session = self.session;
+    var status = self.addon.stopHeapDiff(true, self.options, function(state) {
+      // Drop the report if monitoring was stopped (or restarted) meanwhile.
+      if (!self.timer || self.session !== session) return;
+      var type = self.options.columnar ? 'InstancesColumnar' : 'Instances';
+      var update = { type: type, state: state };
+      // Reports that aren't per class are properties of the summary array,
+      // hoist them out or they get lost when the array is serialized.
+      EXTRAS.forEach(function(name) {
+        if (name in state) update[name] = state[name];
+      });
+      self.agent.emit('instances', update);
+      if (state.historyError) {
+        debug('heap history append failed, %s', [state.historyError.message]);
+      }
+      self._restart();
+    });
+    // A diff without a start snapshot ('not started') has to start over
+    // too, or monitoring stops for good after one aborted start snapshot.
+    if (status && status.aborted) {
+      debug('heap snapshot aborted, %s', [status.reason]);
+      self._restart();
+    }
   };
 }
 module.exports = new Instances;
@@ -33,27 +68,116 @@ Instances.prototype.toggle = function () {
   this.enabled ? this.stop() : this.start();
 };
 
-Instances.prototype.start = function () {
+// Pass { tracking: true } to track heap object allocations instead of
+// diffing heap snapshots.  Much cheaper but it only reports totals, not
+// counts per class.  The other options are passed on to stopHeapDiff(),
+// e.g. { retainers: 3 } to find out what retains the fastest growing classes.
+// Sampling with { sample: n } makes diffs about n times cheaper, cheap enough
+// to take them more often than every 15 seconds; set { interval: ms }.
+// Snapshots can be capped with { snapshotTime: ms, snapshotSize: nodes },
+// a diff is skipped when either one is exceeded.  With { history: path },
+// the class histogram of every diff is appended to |path|, see trend().
+// The file is kept under { historySize: bytes } (16 MB by default, 0 for no
+// limit) by dropping the oldest diffs once it grows past that size.
+Instances.prototype.start = function (options) {
   if (!this.addon) {
     this.agent.info('strong-agent could not load heap monitoring add-on');
     return false;
   }
   debug('instance monitoring started');
+  this.session += 1;
   this.instances = [];
-  this.addon.startHeapDiff();
-  this.timer = Timer.repeat(15 * 1000, this._step);
+  this.options = options || {};
+  this.tracking = Boolean(options && options.tracking &&
+                          this.addon.startHeapTracking);
+  if (this.options.history && this.addon.startHeapHistory) {
+    try {
+      this.addon.startHeapHistory(this.options.history,
+                                  this.options.historySize);
+    } catch (e) {
+      this.agent.info('strong-agent could not open heap history: ' + e.message);
+    }
+  }
+  this.interval = this.options.interval || 15 * 1000;
+  this.timer = Timer.repeat(this.interval, this._step);
+  if (this.tracking) {
+    this.addon.startHeapTracking();
+  } else {
+    this._restart();
+  }
   this._step();
   this.enabled = true;
   return true;
 };
 
+// Starts the next diff and adapts the interval to the cost of the last heap
+// snapshot: taking the two snapshots of a diff should stay below 5% of the
+// time.  The interval never drops below the configured one.
+Instances.prototype._restart = function () {
+  var status = this.addon.startHeapDiff(this.options);
+  if (status && status.aborted) {
+    debug('heap snapshot aborted, over %s budget', [status.reason]);
+  }
+  var stats = this.addon.heapSnapshotStatistics;
+  if (!stats || !this.timer) return;
+  var base = this.options.interval || 15 * 1000;
+  var interval = Math.max(base, 2 * 20 * stats[2]);  // stats[2]: duration.
+  if (Math.abs(interval - this.interval) > this.interval / 4) {
+    debug('instance monitoring interval now %d ms', [interval]);
+    clearInterval(this.timer);
+    this.interval = interval;
+    this.timer = Timer.repeat(interval, this._step);
+  }
+};
+
 Instances.prototype.stop = function () {
   if (!this.addon) return;
   debug('instance monitoring stopped');
   if (this.timer) {
-    this.addon.stopHeapDiff(false);
+    if (this.tracking) {
+      this.addon.stopHeapTracking();
+    } else {
+      this.addon.stopHeapDiff(false);
+    }
     clearInterval(this.timer);
     this.timer = null;
   }
+  if (this.addon.stopHeapHistory) {
+    this.addon.stopHeapHistory();
+  }
   this.enabled = false;
 };
+
+// Writes a gzipped heap snapshot to |path|.  The snapshot is compressed and
+// written on the thread pool, it's never turned into a string in JS land.
+// The callback receives an error or null, and the number of bytes taken
+// from the snapshot and written to disk.
+Instances.prototype.writeSnapshot = function (path, options, callback) {
+  if (typeof options === 'function') {
+    callback = options;
+    options = {};
+  }
+  if (!this.addon || !this.addon.writeHeapSnapshot) {
+    process.nextTick(function() {
+      callback(new Error('heap snapshots not supported'));
+    });
+    return;
+  }
+  debug('writing heap snapshot to %s', [path]);
+  this.addon.writeHeapSnapshot(path, options || {}, function(err, stats) {
+    debug('wrote %d bytes, %d compressed', [stats.bytesIn, stats.bytesOut]);
+    callback(err || null, stats);
+  });
+};
+
+// Returns the growth of class |type| over the last |hours| hours as a
+// { total, size, intervals, first, last } object, read from the history
+// file that was passed to start().  Works after a restart too.
+Instances.prototype.trend = function (type, hours, path) {
+  path = path || this.options.history;
+  if (!this.addon || !this.addon.queryHeapHistory || !path) {
+    return null;
+  }
+  var since = Date.now() - hours * 3600 * 1000;
+  return this.addon.queryHeapHistory(path, String(type), since);
+};
@@ -7,15 +7,23 @@
 #define AGENT_SRC_HEAPDIFF_INL_H_
 
 #include "heapdiff.h"
-#include <string.h>
+#include "heaphistory-inl.h"
+#include "util-inl.h"
+
+#include <math.h>
 
 #include <algorithm>
-#include <iterator>
+#include <functional>
 
 namespace strongloop {
 namespace agent {
 namespace heapdiff {
 
+HeapGraphNodeWrap::HeapGraphNodeWrap()
+  : node_(NULL),
+    id_(0) {
+}
+
 HeapGraphNodeWrap::HeapGraphNodeWrap(const v8::HeapGraphNode* node)
   : node_(node),
     id_(node->GetId()) {
@@ -33,230 +41,1234 @@ bool HeapGraphNodeWrap::operator<(const HeapGraphNodeWrap& that) const {
   return id() < that.id();
 }
 
-Key::Key(v8::Handle<v8::String> handle)
-  : handle_(handle),
-    data_(NULL),
-    size_(0),
-    hash_(0) {
-  uint16_t* data = buffer_;
-  unsigned maxsize = SL_ARRAY_SIZE(buffer_);
-  unsigned size = 0;
-  // HINT_MANY_WRITES_EXPECTED flattens cons strings before writing on the
-  // assumption that we'll be processing the same cons strings repeatedly.
-  // Seems like a reasonable assumption to make because there will normally
-  // be many objects with the same class name.  Class names are usually flat
-  // strings to start with so it might be a wash but the hint is unlikely to
-  // hurt.
-  const int options =
-      v8::String::HINT_MANY_WRITES_EXPECTED | v8::String::NO_NULL_TERMINATION;
+TypeCounts::TypeCounts() {
+  std::fill(counts_, counts_ + kMaxTypes, 0.0);
+  std::fill(sizes_, sizes_ + kMaxTypes, 0.0);
+}
+
+void TypeCounts::Add(const v8::HeapGraphNode* node) {
+  const int type = node->GetType();
+  if (type >= 0 && type < kMaxTypes) {
+    counts_[type] += 1;
+    sizes_[type] += node->GetSelfSize();
+  }
+}
+
+void TypeCounts::Subtract(const TypeCounts& that) {
+  for (int type = 0; type < kMaxTypes; type += 1) {
+    counts_[type] -= that.counts_[type];
+    sizes_[type] -= that.sizes_[type];
+  }
+}
+
+double TypeCounts::count(int type) const {
+  return counts_[type];
+}
+
+double TypeCounts::size(int type) const {
+  return sizes_[type];
+}
+
+HeapGraphNodeSet::HeapGraphNodeSet() : size_(0), shift_(32), sorted_(false) {
+  Resize(1024);
+}
+
+void HeapGraphNodeSet::Reserve(size_t count) {
+  // Keep the load factor at or below 75%.
+  size_t capacity = slots_.size();
+  while (capacity - capacity / 4 < count) {
+    capacity *= 2;
+  }
+  if (capacity > slots_.size()) {
+    Resize(capacity);
+  }
+}
+
+bool HeapGraphNodeSet::Insert(const HeapGraphNodeWrap& wrap) {
+  // Node ids are handed out sequentially, Fibonacci hashing spreads them
+  // out evenly over the table.
+  const size_t mask = slots_.size() - 1;
+  size_t index = (wrap.id() * 2654435769u) >> shift_;
   for (;;) {
-    // The choice for String::Write() is intentional.  String::WriteAscii() and
-    // particularly String::WriteUtf8() are tremendously slow in comparison.
-    size += handle->Write(data + size, size, maxsize - size, options);
-    if (size < maxsize) {
+    HeapGraphNodeWrap& slot = slots_[index];
+    if (slot.id() == wrap.id()) {
+      return false;
+    }
+    if (slot.id() == 0) {
+      slot = wrap;
       break;
     }
-    unsigned const new_maxsize = 2 * maxsize;
-    if (new_maxsize >= kMaxSize) {
-      if (data != buffer_) {
-        delete[] data;
+    index = (index + 1) & mask;
+  }
+  size_ += 1;
+  if (size_ > slots_.size() - slots_.size() / 4) {
+    Resize(2 * slots_.size());
+  }
+  return true;
+}
+
+void HeapGraphNodeSet::Sort() {
+  if (sorted_ == true) {
+    return;
+  }
+  // Squeeze out the empty slots, then release the excess capacity.
+  HeapGraphNodeVector::iterator it = slots_.begin();
+  for (HeapGraphNodeVector::const_iterator src = slots_.begin(),
+       end = slots_.end(); src != end; ++src) {
+    if (src->id() != 0) {
+      *it++ = *src;
+    }
+  }
+  slots_.erase(it, slots_.end());
+  HeapGraphNodeVector(slots_).swap(slots_);
+  std::sort(slots_.begin(), slots_.end());
+  sorted_ = true;
+}
+
+HeapGraphNodeSet::const_iterator HeapGraphNodeSet::begin() const {
+  return slots_.begin();
+}
+
+HeapGraphNodeSet::const_iterator HeapGraphNodeSet::end() const {
+  return slots_.end();
+}
+
+size_t HeapGraphNodeSet::size() const {
+  return size_;
+}
+
+size_t HeapGraphNodeSet::Find(v8::SnapshotObjectId id) const {
+  // Binary search.  Doesn't need the memory for an auxiliary index and it's
+  // only a couple of cache misses more than a hash table lookup.
+  size_t low = 0;
+  size_t high = slots_.size();
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (slots_[middle].id() < id) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low < slots_.size() && slots_[low].id() == id) {
+    return low;
+  }
+  return slots_.size();
+}
+
+const HeapGraphNodeWrap& HeapGraphNodeSet::operator[](size_t index) const {
+  return slots_[index];
+}
+
+void HeapGraphNodeSet::Resize(size_t capacity) {
+  HeapGraphNodeVector slots(capacity);
+  slots.swap(slots_);
+  size_ = 0;
+  shift_ = 32;
+  for (size_t n = capacity; n > 1; n >>= 1) {
+    shift_ -= 1;
+  }
+  for (HeapGraphNodeVector::const_iterator it = slots.begin(),
+       end = slots.end(); it != end; ++it) {
+    if (it->id() != 0) {
+      Insert(*it);
+    }
+  }
+}
+
+Score::Score() : count_(0), size_(0), changes_(0), squares_(0) {
+}
+
+int Score::count() const {
+  return count_;
+}
+
+int Score::size() const {
+  return size_;
+}
+
+int Score::changes() const {
+  return changes_;
+}
+
+double Score::squares() const {
+  return squares_;
+}
+
+void Score::Plus(int size) {
+  count_ += 1, size_ += size;
+  changes_ += 1, squares_ += static_cast<double>(size) * size;
+}
+
+void Score::Minus(int size) {
+  count_ -= 1, size_ -= size;
+  changes_ += 1, squares_ += static_cast<double>(size) * size;
+}
+
+const uint32_t HeapGraph::kNone;
+
+HeapGraph::HeapGraph() {
+}
+
+bool HeapGraph::Build(const HeapGraphNodeSet& nodes, uint64_t deadline) {
+  offsets_.clear();
+  edges_.clear();
+  offsets_.reserve(nodes.size() + 1);
+  for (size_t index = 0; index < nodes.size(); index += 1) {
+    if (index % 4096 == 4095 && uv_hrtime() > deadline) {
+      offsets_.clear();
+      edges_.clear();
+      return false;
+    }
+    offsets_.push_back(static_cast<uint32_t>(edges_.size()));
+    const v8::HeapGraphNode* node = nodes[index].node();
+    const int children_count = node->GetChildrenCount();
+    for (int child = 0; child < children_count; child += 1) {
+      const v8::HeapGraphEdge* edge = node->GetChild(child);
+      if (IsInterestingEdge(edge->GetType()) == false) {
+        continue;
+      }
+      // Heap numbers aren't in the node set, HeapGraphWalker skips them.
+      const size_t to = nodes.Find(edge->GetToNode()->GetId());
+      if (to < nodes.size()) {
+        edges_.push_back(static_cast<uint32_t>(to));
       }
-      return;
     }
-    uint16_t* const new_data = new uint16_t[new_maxsize];
-    ::memcpy(new_data, data, maxsize * sizeof(*data));
-    if (data != buffer_) {
-      delete[] data;
+  }
+  offsets_.push_back(static_cast<uint32_t>(edges_.size()));
+  return true;
+}
+
+void HeapGraph::Reverse(const HeapGraph& graph) {
+  // Counting sort on the target node of every edge.
+  const uint32_t count = graph.size();
+  offsets_.assign(count + 1, 0);
+  for (std::vector<uint32_t>::const_iterator it = graph.edges_.begin(),
+       end = graph.edges_.end(); it != end; ++it) {
+    offsets_[*it + 1] += 1;
+  }
+  for (uint32_t index = 0; index < count; index += 1) {
+    offsets_[index + 1] += offsets_[index];
+  }
+  edges_.resize(graph.edges_.size());
+  std::vector<uint32_t> cursors(offsets_.begin(), offsets_.end() - 1);
+  for (uint32_t from = 0; from < count; from += 1) {
+    for (const uint32_t* it = graph.begin(from); it != graph.end(from); ++it) {
+      edges_[cursors[*it]++] = from;
     }
-    data = new_data;
-    maxsize = new_maxsize;
   }
-  data_ = data;
-  size_ = size;
-  hash_ = JenkinsHash(reinterpret_cast<const uint8_t*>(data), size);
 }
 
-Key::~Key() {
-  if (data_ != buffer_) {
-    delete[] data_;
+uint32_t HeapGraph::size() const {
+  return offsets_.empty() ? 0 : static_cast<uint32_t>(offsets_.size() - 1);
+}
+
+const uint32_t* HeapGraph::begin(uint32_t index) const {
+  return edges_.empty() ? NULL : &edges_[0] + offsets_[index];
+}
+
+const uint32_t* HeapGraph::end(uint32_t index) const {
+  return edges_.empty() ? NULL : &edges_[0] + offsets_[index + 1];
+}
+
+DominatorTree::DominatorTree() {
+}
+
+bool DominatorTree::Build(const HeapGraph& graph,
+                          uint32_t root,
+                          uint64_t deadline) {
+  const uint32_t kNone = HeapGraph::kNone;
+  const uint32_t count = graph.size();
+
+  // Number the nodes in depth-first order.  |order_| maps depth-first
+  // numbers to nodes, |number| maps nodes to depth-first numbers.
+  // Iterative for the same reason that HeapGraphWalker is.
+  std::vector<uint32_t> number(count, kNone);
+  std::vector<uint32_t> parent;  // Indexed by depth-first number.
+  std::vector<const uint32_t*> cursors;
+  order_.clear();
+  order_.reserve(count);
+  parent.reserve(count);
+  number[root] = 0;
+  order_.push_back(root);
+  parent.push_back(kNone);
+  stack_.clear();
+  stack_.push_back(root);
+  cursors.push_back(graph.begin(root));
+  while (stack_.empty() == false) {
+    const uint32_t v = stack_.back();
+    const uint32_t* const cursor = cursors.back();
+    if (cursor == graph.end(v)) {
+      stack_.pop_back();
+      cursors.pop_back();
+      continue;
+    }
+    cursors.back() = cursor + 1;
+    const uint32_t w = *cursor;
+    if (number[w] == kNone) {
+      if (order_.size() % 4096 == 4095 && uv_hrtime() > deadline) {
+        Reset();
+        return false;
+      }
+      number[w] = static_cast<uint32_t>(order_.size());
+      order_.push_back(w);
+      parent.push_back(number[v]);
+      stack_.push_back(w);
+      cursors.push_back(graph.begin(w));
+    }
+  }
+  std::vector<const uint32_t*>().swap(cursors);
+
+  // From here on, everything is in depth-first number space.
+  const uint32_t reached = static_cast<uint32_t>(order_.size());
+  HeapGraph predecessors;
+  predecessors.Reverse(graph);
+  std::vector<uint32_t> dominator(reached, kNone);
+  std::vector<uint32_t> bucket_head(reached, kNone);
+  std::vector<uint32_t> bucket_next(reached, kNone);
+  ancestor_.assign(reached, kNone);
+  label_.resize(reached);
+  semi_.resize(reached);
+  for (uint32_t v = 0; v < reached; v += 1) {
+    label_[v] = semi_[v] = v;
   }
+  for (uint32_t w = reached - 1; w > 0; w -= 1) {
+    if (w % 4096 == 0 && uv_hrtime() > deadline) {
+      Reset();
+      return false;
+    }
+    const uint32_t node = order_[w];
+    for (const uint32_t* it = predecessors.begin(node),
+         *end = predecessors.end(node); it != end; ++it) {
+      const uint32_t v = number[*it];
+      if (v == kNone) {
+        continue;  // Unreachable from the root.
+      }
+      const uint32_t u = Eval(v);
+      if (semi_[u] < semi_[w]) {
+        semi_[w] = semi_[u];
+      }
+    }
+    bucket_next[w] = bucket_head[semi_[w]];
+    bucket_head[semi_[w]] = w;
+    const uint32_t p = parent[w];
+    ancestor_[w] = p;  // Link(p, w)
+    for (uint32_t v = bucket_head[p]; v != kNone; v = bucket_next[v]) {
+      const uint32_t u = Eval(v);
+      dominator[v] = semi_[u] < semi_[v] ? u : p;
+    }
+    bucket_head[p] = kNone;
+  }
+  for (uint32_t w = 1; w < reached; w += 1) {
+    if (dominator[w] != semi_[w]) {
+      dominator[w] = dominator[dominator[w]];
+    }
+  }
+
+  // Translate back to node indices and release the scratch space.
+  idom_.assign(count, kNone);
+  for (uint32_t w = 1; w < reached; w += 1) {
+    idom_[order_[w]] = order_[dominator[w]];
+  }
+  std::vector<uint32_t>().swap(ancestor_);
+  std::vector<uint32_t>().swap(label_);
+  std::vector<uint32_t>().swap(semi_);
+  std::vector<uint32_t>().swap(stack_);
+  return true;
+}
+
+void DominatorTree::Reset() {
+  std::vector<uint32_t>().swap(idom_);
+  std::vector<uint32_t>().swap(order_);
+  std::vector<uint32_t>().swap(ancestor_);
+  std::vector<uint32_t>().swap(label_);
+  std::vector<uint32_t>().swap(semi_);
+  std::vector<uint32_t>().swap(stack_);
+}
+
+uint32_t DominatorTree::idom(uint32_t index) const {
+  return idom_[index];
+}
+
+const std::vector<uint32_t>& DominatorTree::order() const {
+  return order_;
 }
 
-Key::Key(const Key& that)
-  : handle_(that.handle_),
-    data_(that.data_),
-    size_(that.size_),
-    hash_(that.hash_) {
-  if (that.data_ == that.buffer_) {
-    data_ = static_cast<uint16_t*>(::memcpy(buffer_, that.buffer_, that.size_));
+uint32_t DominatorTree::Eval(uint32_t v) {
+  if (ancestor_[v] == HeapGraph::kNone) {
+    return v;
   }
-  that.data_ = NULL;
-  that.size_ = 0;
-  that.hash_ = 0;
+  Compress(v);
+  return label_[v];
 }
 
-bool Key::operator<(const Key& that) const {
-  if (hash() < that.hash()) {
-    return true;
+void DominatorTree::Compress(uint32_t v) {
+  // Iterative version of the textbook recursive path compression.  Collect
+  // the path up to the root of the forest, then compress it top-down.
+  stack_.clear();
+  for (uint32_t x = v; ancestor_[ancestor_[x]] != HeapGraph::kNone;
+       x = ancestor_[x]) {
+    stack_.push_back(x);
   }
-  if (hash() > that.hash()) {
-    return false;
+  while (stack_.empty() == false) {
+    const uint32_t x = stack_.back();
+    const uint32_t a = ancestor_[x];
+    stack_.pop_back();
+    if (semi_[label_[a]] < semi_[label_[x]]) {
+      label_[x] = label_[a];
+    }
+    ancestor_[x] = ancestor_[a];
   }
-  if (size() < that.size()) {
-    return true;
+}
+
+Watermarks::Watermarks() {
+}
+
+void Watermarks::Add(v8::SnapshotObjectId id) {
+  if (ids_.size() == kMaxSize) {
+    ids_.erase(ids_.begin());
   }
-  if (size() > that.size()) {
-    return false;
+  ids_.push_back(id);
+}
+
+uint32_t Watermarks::Age(v8::SnapshotObjectId id) const {
+  return static_cast<uint32_t>(
+      std::lower_bound(ids_.begin(), ids_.end(), id) - ids_.begin());
+}
+
+size_t Watermarks::size() const {
+  return ids_.size();
+}
+
+void AppendAscii(std::vector<uint16_t>* out, const char* s) {
+  while (*s != '\0') {
+    out->push_back(static_cast<uint8_t>(*s++));
   }
-  return ::memcmp(data(), that.data(), size()) < 0;
 }
 
-v8::Handle<v8::String> Key::handle() const {
-  return handle_;
+void AppendName(std::vector<uint16_t>* out,
+                const StringTable* names,
+                uint32_t index) {
+  const uint16_t* data = names->data(index);
+  out->insert(out->end(), data, data + names->size(index));
 }
 
-const uint16_t* Key::data() const {
-  return data_;
+void AppendNodeLabel(std::vector<uint16_t>* out,
+                     StringTable* names,
+                     const v8::HeapGraphNode* node) {
+  // The name of a string node is its contents and the name of an array is
+  // usually empty; don't print those.
+  switch (node->GetType()) {
+    case v8::HeapGraphNode::kArray:
+      AppendAscii(out, "(array)");
+      break;
+    case v8::HeapGraphNode::kString:
+#if SL_NODE_VERSION == 12
+    case v8::HeapGraphNode::kConsString:
+    case v8::HeapGraphNode::kSlicedString:
+#endif
+      AppendAscii(out, "(string)");
+      break;
+    case v8::HeapGraphNode::kRegExp:
+      AppendAscii(out, "(regexp)");
+      break;
+    default:
+      AppendName(out, names, names->Intern(node->GetName()));
+      break;
+  }
 }
 
-unsigned Key::size() const {
-  return size_;
+void AppendEdgeLabel(std::vector<uint16_t>* out,
+                     StringTable* names,
+                     const v8::HeapGraphEdge* edge) {
+  v8::Handle<v8::Value> name = edge->GetName();
+  if (name->IsString()) {
+    out->push_back('.');
+    AppendName(out, names, names->Intern(name.As<v8::String>()));
+  } else {
+    // Element index.
+    char digits[16];
+    char* p = digits + sizeof(digits);
+    *--p = '\0';
+    uint32_t value = name->Uint32Value();
+    do {
+      *--p = '0' + value % 10;
+      value /= 10;
+    } while (value != 0);
+    out->push_back('[');
+    AppendAscii(out, p);
+    out->push_back(']');
+  }
 }
 
-uint32_t Key::hash() const {
-  return hash_;
+const uint32_t ClosureKeys::kNone;
+
+ClosureKeys::ClosureKeys(v8::Isolate* isolate)
+  : isolate_(isolate),
+    closure_string_(FixedString(isolate, "closure")),
+    context_string_(FixedString(isolate, "system / Context")),
+    context_edge_string_(FixedString(isolate, "context")),
+    script_string_(FixedString(isolate, "script")),
+    shared_string_(FixedString(isolate, "shared")) {
 }
 
-Score::Score() : count_(0), size_(0) {
+uint32_t ClosureKeys::ForClosure(StringTable* locations,
+                                 const v8::HeapGraphNode* closure) {
+  scratch_.clear();
+  v8::Handle<v8::String> name = closure->GetName();
+  if (name->Length() == 0) {
+    AppendAscii(&scratch_, "(anonymous)");
+  } else {
+    Append(name);
+  }
+  // JSFunction -> SharedFunctionInfo -> Script.  Builtins have no script.
+  const v8::HeapGraphNode* shared = FindInternalEdge(closure, shared_string_);
+  const v8::HeapGraphNode* script =
+      shared != NULL ? FindInternalEdge(shared, script_string_) : NULL;
+  if (script != NULL) {
+    scratch_.push_back(' ');
+    Append(script->GetName());
+  }
+  return locations->Intern(&scratch_[0], scratch_.size());
 }
 
-int Score::count() const {
-  return count_;
+uint32_t ClosureKeys::ForContext(StringTable* locations,
+                                 const v8::HeapGraphNode* node) {
+  // Function contexts are hidden nodes in V8 3.14 and "system / Context"
+  // objects in newer versions.  Go by the name, not the type.
+  if (node->GetName()->StrictEquals(context_string_) == false) {
+    return kNone;
+  }
+  // Native contexts don't belong to a closure.
+  const v8::HeapGraphNode* closure = FindInternalEdge(node, closure_string_);
+  if (closure == NULL || closure->GetType() != v8::HeapGraphNode::kClosure) {
+    return kNone;
+  }
+  return ForClosure(locations, closure);
 }
 
-int Score::size() const {
-  return size_;
+void ClosureKeys::AddContexts(const HeapGraphNodeSet& objects,
+                              HeapGraphNodeSet* contexts) {
+  for (HeapGraphNodeSet::const_iterator it = objects.begin(),
+       end = objects.end(); it != end; ++it) {
+    const v8::HeapGraphNode* node = it->node();
+    if (node->GetType() != v8::HeapGraphNode::kClosure) {
+      continue;
+    }
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate_);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    const v8::HeapGraphNode* context =
+        FindInternalEdge(node, context_edge_string_);
+    if (context != NULL) {
+      contexts->Insert(HeapGraphNodeWrap(context));
+    }
+  }
+  contexts->Sort();
 }
 
-void Score::Plus(const HeapGraphNodeWrap& wrap) {
-  const v8::HeapGraphNode* node = wrap.node();
-  count_ += 1, size_ += node->GetSelfSize();
+const v8::HeapGraphNode* ClosureKeys::FindInternalEdge(
+    const v8::HeapGraphNode* node,
+    v8::Local<v8::String> name) const {
+  const int children_count = node->GetChildrenCount();
+  for (int child = 0; child < children_count; child += 1) {
+    const v8::HeapGraphEdge* edge = node->GetChild(child);
+    if (edge->GetType() == v8::HeapGraphEdge::kInternal &&
+        edge->GetName()->StrictEquals(name)) {
+      return edge->GetToNode();
+    }
+  }
+  return NULL;
 }
 
-void Score::Minus(const HeapGraphNodeWrap& wrap) {
-  const v8::HeapGraphNode* node = wrap.node();
-  count_ -= 1, size_ -= node->GetSelfSize();
+void ClosureKeys::Append(v8::Handle<v8::String> string) {
+  const size_t offset = scratch_.size();
+  const int length = string->Length();
+  scratch_.resize(offset + length);
+  if (length > 0) {
+    string->Write(&scratch_[offset], 0, length);
+  }
 }
 
-uint32_t JenkinsHash(const uint8_t* data, unsigned size) {
-  uint32_t hash = 0;
-  for (unsigned index = 0; index < size; index += 1) {
-    hash += data[index];
-    hash += hash << 10;
-    hash ^= hash >> 6;
+const uint32_t DigestEntry::kMaxSize;
+
+uint32_t DigestSize(const v8::HeapGraphNode* node) {
+  const double size = node->GetSelfSize();
+  return size < DigestEntry::kMaxSize ? static_cast<uint32_t>(size) :
+                                        DigestEntry::kMaxSize;
+}
+
+bool CompareEntryId(const DigestEntry& a, const DigestEntry& b) {
+  return a.id < b.id;
+}
+
+HeapDigest::HeapDigest() : sample_(1), closures_(0), types_(false) {
+}
+
+void HeapDigest::Build(v8::Isolate* isolate,
+                       const v8::HeapSnapshot* snapshot,
+                       const Options& options,
+                       const Watermarks& history) {
+  sample_ = options.sample > 1 ? options.sample : 1;
+  closures_ = sample_ == 1 ? options.closures : 0;
+  types_ = options.types;
+  type_counts_ = TypeCounts();
+  TypeCounts* const counts = types_ ? &type_counts_ : NULL;
+  watermarks_ = history;
+  watermarks_.Add(snapshot->GetMaxSnapshotJSObjectId());
+  HeapGraphNodeSet objects;
+  if (sample_ > 1) {
+    SampleObjects(snapshot, sample_, &objects, counts);
+  } else {
+    objects.Reserve(snapshot->GetNodesCount());
+    HeapGraphWalker walker;
+    walker.Walk(snapshot->GetRoot(), &objects, counts);
   }
-  hash += hash << 3;
-  hash ^= hash >> 11;
-  hash += hash << 15;
-  return hash;
+  objects.Sort();
+  entries_.clear();
+#if SL_NODE_VERSION == 12
+  v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+  v8::HandleScope handle_scope;
+#endif
+  ClosureKeys keys(isolate);
+  // Contexts are recorded when they're the context of a walked closure,
+  // whether or not the walk reached them by itself.  HeapDiff::Finish()
+  // finds the contexts in the end snapshot the same way.
+  HeapGraphNodeSet contexts;
+  if (closures_ > 0) {
+    keys.AddContexts(objects, &contexts);
+  }
+  for (HeapGraphNodeSet::const_iterator it = objects.begin(),
+       end = objects.end(); it != end; ++it) {
+    const v8::HeapGraphNode* node = it->node();
+    const v8::HeapGraphNode::Type type = node->GetType();
+    if (type != v8::HeapGraphNode::kObject &&
+        (closures_ == 0 || type != v8::HeapGraphNode::kClosure)) {
+      continue;
+    }
+    if (closures_ > 0 && contexts.Find(it->id()) < contexts.size()) {
+      continue;  // Recorded below.
+    }
+    // GetName() creates a new handle every time.  Release them as we go,
+    // a big heap has millions of objects.
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    DigestEntry entry;
+    entry.id = it->id();
+    entry.size = DigestSize(node);
+    if (type == v8::HeapGraphNode::kObject) {
+      entry.kind = kObjectEntry;
+      entry.name = names_.Intern(node->GetName());
+    } else {
+      entry.kind = kClosureEntry;
+      entry.name = keys.ForClosure(&locations_, node);
+    }
+    entries_.push_back(entry);
+  }
+  const size_t objects_count = entries_.size();
+  for (HeapGraphNodeSet::const_iterator it = contexts.begin(),
+       end = contexts.end(); it != end; ++it) {
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    DigestEntry entry;
+    entry.id = it->id();
+    entry.size = DigestSize(it->node());
+    entry.kind = kContextEntry;
+    entry.name = keys.ForContext(&locations_, it->node());
+    if (entry.name != ClosureKeys::kNone) {
+      entries_.push_back(entry);
+    }
+  }
+  // Both sets are sorted, merge their entries.  Trim the excess capacity,
+  // the digest lives for the duration of the heap diff.
+  std::inplace_merge(entries_.begin(),
+                     entries_.begin() + objects_count,
+                     entries_.end(),
+                     CompareEntryId);
+  std::vector<DigestEntry>(entries_).swap(entries_);
+}
+
+const std::vector<DigestEntry>& HeapDigest::entries() const {
+  return entries_;
+}
+
+StringTable* HeapDigest::names() {
+  return &names_;
+}
+
+StringTable* HeapDigest::locations() {
+  return &locations_;
+}
+
+uint32_t HeapDigest::sample() const {
+  return sample_;
+}
+
+uint32_t HeapDigest::closures() const {
+  return closures_;
+}
+
+const TypeCounts* HeapDigest::type_counts() const {
+  return types_ ? &type_counts_ : NULL;
 }
 
-void AddHeapGraphNodeToSet(const v8::HeapGraphNode* node,
-                           HeapGraphNodeSet* set) {
+const Watermarks& HeapDigest::watermarks() const {
+  return watermarks_;
+}
+
+bool IsSampled(v8::SnapshotObjectId id, uint32_t sample) {
+  // Ids are even and handed out sequentially; hash them first, else every
+  // other bucket would be empty.
+  return ((static_cast<uint32_t>(id) * 2654435769u) >> 8) % sample == 0;
+}
+
+void SampleObjects(const v8::HeapSnapshot* snapshot,
+                   uint32_t sample,
+                   HeapGraphNodeSet* set,
+                   TypeCounts* counts) {
+  const int nodes_count = snapshot->GetNodesCount();
+  set->Reserve(nodes_count / sample);
+  for (int index = 0; index < nodes_count; index += 1) {
+    const v8::HeapGraphNode* node = snapshot->GetNode(index);
+    if (counts != NULL) {
+      counts->Add(node);
+    }
+    const int children_count = node->GetChildrenCount();
+    for (int child = 0; child < children_count; child += 1) {
+      const v8::HeapGraphEdge* edge = node->GetChild(child);
+      if (IsInterestingEdge(edge->GetType()) == false) {
+        continue;
+      }
+      const v8::HeapGraphNode* target = edge->GetToNode();
+      if (target->GetType() != v8::HeapGraphNode::kObject) {
+        continue;
+      }
+      const HeapGraphNodeWrap wrap(target);
+      if (IsSampled(wrap.id(), sample)) {
+        set->Insert(wrap);  // No-op if another edge got there first.
+      }
+    }
+  }
+}
+
+bool IsInterestingEdge(v8::HeapGraphEdge::Type type) {
+  // Filter out uninteresting edge types.
+  //
+  //  - Internal links are cons strings slices, relocation data, etc.
+  //  - Shortcuts are predominantly the glue objects for functions bound
+  //    with Function#bind().
+  //  - Weak references (almost?) always point to internal oddbals that
+  //    cannot be inspected.
+  //
+  // Hidden links need to be followed!  While they are usually backlinks for
+  // retained size calculations, in V8 3.14 they also interact with eval().
+  // It should be safe to skip them with V8 3.22 and newer but I'm reluctant
+  // to introduce multiple code paths for something that has relatively
+  // little overhead.  See also test/test-addon-heapdiff-eval.js.
+  return type != v8::HeapGraphEdge::kInternal &&
+         type != v8::HeapGraphEdge::kShortcut &&
+         type != v8::HeapGraphEdge::kWeak;
+}
+
+HeapGraphWalker::HeapGraphWalker() : counts_(NULL), numbers_(NULL) {
+}
+
+void HeapGraphWalker::Walk(const v8::HeapGraphNode* root,
+                           HeapGraphNodeSet* set,
+                           TypeCounts* counts) {
+  HeapGraphNodeSet numbers;
+  counts_ = counts;
+  numbers_ = &numbers;
+  stack_.clear();
+  Visit(root, set);
+  while (stack_.empty() == false) {
+    const v8::HeapGraphNode* node = stack_.back();
+    stack_.pop_back();
+    // A node's edges are stored contiguously in the snapshot.  Scanning them
+    // in one go before descending is a lot friendlier on the CPU cache than
+    // the recursive walk, which had to find its way back to the next edge
+    // after returning from every child.
+    const int children_count = node->GetChildrenCount();
+    for (int index = 0; index < children_count; index += 1) {
+      const v8::HeapGraphEdge* edge = node->GetChild(index);
+      if (IsInterestingEdge(edge->GetType())) {
+        Visit(edge->GetToNode(), set);
+      }
+    }
+  }
+  counts_ = NULL;
+  numbers_ = NULL;
+}
+
+void HeapGraphWalker::Visit(const v8::HeapGraphNode* node,
+                            HeapGraphNodeSet* set) {
   // Heap numbers are numbers that don't fit in a SMI (a tagged pointer),
   // either because they're fractional or too large.  I'm not 100% sure
   // it's okay to filter them out because excessive heap number allocation
   // is a somewhat frequent source of performance issues.  On the other hand,
-  // we're serializing the heap snapshot and sending it over the wire.
-  // Including heap numbers would balloon the size of the payload.
-  // Maybe we should simply keep track of the _number_ of heap numbers.
+  // there are lots of them and they'd make the diff a good deal bigger.
+  // Instead, they're only counted, and only when the caller asks for it.
+  // They have no interesting children, there's no need to push them.
   if (node->GetType() == v8::HeapGraphNode::kHeapNumber) {
+    if (counts_ != NULL && numbers_->Insert(HeapGraphNodeWrap(node))) {
+      counts_->Add(node);
+    }
     return;
   }
-  if (set->insert(HeapGraphNodeWrap(node)).second == false) {
-    // Already in set.  We've processed this node before so there's no need
-    // to iterate over its children.
+  // Nodes are marked as seen when they're discovered, not when they're
+  // expanded.  That way, every node is pushed at most once and the stack
+  // never grows beyond the number of nodes in the snapshot.
+  if (set->Insert(HeapGraphNodeWrap(node)) == true) {
+    if (counts_ != NULL) {
+      counts_->Add(node);
+    }
+    stack_.push_back(node);
+  }
+}
+
+HeapStats::HeapStats()
+  : known_intervals_(0),
+    allocated_count_(0),
+    allocated_size_(0),
+    freed_count_(0),
+    freed_size_(0),
+    live_count_(0),
+    live_size_(0) {
+}
+
+void HeapStats::Reset() {
+  known_intervals_ = intervals_.size();
+  allocated_count_ = allocated_size_ = 0;
+  freed_count_ = freed_size_ = 0;
+}
+
+v8::Local<v8::Object> HeapStats::ToObject(v8::Isolate* isolate) const {
+  struct {
+    v8::Local<v8::String> name;
+    double value;
+  } fields[] = {
+    { FixedString(isolate, "allocatedCount"), allocated_count_ },
+    { FixedString(isolate, "allocatedSize"), allocated_size_ },
+    { FixedString(isolate, "freedCount"), freed_count_ },
+    { FixedString(isolate, "freedSize"), freed_size_ },
+    { FixedString(isolate, "liveCount"), live_count_ },
+    { FixedString(isolate, "liveSize"), live_size_ },
+  };
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name,
+                v8::Number::New(isolate, fields[index].value));
+  }
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name, v8::Number::New(fields[index].value));
+  }
+#endif
+  return object;
+}
+
+void HeapStats::EndOfStream() {
+}
+
+v8::OutputStream::WriteResult HeapStats::WriteAsciiChunk(char*, int) {
+  return kAbort;  // Not a heap snapshot serializer.
+}
+
+v8::OutputStream::WriteResult HeapStats::WriteHeapStatsChunk(
+    v8::HeapStatsUpdate* data,
+    int count) {
+  for (int index = 0; index < count; index += 1) {
+    const v8::HeapStatsUpdate& update = data[index];
+    if (update.index >= intervals_.size()) {
+      const v8::HeapStatsUpdate empty = { 0, 0, 0 };
+      intervals_.resize(update.index + 1, empty);
+    }
+    v8::HeapStatsUpdate& interval = intervals_[update.index];
+    // Live counts of old intervals only ever go down.  New intervals are
+    // all allocations.
+    if (update.index < known_intervals_) {
+      freed_count_ += static_cast<double>(interval.count) - update.count;
+      freed_size_ += static_cast<double>(interval.size) - update.size;
+    } else {
+      allocated_count_ += update.count;
+      allocated_size_ += update.size;
+    }
+    live_count_ += static_cast<double>(update.count) - interval.count;
+    live_size_ += static_cast<double>(update.size) - interval.size;
+    interval = update;
+  }
+  return kContinue;
+}
+
+Options::Options()
+  : retained(0),
+    retainers(0),
+    retainer_paths(3),
+    retainer_time(250),
+    sample(1),
+    columnar(false),
+    ages(false),
+    strings(0),
+    string_budget(8 << 20),
+    closures(0),
+    types(false),
+    snapshot_time(0),
+    snapshot_size(0) {
+}
+
+void ParseOptions(v8::Isolate* isolate,
+                  v8::Handle<v8::Value> value,
+                  Options* options) {
+  if (value->IsObject() == false) {
     return;
   }
-  const int children_count = node->GetChildrenCount();
-  for (int index = 0; index < children_count; index += 1) {
-    const v8::HeapGraphEdge* edge = node->GetChild(index);
-    const v8::HeapGraphEdge::Type type = edge->GetType();
-    // Filter out uninteresting edge types.
-    //
-    //  - Internal links are cons strings slices, relocation data, etc.
-    //  - Shortcuts are predominantly the glue objects for functions bound
-    //    with Function#bind().
-    //  - Weak references (almost?) always point to internal oddbals that
-    //    cannot be inspected.
-    //
-    // Hidden links need to be followed!  While they are usually backlinks for
-    // retained size calculations, in V8 3.14 they also interact with eval().
-    // It should be safe to skip them with V8 3.22 and newer but I'm reluctant
-    // to introduce multiple code paths for something that has relatively
-    // little overhead.  See also test/test-addon-heapdiff-eval.js.
-    if (type != v8::HeapGraphEdge::kInternal &&
-        type != v8::HeapGraphEdge::kShortcut &&
-        type != v8::HeapGraphEdge::kWeak) {
-      AddHeapGraphNodeToSet(edge->GetToNode(), set);
-    }
-  }
-}
-
-template <void (Score::*Method)(const HeapGraphNodeWrap&)>
-struct SummarizeHelper {
-  typedef ptrdiff_t difference_type;
-  typedef std::output_iterator_tag iterator_category;
-  typedef Score* pointer;
-  typedef Score& reference;
-  typedef Score value_type;
-  explicit SummarizeHelper(HeapGraphNodeMap* map) : map_(map) {
-  }
-  void operator++() {
-  }
-  SummarizeHelper& operator*() {
-    return *this;
-  }
-  void operator=(const HeapGraphNodeWrap& wrap) {
-    const v8::HeapGraphNode* node = wrap.node();
-    if (node->GetType() != v8::HeapGraphNode::kObject) {
-      return;
-    }
-    Key key(node->GetName());
-    if (key.data() == NULL) {
-      return;  // Bailed out because string is too big.
-    }
-    Score& score = (*map_)[key];
-    (score.*Method)(wrap);
-  }
-  HeapGraphNodeMap* map_;
-};
+  v8::Handle<v8::Object> object = value.As<v8::Object>();
+  options->retained =
+      object->Get(FixedString(isolate, "retained"))->Uint32Value();
+  options->retainers =
+      object->Get(FixedString(isolate, "retainers"))->Uint32Value();
+  v8::Local<v8::Value> retainer_paths =
+      object->Get(FixedString(isolate, "retainerPaths"));
+  if (retainer_paths->IsNumber()) {
+    // Zero would leave FindRetainerPaths() no room for the first path.
+    options->retainer_paths =
+        std::max(std::min(retainer_paths->Uint32Value(), 16u), 1u);
+  }
+  v8::Local<v8::Value> retainer_time =
+      object->Get(FixedString(isolate, "retainerTime"));
+  if (retainer_time->IsNumber()) {
+    options->retainer_time = retainer_time->Uint32Value();
+  }
+  v8::Local<v8::Value> sample = object->Get(FixedString(isolate, "sample"));
+  if (sample->IsNumber() && sample->Uint32Value() > 1) {
+    options->sample = sample->Uint32Value();
+  }
+  options->columnar =
+      object->Get(FixedString(isolate, "columnar"))->BooleanValue();
+  options->ages = object->Get(FixedString(isolate, "ages"))->BooleanValue();
+  options->strings =
+      std::min(object->Get(FixedString(isolate, "strings"))->Uint32Value(),
+               100u);
+  v8::Local<v8::Value> string_budget =
+      object->Get(FixedString(isolate, "stringBudget"));
+  if (string_budget->IsNumber()) {
+    options->string_budget = string_budget->Uint32Value();
+  }
+  options->closures =
+      std::min(object->Get(FixedString(isolate, "closures"))->Uint32Value(),
+               100u);
+  options->types = object->Get(FixedString(isolate, "types"))->BooleanValue();
+  options->snapshot_time =
+      object->Get(FixedString(isolate, "snapshotTime"))->Uint32Value();
+  options->snapshot_size =
+      object->Get(FixedString(isolate, "snapshotSize"))->Uint32Value();
+}
 
-v8::Local<v8::Object> Summarize(v8::Isolate* isolate,
-                                const v8::HeapSnapshot* start_snapshot,
-                                const v8::HeapSnapshot* end_snapshot) {
-  HeapGraphNodeSet start_objects;
-  HeapGraphNodeSet end_objects;
-  AddHeapGraphNodeToSet(start_snapshot->GetRoot(), &start_objects);
-  AddHeapGraphNodeToSet(end_snapshot->GetRoot(), &end_objects);
-
-  HeapGraphNodeMap summary;
-  HeapGraphNodeVector added_objects;
-  HeapGraphNodeVector removed_objects;
-  std::set_difference(end_objects.begin(),
-                      end_objects.end(),
-                      start_objects.begin(),
-                      start_objects.end(),
-                      SummarizeHelper<&Score::Plus>(&summary));
-  std::set_difference(start_objects.begin(),
-                      start_objects.end(),
-                      end_objects.begin(),
-                      end_objects.end(),
-                      SummarizeHelper<&Score::Minus>(&summary));
+SnapshotControl::SnapshotControl(const Options& options,
+                                 uint32_t* statistics)
+  : start_(uv_hrtime()),
+    deadline_(options.snapshot_time > 0 ?
+              start_ + options.snapshot_time * static_cast<uint64_t>(1e6) :
+              0),
+    size_budget_(options.snapshot_size),
+    reason_(NULL),
+    statistics_(statistics) {
+  statistics_[kProgressDone] = 0;
+  statistics_[kProgressTotal] = 0;
+}
+
+v8::ActivityControl::ControlOption SnapshotControl::ReportProgressValue(
+    int done,
+    int total) {
+  statistics_[kProgressDone] = done;
+  statistics_[kProgressTotal] = total;
+  if (size_budget_ > 0 && static_cast<uint32_t>(total) > size_budget_) {
+    reason_ = "size";
+  } else if (deadline_ > 0 && uv_hrtime() > deadline_) {
+    reason_ = "time";
+  }
+  return reason_ == NULL ? kContinue : kAbort;
+}
+
+void SnapshotControl::Finish(const v8::HeapSnapshot* snapshot) {
+  statistics_[kDuration] = (uv_hrtime() - start_) / static_cast<uint64_t>(1e6);
+  statistics_[kSnapshots] += 1;
+  if (snapshot == NULL) {
+    statistics_[kAborted] += 1;
+    if (reason_ == NULL) {
+      reason_ = "unknown";
+    }
+  }
+}
+
+v8::Local<v8::Object> SnapshotControl::ToObject(v8::Isolate* isolate) const {
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  object->Set(FixedString(isolate, "aborted"), v8::True(isolate));
+  object->Set(FixedString(isolate, "reason"),
+              v8::String::NewFromUtf8(isolate, reason_ ? reason_ : ""));
+  object->Set(FixedString(isolate, "done"),
+              v8::Integer::NewFromUnsigned(isolate,
+                                           statistics_[kProgressDone]));
+  object->Set(FixedString(isolate, "total"),
+              v8::Integer::NewFromUnsigned(isolate,
+                                           statistics_[kProgressTotal]));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  object->Set(FixedString(isolate, "aborted"), v8::True());
+  object->Set(FixedString(isolate, "reason"),
+              v8::String::New(reason_ ? reason_ : ""));
+  object->Set(FixedString(isolate, "done"),
+              v8::Integer::NewFromUnsigned(statistics_[kProgressDone]));
+  object->Set(FixedString(isolate, "total"),
+              v8::Integer::NewFromUnsigned(statistics_[kProgressTotal]));
+#endif
+  return object;
+}
+
+v8::Local<v8::Object> NotStartedStatus(v8::Isolate* isolate) {
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  object->Set(FixedString(isolate, "aborted"), v8::True(isolate));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  object->Set(FixedString(isolate, "aborted"), v8::True());
+#endif
+  object->Set(FixedString(isolate, "reason"),
+              FixedString(isolate, "not started"));
+  return object;
+}
+
+bool CompareScoreSize(const std::pair<int, uint32_t>& a,
+                      const std::pair<int, uint32_t>& b) {
+  return a.first > b.first;
+}
+
+HeapDiff::HeapDiff(HeapDigest* start_digest,
+                   const v8::HeapSnapshot* end_snapshot,
+                   const Options& options)
+  : start_digest_(start_digest),
+    end_snapshot_(end_snapshot),
+    end_root_(end_snapshot->GetRoot()),
+    end_root_id_(end_root_->GetId()),
+    end_nodes_count_(end_snapshot->GetNodesCount()),
+    sample_(start_digest->sample()),
+    options_(options),
+    age_buckets_(start_digest->watermarks().size() + 1) {
+  if (sample_ > 1 || options_.columnar) {
+    // The sample doesn't contain the edges between objects, and the columnar
+    // format has no place for the results.
+    options_.retained = 0;
+    options_.retainers = 0;
+  }
+  if (sample_ > 1) {
+    options_.strings = 0;  // Not in the sample.
+  }
+  options_.closures = start_digest->closures();
+  if (start_digest->type_counts() == NULL) {
+    options_.types = false;
+  }
+}
+
+void HeapDiff::Compute() {
+  TypeCounts* const counts = options_.types ? &type_counts_ : NULL;
+  if (sample_ > 1) {
+    SampleObjects(end_snapshot_, sample_, &end_objects_, counts);
+  } else {
+    end_objects_.Reserve(end_nodes_count_);
+    HeapGraphWalker walker;
+    walker.Walk(end_root_, &end_objects_, counts);
+  }
+  end_objects_.Sort();
+  if (options_.types) {
+    type_counts_.Subtract(*start_digest_->type_counts());
+  }
+
+  // Scores are indexed by class name index.  |touched_| records the classes
+  // that have a score, in order of appearance.
+  const size_t names_count = start_digest_->names()->size();
+  scores_.resize(names_count);
+  is_touched_.resize(names_count);
+  if (options_.retained > 0 || options_.retainers > 0) {
+    classes_.assign(end_objects_.size(), HeapGraph::kNone);
+  }
+  if (options_.ages) {
+    ages_.resize(names_count * age_buckets_);
+  }
+
+  // Both sequences are ordered by id.  Merge them, objects that only exist
+  // in the end snapshot have been created, objects that only exist in the
+  // start digest have been reaped.  Reaped objects are scored right away,
+  // created objects are scored in Finish() because looking up their class
+  // names needs the isolate.
+  typedef std::vector<DigestEntry>::const_iterator DigestIterator;
+  HeapGraphNodeSet::const_iterator a = end_objects_.begin();
+  HeapGraphNodeSet::const_iterator a_end = end_objects_.end();
+  DigestIterator b = start_digest_->entries().begin();
+  DigestIterator b_end = start_digest_->entries().end();
+  while (a != a_end || b != b_end) {
+    if (b == b_end || (a != a_end && a->id() < b->id)) {
+      const v8::HeapGraphNode::Type type = a->node()->GetType();
+      if (type == v8::HeapGraphNode::kObject ||
+          (options_.closures > 0 && type == v8::HeapGraphNode::kClosure)) {
+        added_.push_back(static_cast<uint32_t>(a - end_objects_.begin()));
+      }
+      ++a;
+    } else if (a == a_end || b->id < a->id()) {
+      // The walk usually doesn't reach contexts.  Whether they've been
+      // reaped is only known once Finish() has found the end contexts.
+      if (b->kind == kContextEntry) {
+        missing_contexts_.push_back(
+            static_cast<uint32_t>(b - start_digest_->entries().begin()));
+      } else {
+        ScoreEntry(b->kind, b->name, b->size, false);
+      }
+      ++b;
+    } else if (b->kind != kObjectEntry) {
+      ++a, ++b;
+    } else {
+      if (classes_.empty() == false) {
+        classes_[a - end_objects_.begin()] = b->name;
+      }
+      if (options_.ages) {
+        CountAge(b->name, b->id);
+      }
+      ++a, ++b;
+    }
+  }
+
+  if (options_.retained > 0 || options_.retainers > 0) {
+    // One budget for the graph, the dominator tree and the path search.
+    // Checking the clock is relatively expensive, the loops only do it
+    // every few thousand nodes.
+    const uint64_t deadline =
+        uv_hrtime() + static_cast<uint64_t>(options_.retainer_time) * 1000000;
+    HeapGraph graph;
+    if (graph.Build(end_objects_, deadline)) {
+      if (options_.retained > 0) {
+        ComputeRetainedSizes(graph, deadline);
+      }
+      if (options_.retainers > 0) {
+        ComputeShortestPaths(graph, deadline);
+      }
+    }
+  }
+}
+
+void HeapDiff::ScoreContexts(v8::Isolate* isolate,
+                             ClosureKeys* keys,
+                             HeapGraphNodeSet* contexts) {
+  keys->AddContexts(end_objects_, contexts);
+  StringTable* locations = start_digest_->locations();
+  const std::vector<DigestEntry>& entries = start_digest_->entries();
+  for (HeapGraphNodeSet::const_iterator it = contexts->begin(),
+       end = contexts->end(); it != end; ++it) {
+    DigestEntry probe;
+    probe.id = it->id();
+    if (std::binary_search(entries.begin(), entries.end(), probe,
+                           CompareEntryId)) {
+      continue;
+    }
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    const uint32_t key = keys->ForContext(locations, it->node());
+    if (key != ClosureKeys::kNone) {
+      ScoreEntry(kContextEntry, key, DigestSize(it->node()), true);
+    }
+  }
+  for (std::vector<uint32_t>::const_iterator it = missing_contexts_.begin(),
+       end = missing_contexts_.end(); it != end; ++it) {
+    const DigestEntry& entry = entries[*it];
+    if (contexts->Find(entry.id) == contexts->size()) {
+      ScoreEntry(kContextEntry, entry.name, entry.size, false);
+    }
+  }
+}
+
+v8::Local<v8::Object> HeapDiff::Finish(v8::Isolate* isolate) {
+  StringTable* names = start_digest_->names();
+  ClosureKeys keys(isolate);
+  HeapGraphNodeSet contexts;
+  if (options_.closures > 0) {
+    ScoreContexts(isolate, &keys, &contexts);
+  }
+  for (std::vector<uint32_t>::const_iterator it = added_.begin(),
+       end = added_.end(); it != end; ++it) {
+    const v8::HeapGraphNode* node = end_objects_[*it].node();
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    const v8::HeapGraphNode::Type type = node->GetType();
+    if (type == v8::HeapGraphNode::kClosure) {
+      ScoreEntry(kClosureEntry,
+                 keys.ForClosure(start_digest_->locations(), node),
+                 DigestSize(node),
+                 true);
+      continue;
+    }
+    if (options_.closures > 0 &&
+        contexts.Find(end_objects_[*it].id()) < contexts.size()) {
+      continue;  // Scored by ScoreContexts().
+    }
+    const uint32_t name = names->Intern(node->GetName());
+    ScoreEntry(kObjectEntry, name, DigestSize(node), true);
+    if (options_.ages) {
+      CountAge(name, end_objects_[*it].id());
+    }
+    if (classes_.empty() == false) {
+      classes_[*it] = name;
+    }
+  }
+  SortTouched();
+
+  if (options_.columnar) {
+    v8::Local<v8::Object> result = ToColumns(isolate);
+    AddExtras(isolate, result);
+    return result;
+  }
+
+  // Retained sizes of the classes that grew the most, by class name index.
+  // Negative for classes that aren't in the top.
+  std::vector<double> retained;
+  if (options_.retained > 0 && retained_.empty() == false) {
+    AggregateRetainedSizes(&retained);
+  }
+
+  // Retainer paths of the classes that grew the most.  |retainers| holds
+  // the class name indices, |paths| the paths in the same order.
+  std::vector<uint32_t> retainers;
+  std::vector<RetainerPath> paths;
+  if (options_.retainers > 0) {
+    TopGrowingClasses(options_.retainers, &retainers);
+    FindRetainerPaths(retainers, &paths);
+  }
+  const size_t paths_per_class = options_.retainer_paths;
 
   v8::Local<v8::String> type_string = FixedString(isolate, "type");
   v8::Local<v8::String> total_string = FixedString(isolate, "total");
   v8::Local<v8::String> size_string = FixedString(isolate, "size");
+  v8::Local<v8::String> total_error_string =
+      FixedString(isolate, "totalError");
+  v8::Local<v8::String> size_error_string = FixedString(isolate, "sizeError");
+  v8::Local<v8::String> retained_string = FixedString(isolate, "retained");
+  v8::Local<v8::String> retainers_string = FixedString(isolate, "retainers");
+  v8::Local<v8::String> ages_string = FixedString(isolate, "ages");
 
   uint32_t index = 0;
 #if SL_NODE_VERSION == 12
@@ -264,10 +1276,9 @@ v8::Local<v8::Object> Summarize(v8::Isolate* isolate,
 #elif SL_NODE_VERSION == 10
   v8::Local<v8::Array> result = v8::Array::New();
 #endif
-  for (HeapGraphNodeMap::const_iterator it = summary.begin(),
-       end = summary.end(); it != end; ++it) {
-    const Key& key = it->first;
-    const Score& score = it->second;
+  for (std::vector<uint32_t>::const_iterator it = touched_.begin(),
+       end = touched_.end(); it != end; ++it) {
+    const Score& score = scores_[*it];
 #if SL_NODE_VERSION == 12
     v8::Local<v8::Object> object = v8::Object::New(isolate);
     object->Set(total_string, v8::Integer::New(isolate, score.count()));
@@ -277,11 +1288,650 @@ v8::Local<v8::Object> Summarize(v8::Isolate* isolate,
     object->Set(total_string, v8::Integer::New(score.count()));
     object->Set(size_string, v8::Integer::New(score.size()));
 #endif
-    object->Set(type_string, key.handle());
+    if (sample_ > 1) {
+      // Every object is in the sample with probability p = 1 / n.  Scaling
+      // a binomial count by n gives a variance of n * (n - 1) per sampled
+      // object, or per squared size for the size estimate.
+      const double n = sample_;
+      const double total = n * score.count();
+      const double size = n * score.size();
+      const double total_error = 1.96 * sqrt(n * (n - 1) * score.changes());
+      const double size_error = 1.96 * sqrt(n * (n - 1) * score.squares());
+#if SL_NODE_VERSION == 12
+      object->Set(total_string, v8::Number::New(isolate, total));
+      object->Set(size_string, v8::Number::New(isolate, size));
+      object->Set(total_error_string,
+                  v8::Number::New(isolate, ceil(total_error)));
+      object->Set(size_error_string,
+                  v8::Number::New(isolate, ceil(size_error)));
+#elif SL_NODE_VERSION == 10
+      object->Set(total_string, v8::Number::New(total));
+      object->Set(size_string, v8::Number::New(size));
+      object->Set(total_error_string, v8::Number::New(ceil(total_error)));
+      object->Set(size_error_string, v8::Number::New(ceil(size_error)));
+#endif
+    }
+    object->Set(type_string, names->Get(isolate, *it));
+    if (retained.empty() == false && retained[*it] >= 0) {
+#if SL_NODE_VERSION == 12
+      object->Set(retained_string, v8::Number::New(isolate, retained[*it]));
+#elif SL_NODE_VERSION == 10
+      object->Set(retained_string, v8::Number::New(retained[*it]));
+#endif
+    }
+    if (options_.ages) {
+      // Classes that only lost instances may have no live instances left.
+      const size_t offset = *it * age_buckets_;
+#if SL_NODE_VERSION == 12
+      v8::Local<v8::Array> array = v8::Array::New(isolate, age_buckets_);
+#elif SL_NODE_VERSION == 10
+      v8::Local<v8::Array> array = v8::Array::New(age_buckets_);
+#endif
+      for (uint32_t age = 0; age < age_buckets_; age += 1) {
+        const double count =
+            offset < ages_.size() ? ages_[offset + age] * sample_ : 0.0;
+#if SL_NODE_VERSION == 12
+        array->Set(age, v8::Number::New(isolate, count));
+#elif SL_NODE_VERSION == 10
+        array->Set(age, v8::Number::New(count));
+#endif
+      }
+      object->Set(ages_string, array);
+    }
+    const size_t slot =
+        std::find(retainers.begin(), retainers.end(), *it) - retainers.begin();
+    if (slot < retainers.size()) {
+#if SL_NODE_VERSION == 12
+      v8::Local<v8::Array> array = v8::Array::New(isolate);
+#elif SL_NODE_VERSION == 10
+      v8::Local<v8::Array> array = v8::Array::New();
+#endif
+      for (size_t k = 0; k < paths_per_class; k += 1) {
+        const RetainerPath& path = paths[slot * paths_per_class + k];
+        if (path.count == 0) {
+          break;
+        }
+        array->Set(k, RetainerPathToObject(isolate, path));
+      }
+      object->Set(retainers_string, array);
+    }
     result->Set(index, object);
     index += 1;
   }
 
+  AddExtras(isolate, result);
+  return result;
+}
+
+int HeapDiff::AppendTo(HeapHistory* history, double timestamp) const {
+  std::vector<HistoryRecord> records;
+  records.reserve(touched_.size());
+  for (std::vector<uint32_t>::const_iterator it = touched_.begin(),
+       end = touched_.end(); it != end; ++it) {
+    const Score& score = scores_[*it];
+    if (score.count() == 0 && score.size() == 0) {
+      continue;
+    }
+    HistoryRecord record;
+    record.name = *it;
+    record.total = score.count();
+    record.size = score.size();
+    records.push_back(record);
+  }
+  return history->Append(timestamp,
+                         sample_,
+                         *start_digest_->names(),
+                         &records);
+}
+
+// The hash that the summary's std::map keys were ordered by.  It only hashes
+// the first |size| bytes of the UTF-16 string, that's how it always was.
+uint32_t LegacyNameHash(const uint16_t* data, size_t size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  uint32_t hash = 0;
+  for (size_t index = 0; index < size; index += 1) {
+    hash += bytes[index];
+    hash += hash << 10;
+    hash ^= hash >> 6;
+  }
+  hash += hash << 3;
+  hash ^= hash >> 11;
+  hash += hash << 15;
+  return hash;
+}
+
+// Orders class names by hash, then length, then contents, like the old
+// summary's map keys did.  The contents comparison has the same quirk as
+// the hash, it looks at |size| bytes.
+class LegacyNameOrder {
+ public:
+  LegacyNameOrder(const StringTable* names, const std::vector<uint32_t>* hashes)
+      : names_(names), hashes_(hashes) {
+  }
+  bool operator()(uint32_t a, uint32_t b) const {
+    if ((*hashes_)[a] != (*hashes_)[b]) {
+      return (*hashes_)[a] < (*hashes_)[b];
+    }
+    const size_t size = names_->size(a);
+    if (size != names_->size(b)) {
+      return size < names_->size(b);
+    }
+    return ::memcmp(names_->data(a), names_->data(b), size) < 0;
+  }
+ private:
+  const StringTable* names_;
+  const std::vector<uint32_t>* hashes_;
+};
+
+void HeapDiff::SortTouched() {
+  const StringTable* names = start_digest_->names();
+  std::vector<uint32_t> hashes(names->size());
+  for (std::vector<uint32_t>::const_iterator it = touched_.begin(),
+       end = touched_.end(); it != end; ++it) {
+    hashes[*it] = LegacyNameHash(names->data(*it), names->size(*it));
+  }
+  std::sort(touched_.begin(), touched_.end(), LegacyNameOrder(names, &hashes));
+}
+
+void HeapDiff::Touch(uint32_t name) {
+  if (is_touched_[name] == false) {
+    is_touched_[name] = true;
+    touched_.push_back(name);
+  }
+}
+
+void HeapDiff::CountAge(uint32_t name, v8::SnapshotObjectId id) {
+  const size_t offset = name * age_buckets_;
+  if (offset >= ages_.size()) {
+    ages_.resize(offset + age_buckets_);
+  }
+  ages_[offset + start_digest_->watermarks().Age(id)] += 1;
+}
+
+void HeapDiff::ScoreEntry(uint32_t kind, uint32_t name, int size, bool plus) {
+  std::vector<Score>* scores = &scores_;
+  if (kind == kClosureEntry) {
+    scores = &closure_scores_;
+  } else if (kind == kContextEntry) {
+    scores = &context_scores_;
+  }
+  if (name >= scores->size()) {
+    scores->resize(name + 1);
+  }
+  if (plus) {
+    (*scores)[name].Plus(size);
+  } else {
+    (*scores)[name].Minus(size);
+  }
+  if (kind == kObjectEntry) {
+    if (name >= is_touched_.size()) {
+      is_touched_.resize(name + 1);
+    }
+    Touch(name);
+  }
+}
+
+void HeapDiff::AddExtras(v8::Isolate* isolate,
+                         v8::Local<v8::Object> result) {
+  if (options_.strings > 0) {
+    result->Set(FixedString(isolate, "strings"), DuplicateStrings(isolate));
+  }
+  if (options_.closures > 0) {
+    result->Set(FixedString(isolate, "closures"), ClosureGrowth(isolate));
+  }
+  if (options_.types) {
+    result->Set(FixedString(isolate, "types"), TypesToObject(isolate));
+  }
+}
+
+v8::Local<v8::Array> HeapDiff::ClosureGrowth(v8::Isolate* isolate) const {
+  const Score none;
+  const size_t size = std::max(closure_scores_.size(), context_scores_.size());
+  std::vector<std::pair<double, uint32_t> > growth;
+  for (uint32_t index = 0; index < size; index += 1) {
+    const Score& closures =
+        index < closure_scores_.size() ? closure_scores_[index] : none;
+    const Score& contexts =
+        index < context_scores_.size() ? context_scores_[index] : none;
+    const double bytes = closures.size() + contexts.size();
+    if (bytes > 0) {
+      growth.push_back(std::make_pair(bytes, index));
+    }
+  }
+  const size_t count = std::min<size_t>(growth.size(), options_.closures);
+  std::partial_sort(growth.begin(),
+                    growth.begin() + count,
+                    growth.end(),
+                    std::greater<std::pair<double, uint32_t> >());
+
+  const StringTable* locations = start_digest_->locations();
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> result = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> result = v8::Array::New(count);
+#endif
+  for (size_t k = 0; k < count; k += 1) {
+    const uint32_t index = growth[k].second;
+    const Score& closures =
+        index < closure_scores_.size() ? closure_scores_[index] : none;
+    const Score& contexts =
+        index < context_scores_.size() ? context_scores_[index] : none;
+    struct {
+      v8::Local<v8::String> name;
+      int value;
+    } fields[] = {
+      { FixedString(isolate, "total"), closures.count() },
+      { FixedString(isolate, "size"), closures.size() },
+      { FixedString(isolate, "contexts"), contexts.count() },
+      { FixedString(isolate, "contextsSize"), contexts.size() },
+    };
+#if SL_NODE_VERSION == 12
+    v8::Local<v8::Object> object = v8::Object::New(isolate);
+    for (size_t i = 0; i < SL_ARRAY_SIZE(fields); i += 1) {
+      object->Set(fields[i].name, v8::Integer::New(isolate, fields[i].value));
+    }
+#elif SL_NODE_VERSION == 10
+    v8::Local<v8::Object> object = v8::Object::New();
+    for (size_t i = 0; i < SL_ARRAY_SIZE(fields); i += 1) {
+      object->Set(fields[i].name, v8::Integer::New(fields[i].value));
+    }
+#endif
+    object->Set(FixedString(isolate, "location"),
+                locations->Get(isolate, index));
+    result->Set(k, object);
+  }
+  return result;
+}
+
+v8::Local<v8::Array> HeapDiff::DuplicateStrings(v8::Isolate* isolate) const {
+  // Group the strings by value.  The values go into a table of their own,
+  // it's thrown away afterwards.
+  StringTable values;
+  std::vector<StringGroup> groups;
+  size_t bytes = 0;
+  for (HeapGraphNodeSet::const_iterator it = end_objects_.begin(),
+       end = end_objects_.end(); it != end; ++it) {
+    const v8::HeapGraphNode* node = it->node();
+    if (node->GetType() != v8::HeapGraphNode::kString) {
+      continue;
+    }
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    const uint32_t index = values.Intern(node->GetName());
+    if (index == groups.size()) {
+      const StringGroup group = {
+        0, static_cast<uint32_t>(node->GetSelfSize()), 0
+      };
+      groups.push_back(group);
+    }
+    StringGroup& group = groups[index];
+    group.count += 1;
+    group.size += node->GetSelfSize();
+    bytes += values.size(index) * sizeof(uint16_t);
+    if (bytes >= options_.string_budget) {
+      break;
+    }
+  }
+
+  std::vector<std::pair<double, uint32_t> > waste;
+  for (uint32_t index = 0; index < groups.size(); index += 1) {
+    if (groups[index].count > 1) {
+      const double wasted = groups[index].size - groups[index].first_size;
+      waste.push_back(std::make_pair(wasted, index));
+    }
+  }
+  const size_t count = std::min<size_t>(waste.size(), options_.strings);
+  std::partial_sort(waste.begin(),
+                    waste.begin() + count,
+                    waste.end(),
+                    std::greater<std::pair<double, uint32_t> >());
+
+  static const size_t kMaxLength = 256;
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> result = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> result = v8::Array::New(count);
+#endif
+  for (size_t k = 0; k < count; k += 1) {
+    const uint32_t index = waste[k].second;
+    const StringGroup& group = groups[index];
+    const int length =
+        static_cast<int>(std::min(values.size(index), kMaxLength));
+#if SL_NODE_VERSION == 12
+    v8::Local<v8::Object> object = v8::Object::New(isolate);
+    object->Set(FixedString(isolate, "value"),
+                v8::String::NewFromTwoByte(isolate,
+                                           values.data(index),
+                                           v8::String::kNormalString,
+                                           length));
+    object->Set(FixedString(isolate, "count"),
+                v8::Integer::NewFromUnsigned(isolate, group.count));
+    object->Set(FixedString(isolate, "size"),
+                v8::Number::New(isolate, group.size));
+    object->Set(FixedString(isolate, "wasted"),
+                v8::Number::New(isolate, waste[k].first));
+#elif SL_NODE_VERSION == 10
+    v8::Local<v8::Object> object = v8::Object::New();
+    object->Set(FixedString(isolate, "value"),
+                v8::String::New(values.data(index), length));
+    object->Set(FixedString(isolate, "count"),
+                v8::Integer::NewFromUnsigned(group.count));
+    object->Set(FixedString(isolate, "size"), v8::Number::New(group.size));
+    object->Set(FixedString(isolate, "wasted"),
+                v8::Number::New(waste[k].first));
+#endif
+    result->Set(k, object);
+  }
+  return result;
+}
+
+v8::Local<v8::Object> HeapDiff::ToColumns(v8::Isolate* isolate) const {
+  const StringTable* names = start_digest_->names();
+  const size_t count = touched_.size();
+  std::vector<int32_t> columns(2 * count);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> types = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> types = v8::Array::New(count);
+#endif
+  for (size_t index = 0; index < count; index += 1) {
+    const uint32_t name = touched_[index];
+    types->Set(index, names->Get(isolate, name));
+    columns[index] = scores_[name].count();
+    columns[count + index] = scores_[name].size();
+  }
+  v8::Local<v8::Object> arrays[2];
+  NewInt32Columns(isolate,
+                  columns.empty() ? NULL : &columns[0],
+                  count,
+                  SL_ARRAY_SIZE(arrays),
+                  arrays);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+  result->Set(FixedString(isolate, "sample"),
+              v8::Integer::NewFromUnsigned(isolate, sample_));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+  result->Set(FixedString(isolate, "sample"),
+              v8::Integer::NewFromUnsigned(sample_));
+#endif
+  result->Set(FixedString(isolate, "type"), types);
+  result->Set(FixedString(isolate, "total"), arrays[0]);
+  result->Set(FixedString(isolate, "size"), arrays[1]);
+  return result;
+}
+
+v8::Local<v8::Object> HeapDiff::TypesToObject(v8::Isolate* isolate) const {
+  // Indexed by v8::HeapGraphNode::Type.  Newer V8 versions have more types.
+  static const char* const type_names[] = {
+    "hidden", "array", "string", "object", "code", "closure", "regexp",
+    "number", "native", "synthetic",
+#if SL_NODE_VERSION == 12
+    "concatenated string", "sliced string", "symbol",
+#endif
+  };
+  const size_t count = SL_ARRAY_SIZE(type_names);
+  // Doubles, the size of a type can grow by more than 2 GB.
+  double columns[2 * SL_ARRAY_SIZE(type_names)];
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> types = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> types = v8::Array::New(count);
+#endif
+  for (size_t type = 0; type < count; type += 1) {
+#if SL_NODE_VERSION == 12
+    types->Set(type, v8::String::NewFromUtf8(isolate, type_names[type]));
+#elif SL_NODE_VERSION == 10
+    types->Set(type, v8::String::New(type_names[type]));
+#endif
+    columns[type] = type_counts_.count(type);
+    columns[count + type] = type_counts_.size(type);
+  }
+  v8::Local<v8::Object> arrays[2];
+  NewFloat64Columns(isolate, columns, count, SL_ARRAY_SIZE(arrays), arrays);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+#endif
+  result->Set(FixedString(isolate, "type"), types);
+  result->Set(FixedString(isolate, "total"), arrays[0]);
+  result->Set(FixedString(isolate, "size"), arrays[1]);
+  return result;
+}
+
+void HeapDiff::TopGrowingClasses(size_t limit,
+                                 std::vector<uint32_t>* names) const {
+  std::vector<std::pair<int, uint32_t> > growth;
+  for (std::vector<uint32_t>::const_iterator it = touched_.begin(),
+       end = touched_.end(); it != end; ++it) {
+    if (scores_[*it].size() > 0) {
+      growth.push_back(std::make_pair(scores_[*it].size(), *it));
+    }
+  }
+  const size_t count = std::min(growth.size(), std::min<size_t>(limit, 32));
+  std::partial_sort(growth.begin(),
+                    growth.begin() + count,
+                    growth.end(),
+                    CompareScoreSize);
+  names->clear();
+  for (size_t slot = 0; slot < count; slot += 1) {
+    names->push_back(growth[slot].second);
+  }
+}
+
+void HeapDiff::ComputeRetainedSizes(const HeapGraph& graph,
+                                    uint64_t deadline) {
+  if (tree_.Build(graph, end_objects_.Find(end_root_id_), deadline) == false) {
+    return;  // Out of time, |retained_| stays empty.
+  }
+  // Dominators precede the nodes they dominate, a reverse pass over the
+  // depth-first order accumulates the retained sizes bottom-up.
+  const std::vector<uint32_t>& order = tree_.order();
+  retained_.resize(end_objects_.size());
+  for (size_t index = 0; index < end_objects_.size(); index += 1) {
+    retained_[index] = end_objects_[index].node()->GetSelfSize();
+  }
+  for (size_t k = order.size(); k > 1; k -= 1) {
+    const uint32_t v = order[k - 1];
+    retained_[tree_.idom(v)] += retained_[v];
+  }
+}
+
+void HeapDiff::AggregateRetainedSizes(std::vector<double>* sizes) const {
+  const uint32_t kNone = HeapGraph::kNone;
+  std::vector<uint32_t> top;
+  TopGrowingClasses(options_.retained, &top);
+  const size_t count = top.size();
+
+  // Give each of the top classes a bit.  |covered| is the set of top classes
+  // that occur among a node's dominators.  A node only contributes to its
+  // class's retained size when no other instance of that class dominates it,
+  // else it would be counted twice.
+  std::vector<uint32_t> class_bits(scores_.size());
+  for (size_t slot = 0; slot < count; slot += 1) {
+    class_bits[top[slot]] = 1u << slot;
+  }
+  std::vector<uint32_t> bits(end_objects_.size());
+  for (size_t index = 0; index < end_objects_.size(); index += 1) {
+    if (classes_[index] != kNone) {
+      bits[index] = class_bits[classes_[index]];
+    }
+  }
+  const std::vector<uint32_t>& order = tree_.order();
+  std::vector<uint32_t> covered(end_objects_.size());
+  std::vector<double> totals(count);
+  for (size_t k = 0; k < order.size(); k += 1) {
+    const uint32_t v = order[k];
+    const uint32_t d = tree_.idom(v);
+    if (d != kNone) {
+      covered[v] = covered[d] | bits[d];
+    }
+    if (bits[v] != 0 && (covered[v] & bits[v]) == 0) {
+      // Only one bit is set, find out which one.
+      uint32_t slot = 0;
+      while ((bits[v] >> slot) != 1) {
+        slot += 1;
+      }
+      totals[slot] += retained_[v];
+    }
+  }
+  sizes->assign(scores_.size(), -1);
+  for (size_t slot = 0; slot < count; slot += 1) {
+    (*sizes)[top[slot]] = totals[slot];
+  }
+}
+
+void HeapDiff::ComputeShortestPaths(const HeapGraph& graph,
+                                    uint64_t deadline) {
+  // A breadth-first search finds the shortest path from the root to every
+  // object in one pass, that's cheaper than searching backwards from the
+  // instances of each class separately.
+  const uint32_t kNone = HeapGraph::kNone;
+  const uint32_t root = end_objects_.Find(end_root_id_);
+  parents_.assign(end_objects_.size(), kNone);
+  bfs_order_.clear();
+  bfs_order_.reserve(end_objects_.size());
+  bfs_order_.push_back(root);
+  parents_[root] = root;
+  for (size_t head = 0; head < bfs_order_.size(); head += 1) {
+    if (head % 4096 == 4095 && uv_hrtime() > deadline) {
+      break;
+    }
+    const uint32_t from = bfs_order_[head];
+    for (const uint32_t* it = graph.begin(from); it != graph.end(from); ++it) {
+      if (parents_[*it] == kNone) {
+        parents_[*it] = from;
+        bfs_order_.push_back(*it);
+      }
+    }
+  }
+}
+
+void HeapDiff::FindRetainerPaths(const std::vector<uint32_t>& names,
+                                 std::vector<RetainerPath>* paths) const {
+  // Nodes are visited in order of distance from the root so the first
+  // instances that are found have the shortest paths.  Instances with the
+  // same retainer, like the elements of an array, are folded into one path.
+  const uint32_t kNone = HeapGraph::kNone;
+  const size_t paths_per_class = options_.retainer_paths;
+  RetainerPath empty = { kNone, kNone, 0 };
+  paths->assign(names.size() * paths_per_class, empty);
+  std::vector<uint32_t> slots(scores_.size(), kNone);
+  for (size_t slot = 0; slot < names.size(); slot += 1) {
+    slots[names[slot]] = static_cast<uint32_t>(slot);
+  }
+  for (size_t k = 1; k < bfs_order_.size(); k += 1) {
+    const uint32_t v = bfs_order_[k];
+    if (classes_[v] == kNone || slots[classes_[v]] == kNone) {
+      continue;
+    }
+    RetainerPath* it = &(*paths)[slots[classes_[v]] * paths_per_class];
+    RetainerPath* end = it + paths_per_class;
+    while (it != end && it->count != 0 && it->retainer != parents_[v]) {
+      ++it;
+    }
+    if (it == end) {
+      continue;  // Already have enough paths for this class.
+    }
+    if (it->count == 0) {
+      it->retainer = parents_[v];
+      it->target = v;
+    }
+    it->count += 1;
+  }
+}
+
+v8::Local<v8::Object> HeapDiff::RetainerPathToObject(
+    v8::Isolate* isolate,
+    const RetainerPath& path) {
+  // Long paths are cut short, the nodes nearest to the target are the most
+  // interesting ones.
+  static const size_t kMaxLength = 24;
+  const uint32_t root = bfs_order_[0];
+  std::vector<uint32_t> nodes;
+  for (uint32_t v = path.target; v != root; v = parents_[v]) {
+    nodes.push_back(v);
+  }
+  const size_t depth = nodes.size();
+  scratch_.clear();
+  if (nodes.size() > kMaxLength) {
+    nodes.resize(kMaxLength);
+    AppendAscii(&scratch_, "... -> ");
+  }
+  StringTable* names = &labels_;
+  for (size_t k = nodes.size(); k > 0; k -= 1) {
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    const v8::HeapGraphNode* node = end_objects_[nodes[k - 1]].node();
+    AppendNodeLabel(&scratch_, names, node);
+    if (k == 1) {
+      break;
+    }
+    const v8::SnapshotObjectId child_id = end_objects_[nodes[k - 2]].id();
+    const int children_count = node->GetChildrenCount();
+    for (int child = 0; child < children_count; child += 1) {
+      const v8::HeapGraphEdge* edge = node->GetChild(child);
+      if (IsInterestingEdge(edge->GetType()) &&
+          edge->GetToNode()->GetId() == child_id) {
+        AppendEdgeLabel(&scratch_, names, edge);
+        break;
+      }
+    }
+    AppendAscii(&scratch_, " -> ");
+  }
+
+  struct {
+    v8::Local<v8::String> name;
+    v8::Local<v8::Value> value;
+  } fields[] = {
+#if SL_NODE_VERSION == 12
+    { FixedString(isolate, "path"),
+      v8::String::NewFromTwoByte(isolate,
+                                 &scratch_[0],
+                                 v8::String::kNormalString,
+                                 static_cast<int>(scratch_.size())) },
+    { FixedString(isolate, "count"), v8::Integer::New(isolate, path.count) },
+    { FixedString(isolate, "depth"), v8::Integer::New(isolate, depth) },
+#elif SL_NODE_VERSION == 10
+    { FixedString(isolate, "path"),
+      v8::String::New(&scratch_[0], static_cast<int>(scratch_.size())) },
+    { FixedString(isolate, "count"), v8::Integer::New(path.count) },
+    { FixedString(isolate, "depth"), v8::Integer::New(depth) },
+#endif
+  };
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+#endif
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name, fields[index].value);
+  }
+  return object;
+}
+
+v8::Local<v8::Object> Summarize(v8::Isolate* isolate,
+                                HeapDigest* start_digest,
+                                const v8::HeapSnapshot* end_snapshot,
+                                const Options& options,
+                                HeapHistory* history) {
+  HeapDiff diff(start_digest, end_snapshot, options);
+  diff.Compute();
+  v8::Local<v8::Object> result = diff.Finish(isolate);
+  if (history != NULL) {
+    const int err = diff.AppendTo(history, WallClockTime());
+    if (err != 0) {
+      result->Set(FixedString(isolate, "historyError"),
+                  HistoryErrorToValue(isolate, err));
+    }
+  }
   return result;
 }
 
@@ -8,6 +8,8 @@
 
 #include "heapdiff.h"
 #include "heapdiff-inl.h"
+#include "heapsnapshot-writer.h"
+#include "heapsnapshot-writer-inl.h"
 #include "strong-agent.h"
 #include "v8-profiler.h"
 
@@ -16,51 +18,378 @@ namespace agent {
 namespace heapdiff {
 
 using v8::Arguments;
+using v8::Context;
+using v8::Exception;
+using v8::Function;
 using v8::FunctionTemplate;
 using v8::Handle;
 using v8::HandleScope;
 using v8::HeapProfiler;
 using v8::HeapSnapshot;
 using v8::Isolate;
+using v8::kExternalUnsignedIntArray;
+using v8::Local;
 using v8::Object;
+using v8::Persistent;
 using v8::String;
 using v8::Undefined;
 using v8::Value;
 
-const HeapSnapshot* start_snapshot;
+HeapDigest* start_digest;
+Watermarks watermarks;
+uint32_t snapshot_statistics[SnapshotControl::kStatisticsCount];
+HeapHistory* heap_history;
 
-Handle<Value> StartHeapDiff(const Arguments&) {
+// startHeapDiff([options])
+//
+// Pass { sample: n } to only diff 1 in n objects, see Summarize().  Pass
+// { snapshotTime: ms } or { snapshotSize: objects } to limit the cost of the
+// snapshot; when it's exceeded, the snapshot is aborted and a status object
+// is returned, see SnapshotControl::ToObject().
+Handle<Value> StartHeapDiff(const Arguments& args) {
   HandleScope handle_scope;
-  if (start_snapshot == NULL) {
-    start_snapshot = HeapProfiler::TakeSnapshot(String::Empty());
+  if (start_digest == NULL) {
+    Options options;
+    ParseOptions(NULL, args[0], &options);
+    SnapshotControl control(options, snapshot_statistics);
+    const HeapSnapshot* snapshot =
+        HeapProfiler::TakeSnapshot(String::Empty(),
+                                   HeapSnapshot::kFull,
+                                   &control);
+    control.Finish(snapshot);
+    if (snapshot == NULL) {
+      return handle_scope.Close(control.ToObject(NULL));
+    }
+    start_digest = new HeapDigest;
+    start_digest->Build(NULL, snapshot, options, watermarks);
+    watermarks = start_digest->watermarks();
+    const_cast<HeapSnapshot*>(snapshot)->Delete();
   }
   return Undefined();
 }
 
+struct HeapDiffJob {
+  uv_work_t work_req;
+  HeapDigest* start_digest;
+  const HeapSnapshot* end_snapshot;
+  Options options;
+  Persistent<Function> callback;
+};
+
+void HeapDiffWork(uv_work_t*) {
+  // V8 3.14's heap graph accessors look up the current isolate, they can't
+  // be used off the main thread.  The job only defers the work to the next
+  // tick of the event loop.
+}
+
+void HeapDiffDone(uv_work_t* req, int) {
+  HeapDiffJob* job = static_cast<HeapDiffJob*>(req->data);
+  HandleScope handle_scope;
+  Local<Value> argv[] = {
+    Summarize(NULL,
+              job->start_digest,
+              job->end_snapshot,
+              job->options,
+              heap_history)
+  };
+  Persistent<Function> callback = job->callback;
+  const_cast<HeapSnapshot*>(job->end_snapshot)->Delete();
+  delete job->start_digest;
+  delete job;
+  callback->Call(Context::GetCurrent()->Global(), SL_ARRAY_SIZE(argv), argv);
+  callback.Dispose();
+}
+
+// stopHeapDiff(summarize, [options], [callback])
+//
+// When |summarize| is true and a callback is passed, the summary is passed
+// to the callback on a later tick of the event loop.  Nothing is returned
+// in that case.  The class histogram is appended to the history file if
+// one was opened with startHeapHistory().
+//
+// When the end snapshot exceeds the budget from |options|, the diff is
+// abandoned and a status object is returned instead, the callback is not
+// called.  The same goes for a diff without a start snapshot, because the
+// start snapshot was over budget too, see NotStartedStatus().
 Handle<Value> StopHeapDiff(const Arguments& args) {
   HandleScope handle_scope;
 
-  if (start_snapshot == NULL) {
+  if (start_digest == NULL) {
+    if (args[0]->IsTrue()) {
+      return handle_scope.Close(NotStartedStatus(NULL));
+    }
     return Undefined();
   }
 
   Handle<Value> result = Undefined();
   if (args[0]->IsTrue()) {
+    Local<Value> options_arg = args[1];
+    Local<Value> callback_arg = args[2];
+    if (options_arg->IsFunction()) {
+      callback_arg = options_arg;
+      options_arg = Local<Value>();
+    }
+    Options options;
+    if (options_arg.IsEmpty() == false) {
+      ParseOptions(NULL, options_arg, &options);
+    }
+    SnapshotControl control(options, snapshot_statistics);
     const HeapSnapshot* end_snapshot =
-        HeapProfiler::TakeSnapshot(String::Empty());
-    result = Summarize(NULL, start_snapshot, end_snapshot);
+        HeapProfiler::TakeSnapshot(String::Empty(),
+                                   HeapSnapshot::kFull,
+                                   &control);
+    control.Finish(end_snapshot);
+    if (end_snapshot == NULL) {
+      delete start_digest;
+      start_digest = NULL;
+      return handle_scope.Close(control.ToObject(NULL));
+    }
+    if (callback_arg->IsFunction()) {
+      HeapDiffJob* job = new HeapDiffJob;
+      job->work_req.data = job;
+      job->start_digest = start_digest;
+      job->end_snapshot = end_snapshot;
+      job->options = options;
+      job->callback = Persistent<Function>::New(callback_arg.As<Function>());
+      uv_queue_work(uv_default_loop(),
+                    &job->work_req,
+                    HeapDiffWork,
+                    HeapDiffDone);
+      start_digest = NULL;  // Owned by the job now.
+      return Undefined();
+    }
+    result =
+        Summarize(NULL, start_digest, end_snapshot, options, heap_history);
+    const_cast<HeapSnapshot*>(end_snapshot)->Delete();
   }
 
-  HeapProfiler::DeleteAllSnapshots();
-  start_snapshot = NULL;
+  delete start_digest;
+  start_digest = NULL;
   return handle_scope.Close(result);
 }
 
+// startHeapHistory(path, maxSize)
+//
+// Appends the class histogram of every heap diff to the file at |path| from
+// now on, see HeapHistory.  The file is compacted when it grows past
+// |maxSize| bytes, 16 MB by default; zero means no limit.  Throws when the
+// file can't be opened or isn't a history file.
+Handle<Value> StartHeapHistory(const Arguments& args) {
+  HandleScope handle_scope;
+  if (args[0]->IsString() == false) {
+    return ThrowException(Exception::TypeError(
+        FixedString(NULL, "Expected path argument.")));
+  }
+  String::Utf8Value path(args[0]);
+  size_t max_size = HeapHistory::kDefaultMaxSize;
+  if (args[1]->IsNumber() && args[1]->NumberValue() >= 0) {
+    max_size = static_cast<size_t>(args[1]->NumberValue());
+  }
+  HeapHistory* history = new HeapHistory;
+  const int err = history->Open(*path, max_size);
+  if (err != 0) {
+    delete history;
+    return ThrowException(HistoryErrorToValue(NULL, err));
+  }
+  delete heap_history;
+  heap_history = history;
+  return Undefined();
+}
+
+Handle<Value> StopHeapHistory(const Arguments&) {
+  delete heap_history;
+  heap_history = NULL;
+  return Undefined();
+}
+
+// queryHeapHistory(path, type, since)
+//
+// Returns the growth of class |type| over the diffs in the history file at
+// |path| that were recorded at or after |since|, a timestamp in milliseconds.
+// See HistoryTrend::ToObject().  The file is memory-mapped, not parsed.
+Handle<Value> QueryHeapHistory(const Arguments& args) {
+  HandleScope handle_scope;
+  if (args[0]->IsString() == false || args[1]->IsString() == false) {
+    return ThrowException(Exception::TypeError(
+        FixedString(NULL, "Expected path and type arguments.")));
+  }
+  String::Utf8Value path(args[0]);
+  HeapHistoryReader reader;
+  const int err = reader.Open(*path);
+  if (err != 0) {
+    return ThrowException(HistoryErrorToValue(NULL, err));
+  }
+  String::Value type(args[1]);
+  const HistoryTrend trend =
+      reader.Query(*type, type.length(), args[2]->NumberValue());
+  return handle_scope.Close(trend.ToObject(NULL));
+}
+
+HeapStats* heap_stats;
+
+Handle<Value> StartHeapTracking(const Arguments&) {
+  if (heap_stats == NULL) {
+    heap_stats = new HeapStats;
+    HeapProfiler::StartHeapObjectsTracking();
+    // The first interval holds everything that's already on the heap.
+    HeapProfiler::PushHeapObjectsStats(heap_stats);
+  }
+  return Undefined();
+}
+
+Handle<Value> PollHeapTracking(const Arguments&) {
+  HandleScope handle_scope;
+  if (heap_stats == NULL) {
+    return Undefined();
+  }
+  heap_stats->Reset();
+  HeapProfiler::PushHeapObjectsStats(heap_stats);
+  return handle_scope.Close(heap_stats->ToObject(NULL));
+}
+
+Handle<Value> StopHeapTracking(const Arguments&) {
+  if (heap_stats != NULL) {
+    HeapProfiler::StopHeapObjectsTracking();
+    delete heap_stats;
+    heap_stats = NULL;
+  }
+  return Undefined();
+}
+
+struct WriteSnapshotJob {
+  uv_work_t work_req;
+  uv_async_t progress_handle;
+  SnapshotWriter* writer;
+  Persistent<Function> progress;
+  Persistent<Function> callback;
+};
+
+void WriteSnapshotWork(uv_work_t* req) {
+  WriteSnapshotJob* job = static_cast<WriteSnapshotJob*>(req->data);
+  job->writer->Run();
+}
+
+void WriteSnapshotProgress(uv_async_t* handle, int) {
+  WriteSnapshotJob* job = static_cast<WriteSnapshotJob*>(handle->data);
+  if (job->progress.IsEmpty()) {
+    return;
+  }
+  HandleScope handle_scope;
+  Local<Value> argv[] = { job->writer->ProgressToObject(NULL) };
+  job->progress->Call(Context::GetCurrent()->Global(),
+                      SL_ARRAY_SIZE(argv),
+                      argv);
+}
+
+void WriteSnapshotClose(uv_handle_t* handle) {
+  delete static_cast<WriteSnapshotJob*>(handle->data);
+}
+
+void WriteSnapshotDone(uv_work_t* req, int) {
+  WriteSnapshotJob* job = static_cast<WriteSnapshotJob*>(req->data);
+  HandleScope handle_scope;
+  Local<Value> argv[] = {
+    job->writer->ErrorToValue(NULL),
+    job->writer->ProgressToObject(NULL),
+  };
+  Persistent<Function> callback = job->callback;
+  if (job->progress.IsEmpty() == false) {
+    job->progress.Dispose();
+    job->progress.Clear();
+  }
+  delete job->writer;
+  job->writer = NULL;
+  // Pending progress notifications are dropped, the job is deleted once
+  // libuv is done with the handle.
+  uv_close(reinterpret_cast<uv_handle_t*>(&job->progress_handle),
+           WriteSnapshotClose);
+  callback->Call(Context::GetCurrent()->Global(), SL_ARRAY_SIZE(argv), argv);
+  callback.Dispose();
+}
+
+// writeHeapSnapshot(path, [options], callback)
+//
+// Takes a heap snapshot and writes it to |path| as gzipped JSON.  V8 can
+// only serialize the snapshot on the main thread but compressing and
+// writing it normally happens on the thread pool.  At most a few buffers
+// are queued; when the thread pool falls behind, the main thread writes
+// the backlog itself.  A partially written file is removed on error.
+// The callback receives an error or undefined, and a { bytesIn, bytesOut,
+// buffers } object.  |options.progress| is called with the same object
+// while the file is being written.
+Handle<Value> WriteHeapSnapshot(const Arguments& args) {
+  HandleScope handle_scope;
+
+  Local<Value> options_arg = args[1];
+  Local<Value> callback_arg = args[2];
+  if (options_arg->IsFunction()) {
+    callback_arg = options_arg;
+    options_arg = Local<Value>();
+  }
+  if (args[0]->IsString() == false || callback_arg->IsFunction() == false) {
+    return ThrowException(Exception::TypeError(
+        FixedString(NULL, "Expected path and callback arguments.")));
+  }
+
+  WriterOptions options;
+  Local<Value> progress_arg;
+  if (options_arg.IsEmpty() == false && options_arg->IsObject()) {
+    ParseWriterOptions(NULL, options_arg, &options);
+    progress_arg = options_arg.As<Object>()->Get(FixedString(NULL, "progress"));
+  }
+
+  String::Utf8Value path(args[0]);
+  WriteSnapshotJob* job = new WriteSnapshotJob;
+  job->work_req.data = job;
+  job->progress_handle.data = job;
+  job->writer = new SnapshotWriter(*path, options, &job->progress_handle);
+  job->callback = Persistent<Function>::New(callback_arg.As<Function>());
+  if (progress_arg.IsEmpty() == false && progress_arg->IsFunction()) {
+    job->progress = Persistent<Function>::New(progress_arg.As<Function>());
+  }
+  uv_async_init(uv_default_loop(),
+                &job->progress_handle,
+                WriteSnapshotProgress);
+  uv_queue_work(uv_default_loop(),
+                &job->work_req,
+                WriteSnapshotWork,
+                WriteSnapshotDone);
+
+  const HeapSnapshot* snapshot = HeapProfiler::TakeSnapshot(String::Empty());
+  snapshot->Serialize(job->writer, HeapSnapshot::kJSON);
+  job->writer->Finish();
+  const_cast<HeapSnapshot*>(snapshot)->Delete();
+  return Undefined();
+}
+
 void Initialize(Isolate* isolate, Handle<Object> binding) {
   binding->Set(FixedString(isolate, "startHeapDiff"),
                FunctionTemplate::New(StartHeapDiff)->GetFunction());
   binding->Set(FixedString(isolate, "stopHeapDiff"),
                FunctionTemplate::New(StopHeapDiff)->GetFunction());
+  binding->Set(FixedString(isolate, "startHeapTracking"),
+               FunctionTemplate::New(StartHeapTracking)->GetFunction());
+  binding->Set(FixedString(isolate, "pollHeapTracking"),
+               FunctionTemplate::New(PollHeapTracking)->GetFunction());
+  binding->Set(FixedString(isolate, "stopHeapTracking"),
+               FunctionTemplate::New(StopHeapTracking)->GetFunction());
+  binding->Set(FixedString(isolate, "writeHeapSnapshot"),
+               FunctionTemplate::New(WriteHeapSnapshot)->GetFunction());
+#ifndef _WIN32  // The history file is POSIX only, see heaphistory-inl.h.
+  binding->Set(FixedString(isolate, "startHeapHistory"),
+               FunctionTemplate::New(StartHeapHistory)->GetFunction());
+  binding->Set(FixedString(isolate, "stopHeapHistory"),
+               FunctionTemplate::New(StopHeapHistory)->GetFunction());
+  binding->Set(FixedString(isolate, "queryHeapHistory"),
+               FunctionTemplate::New(QueryHeapHistory)->GetFunction());
+#endif
+  Local<Object> heap_snapshot_statistics = Object::New();
+  heap_snapshot_statistics->SetIndexedPropertiesToExternalArrayData(
+      snapshot_statistics,
+      kExternalUnsignedIntArray,
+      SL_ARRAY_SIZE(snapshot_statistics));
+  binding->Set(FixedString(isolate, "heapSnapshotStatistics"),
+               heap_snapshot_statistics);
 }
 
 }  // namespace heapdiff
@@ -8,6 +8,8 @@
 
 #include "heapdiff.h"
 #include "heapdiff-inl.h"
+#include "heapsnapshot-writer.h"
+#include "heapsnapshot-writer-inl.h"
 #include "strong-agent.h"
 #include "v8-profiler.h"
 
@@ -15,45 +17,368 @@ namespace strongloop {
 namespace agent {
 namespace heapdiff {
 
+using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
+using v8::Exception;
 using v8::Handle;
 using v8::HandleScope;
+using v8::HeapProfiler;
 using v8::HeapSnapshot;
 using v8::Isolate;
+using v8::kExternalUnsignedIntArray;
 using v8::Local;
 using v8::Object;
+using v8::Persistent;
 using v8::String;
 using v8::Value;
 
-const HeapSnapshot* start_snapshot;
+HeapDigest* start_digest;
+Watermarks watermarks;
+uint32_t snapshot_statistics[SnapshotControl::kStatisticsCount];
+HeapHistory* heap_history;
 
+// startHeapDiff([options])
+//
+// Pass { sample: n } to only diff 1 in n objects, see Summarize().  Pass
+// { snapshotTime: ms } or { snapshotSize: objects } to limit the cost of the
+// snapshot; when it's exceeded, the snapshot is aborted and a status object
+// is returned, see SnapshotControl::ToObject().
 void StartHeapDiff(const FunctionCallbackInfo<Value>& args) {
-  if (start_snapshot == NULL) {
+  if (start_digest == NULL) {
     Isolate* isolate = args.GetIsolate();
     HandleScope handle_scope(isolate);
-    start_snapshot =
-        isolate->GetHeapProfiler()->TakeHeapSnapshot(String::Empty(isolate));
+    Options options;
+    ParseOptions(isolate, args[0], &options);
+    SnapshotControl control(options, snapshot_statistics);
+    const HeapSnapshot* snapshot =
+        isolate->GetHeapProfiler()->TakeHeapSnapshot(String::Empty(isolate),
+                                                     &control);
+    control.Finish(snapshot);
+    if (snapshot == NULL) {
+      args.GetReturnValue().Set(control.ToObject(isolate));
+      return;
+    }
+    start_digest = new HeapDigest;
+    start_digest->Build(isolate, snapshot, options, watermarks);
+    watermarks = start_digest->watermarks();
+    const_cast<HeapSnapshot*>(snapshot)->Delete();
   }
 }
 
-void StopHeapDiff(const FunctionCallbackInfo<Value>& args) {
-  if (start_snapshot == NULL) {
-    return;
+struct HeapDiffJob {
+  uv_work_t work_req;
+  Isolate* isolate;
+  HeapDigest* start_digest;
+  const HeapSnapshot* end_snapshot;
+  HeapDiff* diff;
+  Persistent<Function> callback;
+};
+
+void HeapDiffWork(uv_work_t* req) {
+  HeapDiffJob* job = static_cast<HeapDiffJob*>(req->data);
+  job->diff->Compute();
+}
+
+void HeapDiffDone(uv_work_t* req, int) {
+  HeapDiffJob* job = static_cast<HeapDiffJob*>(req->data);
+  Isolate* isolate = job->isolate;
+  HandleScope handle_scope(isolate);
+  Local<Object> result = job->diff->Finish(isolate);
+  if (heap_history != NULL) {
+    const int err = job->diff->AppendTo(heap_history, WallClockTime());
+    if (err != 0) {
+      result->Set(FixedString(isolate, "historyError"),
+                  HistoryErrorToValue(isolate, err));
+    }
   }
+  Local<Value> argv[] = { result };
+  Local<Function> callback = Local<Function>::New(isolate, job->callback);
+  job->callback.Reset();
+  delete job->diff;
+  const_cast<HeapSnapshot*>(job->end_snapshot)->Delete();
+  delete job->start_digest;
+  delete job;
+  callback->Call(isolate->GetCurrentContext()->Global(),
+                 SL_ARRAY_SIZE(argv),
+                 argv);
+}
 
+// stopHeapDiff(summarize, [options], [callback])
+//
+// When |summarize| is true and a callback is passed, the diff is computed
+// on the thread pool and the summary is passed to the callback.  Nothing is
+// returned in that case.  Only taking the snapshot and looking up the class
+// names of new objects happens on the main thread.  The class histogram
+// is appended to the history file if one was opened with startHeapHistory().
+//
+// When the end snapshot exceeds the budget from |options|, the diff is
+// abandoned and a status object is returned instead, the callback is not
+// called.  The same goes for a diff without a start snapshot, because the
+// start snapshot was over budget too, see NotStartedStatus().
+void StopHeapDiff(const FunctionCallbackInfo<Value>& args) {
   Isolate* isolate = args.GetIsolate();
   HandleScope handle_scope(isolate);
 
+  if (start_digest == NULL) {
+    if (args[0]->IsTrue()) {
+      args.GetReturnValue().Set(NotStartedStatus(isolate));
+    }
+    return;
+  }
+
   if (args[0]->IsTrue()) {
+    Local<Value> options_arg = args[1];
+    Local<Value> callback_arg = args[2];
+    if (options_arg->IsFunction()) {
+      callback_arg = options_arg;
+      options_arg = Local<Value>();
+    }
+    Options options;
+    if (options_arg.IsEmpty() == false) {
+      ParseOptions(isolate, options_arg, &options);
+    }
+    SnapshotControl control(options, snapshot_statistics);
     const HeapSnapshot* end_snapshot =
-        isolate->GetHeapProfiler()->TakeHeapSnapshot(String::Empty(isolate));
-    Local<Object> result = Summarize(isolate, start_snapshot, end_snapshot);
+        isolate->GetHeapProfiler()->TakeHeapSnapshot(String::Empty(isolate),
+                                                     &control);
+    control.Finish(end_snapshot);
+    if (end_snapshot == NULL) {
+      args.GetReturnValue().Set(control.ToObject(isolate));
+      delete start_digest;
+      start_digest = NULL;
+      return;
+    }
+    if (callback_arg->IsFunction()) {
+      HeapDiffJob* job = new HeapDiffJob;
+      job->work_req.data = job;
+      job->isolate = isolate;
+      job->start_digest = start_digest;
+      job->end_snapshot = end_snapshot;
+      job->diff = new HeapDiff(start_digest, end_snapshot, options);
+      job->callback.Reset(isolate, callback_arg.As<Function>());
+      uv_queue_work(uv_default_loop(),
+                    &job->work_req,
+                    HeapDiffWork,
+                    HeapDiffDone);
+      start_digest = NULL;  // Owned by the job now.
+      return;
+    }
+    Local<Object> result =
+        Summarize(isolate, start_digest, end_snapshot, options, heap_history);
+    const_cast<HeapSnapshot*>(end_snapshot)->Delete();
     args.GetReturnValue().Set(result);
   }
 
-  isolate->GetHeapProfiler()->DeleteAllHeapSnapshots();
-  start_snapshot = NULL;
+  delete start_digest;
+  start_digest = NULL;
+}
+
+// startHeapHistory(path, maxSize)
+//
+// Appends the class histogram of every heap diff to the file at |path| from
+// now on, see HeapHistory.  The file is compacted when it grows past
+// |maxSize| bytes, 16 MB by default; zero means no limit.  Throws when the
+// file can't be opened or isn't a history file.
+void StartHeapHistory(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  if (args[0]->IsString() == false) {
+    isolate->ThrowException(Exception::TypeError(
+        FixedString(isolate, "Expected path argument.")));
+    return;
+  }
+  String::Utf8Value path(args[0]);
+  size_t max_size = HeapHistory::kDefaultMaxSize;
+  if (args[1]->IsNumber() && args[1]->NumberValue() >= 0) {
+    max_size = static_cast<size_t>(args[1]->NumberValue());
+  }
+  HeapHistory* history = new HeapHistory;
+  const int err = history->Open(*path, max_size);
+  if (err != 0) {
+    delete history;
+    isolate->ThrowException(HistoryErrorToValue(isolate, err));
+    return;
+  }
+  delete heap_history;
+  heap_history = history;
+}
+
+void StopHeapHistory(const FunctionCallbackInfo<Value>&) {
+  delete heap_history;
+  heap_history = NULL;
+}
+
+// queryHeapHistory(path, type, since)
+//
+// Returns the growth of class |type| over the diffs in the history file at
+// |path| that were recorded at or after |since|, a timestamp in milliseconds.
+// See HistoryTrend::ToObject().  The file is memory-mapped, not parsed.
+void QueryHeapHistory(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  if (args[0]->IsString() == false || args[1]->IsString() == false) {
+    isolate->ThrowException(Exception::TypeError(
+        FixedString(isolate, "Expected path and type arguments.")));
+    return;
+  }
+  String::Utf8Value path(args[0]);
+  HeapHistoryReader reader;
+  const int err = reader.Open(*path);
+  if (err != 0) {
+    isolate->ThrowException(HistoryErrorToValue(isolate, err));
+    return;
+  }
+  String::Value type(args[1]);
+  const HistoryTrend trend =
+      reader.Query(*type, type.length(), args[2]->NumberValue());
+  args.GetReturnValue().Set(trend.ToObject(isolate));
+}
+
+HeapStats* heap_stats;
+
+void StartHeapTracking(const FunctionCallbackInfo<Value>& args) {
+  if (heap_stats == NULL) {
+    Isolate* isolate = args.GetIsolate();
+    HeapProfiler* heap_profiler = isolate->GetHeapProfiler();
+    heap_stats = new HeapStats;
+    heap_profiler->StartTrackingHeapObjects();
+    // The first interval holds everything that's already on the heap.
+    heap_profiler->GetHeapStats(heap_stats);
+  }
+}
+
+void PollHeapTracking(const FunctionCallbackInfo<Value>& args) {
+  if (heap_stats == NULL) {
+    return;
+  }
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  heap_stats->Reset();
+  isolate->GetHeapProfiler()->GetHeapStats(heap_stats);
+  args.GetReturnValue().Set(heap_stats->ToObject(isolate));
+}
+
+void StopHeapTracking(const FunctionCallbackInfo<Value>& args) {
+  if (heap_stats == NULL) {
+    return;
+  }
+  args.GetIsolate()->GetHeapProfiler()->StopTrackingHeapObjects();
+  delete heap_stats;
+  heap_stats = NULL;
+}
+
+struct WriteSnapshotJob {
+  uv_work_t work_req;
+  uv_async_t progress_handle;
+  Isolate* isolate;
+  SnapshotWriter* writer;
+  Persistent<Function> progress;
+  Persistent<Function> callback;
+};
+
+void WriteSnapshotWork(uv_work_t* req) {
+  WriteSnapshotJob* job = static_cast<WriteSnapshotJob*>(req->data);
+  job->writer->Run();
+}
+
+void WriteSnapshotProgress(uv_async_t* handle, int) {
+  WriteSnapshotJob* job = static_cast<WriteSnapshotJob*>(handle->data);
+  if (job->progress.IsEmpty()) {
+    return;
+  }
+  Isolate* isolate = job->isolate;
+  HandleScope handle_scope(isolate);
+  Local<Value> argv[] = { job->writer->ProgressToObject(isolate) };
+  Local<Function> progress = Local<Function>::New(isolate, job->progress);
+  progress->Call(isolate->GetCurrentContext()->Global(),
+                 SL_ARRAY_SIZE(argv),
+                 argv);
+}
+
+void WriteSnapshotClose(uv_handle_t* handle) {
+  delete static_cast<WriteSnapshotJob*>(handle->data);
+}
+
+void WriteSnapshotDone(uv_work_t* req, int) {
+  WriteSnapshotJob* job = static_cast<WriteSnapshotJob*>(req->data);
+  Isolate* isolate = job->isolate;
+  HandleScope handle_scope(isolate);
+  Local<Value> argv[] = {
+    job->writer->ErrorToValue(isolate),
+    job->writer->ProgressToObject(isolate),
+  };
+  Local<Function> callback = Local<Function>::New(isolate, job->callback);
+  job->callback.Reset();
+  job->progress.Reset();
+  delete job->writer;
+  job->writer = NULL;
+  // Pending progress notifications are dropped, the job is deleted once
+  // libuv is done with the handle.
+  uv_close(reinterpret_cast<uv_handle_t*>(&job->progress_handle),
+           WriteSnapshotClose);
+  callback->Call(isolate->GetCurrentContext()->Global(),
+                 SL_ARRAY_SIZE(argv),
+                 argv);
+}
+
+// writeHeapSnapshot(path, [options], callback)
+//
+// Takes a heap snapshot and writes it to |path| as gzipped JSON.  V8 can
+// only serialize the snapshot on the main thread but compressing and
+// writing it normally happens on the thread pool.  At most a few buffers
+// are queued; when the thread pool falls behind, the main thread writes
+// the backlog itself.  A partially written file is removed on error.
+// The callback receives an error or undefined, and a { bytesIn, bytesOut,
+// buffers } object.  |options.progress| is called with the same object
+// while the file is being written.
+void WriteHeapSnapshot(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+
+  Local<Value> options_arg = args[1];
+  Local<Value> callback_arg = args[2];
+  if (options_arg->IsFunction()) {
+    callback_arg = options_arg;
+    options_arg = Local<Value>();
+  }
+  if (args[0]->IsString() == false || callback_arg->IsFunction() == false) {
+    isolate->ThrowException(Exception::TypeError(
+        FixedString(isolate, "Expected path and callback arguments.")));
+    return;
+  }
+
+  WriterOptions options;
+  Local<Value> progress_arg;
+  if (options_arg.IsEmpty() == false && options_arg->IsObject()) {
+    ParseWriterOptions(isolate, options_arg, &options);
+    progress_arg =
+        options_arg.As<Object>()->Get(FixedString(isolate, "progress"));
+  }
+
+  String::Utf8Value path(args[0]);
+  WriteSnapshotJob* job = new WriteSnapshotJob;
+  job->work_req.data = job;
+  job->progress_handle.data = job;
+  job->isolate = isolate;
+  job->writer = new SnapshotWriter(*path, options, &job->progress_handle);
+  job->callback.Reset(isolate, callback_arg.As<Function>());
+  if (progress_arg.IsEmpty() == false && progress_arg->IsFunction()) {
+    job->progress.Reset(isolate, progress_arg.As<Function>());
+  }
+  uv_async_init(uv_default_loop(),
+                &job->progress_handle,
+                WriteSnapshotProgress);
+  uv_queue_work(uv_default_loop(),
+                &job->work_req,
+                WriteSnapshotWork,
+                WriteSnapshotDone);
+
+  const HeapSnapshot* snapshot =
+      isolate->GetHeapProfiler()->TakeHeapSnapshot(String::Empty(isolate));
+  snapshot->Serialize(job->writer, HeapSnapshot::kJSON);
+  job->writer->Finish();
+  const_cast<HeapSnapshot*>(snapshot)->Delete();
 }
 
 void Initialize(Isolate* isolate, Handle<Object> binding) {
@@ -61,6 +386,36 @@ void Initialize(Isolate* isolate, Handle<Object> binding) {
                FunctionTemplate::New(isolate, StartHeapDiff)->GetFunction());
   binding->Set(FixedString(isolate, "stopHeapDiff"),
                FunctionTemplate::New(isolate, StopHeapDiff)->GetFunction());
+  binding->Set(
+      FixedString(isolate, "startHeapTracking"),
+      FunctionTemplate::New(isolate, StartHeapTracking)->GetFunction());
+  binding->Set(
+      FixedString(isolate, "pollHeapTracking"),
+      FunctionTemplate::New(isolate, PollHeapTracking)->GetFunction());
+  binding->Set(
+      FixedString(isolate, "stopHeapTracking"),
+      FunctionTemplate::New(isolate, StopHeapTracking)->GetFunction());
+  binding->Set(
+      FixedString(isolate, "writeHeapSnapshot"),
+      FunctionTemplate::New(isolate, WriteHeapSnapshot)->GetFunction());
+#ifndef _WIN32  // The history file is POSIX only, see heaphistory-inl.h.
+  binding->Set(
+      FixedString(isolate, "startHeapHistory"),
+      FunctionTemplate::New(isolate, StartHeapHistory)->GetFunction());
+  binding->Set(
+      FixedString(isolate, "stopHeapHistory"),
+      FunctionTemplate::New(isolate, StopHeapHistory)->GetFunction());
+  binding->Set(
+      FixedString(isolate, "queryHeapHistory"),
+      FunctionTemplate::New(isolate, QueryHeapHistory)->GetFunction());
+#endif
+  Local<Object> heap_snapshot_statistics = Object::New(isolate);
+  heap_snapshot_statistics->SetIndexedPropertiesToExternalArrayData(
+      snapshot_statistics,
+      kExternalUnsignedIntArray,
+      SL_ARRAY_SIZE(snapshot_statistics));
+  binding->Set(FixedString(isolate, "heapSnapshotStatistics"),
+               heap_snapshot_statistics);
 }
 
 }  // namespace heapdiff
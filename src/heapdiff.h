@@ -6,12 +6,12 @@
 #ifndef AGENT_SRC_HEAPDIFF_H_
 #define AGENT_SRC_HEAPDIFF_H_
 
+#include "heaphistory.h"
+#include "util.h"
 #include "v8.h"
 #include "v8-profiler.h"
 #include <stdint.h>
 
-#include <map>
-#include <set>
 #include <vector>
 
 namespace strongloop {
@@ -25,6 +25,7 @@ namespace heapdiff {
 // attributable to v8::HeapGraphNode::GetId().
 class HeapGraphNodeWrap {
  public:
+  HeapGraphNodeWrap();
   explicit HeapGraphNodeWrap(const v8::HeapGraphNode* node);
   const v8::HeapGraphNode* node() const;
   v8::SnapshotObjectId id() const;
@@ -34,48 +35,495 @@ class HeapGraphNodeWrap {
   v8::SnapshotObjectId id_;
 };
 
-class Key {
- public:
-  explicit Key(v8::Handle<v8::String> string);
-  // Copy constructor has move semantics, afterwards that.data() returns NULL.
-  Key(const Key& that);
-  ~Key();
-  bool operator<(const Key& that) const;
-  v8::Handle<v8::String> handle() const;
-  const uint16_t* data() const;
-  unsigned size() const;
-  uint32_t hash() const;
- private:
-  static const unsigned kMaxSize = 4096;
-  v8::Handle<v8::String> handle_;
-  mutable uint16_t* data_;
-  mutable unsigned size_;
-  mutable uint32_t hash_;
-  uint16_t buffer_[32];
-  void operator=(const Key&);
-};
-
 class Score {
  public:
   Score();
   int count() const;
   int size() const;
-  void Plus(const HeapGraphNodeWrap& wrapper);
-  void Minus(const HeapGraphNodeWrap& wrapper);
+  // Number of Plus() and Minus() calls and the sum of the squares of their
+  // sizes.  Used to estimate the error when the heap is sampled.
+  int changes() const;
+  double squares() const;
+  void Plus(int size);
+  void Minus(int size);
  private:
   int count_;
   int size_;
+  int changes_;
+  double squares_;
+};
+
+// Number and total self size of the nodes of each HeapGraphNode::Type.
+// Cheap enough to gather while a snapshot is walked or scanned anyway, and
+// it shows the growth of heap numbers, strings and arrays that the per class
+// diff doesn't report.  Sizes are doubles, strings alone can exceed 2 GB.
+class TypeCounts {
+ public:
+  static const int kMaxTypes = 16;
+  TypeCounts();
+  void Add(const v8::HeapGraphNode* node);
+  // Subtracts the counters of |that|, turning them into deltas.
+  void Subtract(const TypeCounts& that);
+  double count(int type) const;
+  double size(int type) const;
+ private:
+  double counts_[kMaxTypes];
+  double sizes_[kMaxTypes];
 };
 
-typedef std::map<Key, Score> HeapGraphNodeMap;
-typedef std::set<HeapGraphNodeWrap> HeapGraphNodeSet;
 typedef std::vector<HeapGraphNodeWrap> HeapGraphNodeVector;
 
-// TODO(bnoordhuis) This should be in a util.h header.
-uint32_t JenkinsHash(const uint8_t* data, unsigned size);
+// Set of heap graph nodes, keyed by node id.  Snapshots of large heaps contain
+// millions of nodes and a node-based container like std::set would make one
+// heap allocation per node, so this is a flat hash table with linear probing
+// instead.  Id 0 is never assigned to a heap object and marks empty slots.
+//
+// The set is built in two phases: Insert() nodes, then Sort() once to compact
+// the table into an array that is ordered by node id, ready to be merged
+// with another sorted sequence.  Insert() must not be called after Sort().
+class HeapGraphNodeSet {
+ public:
+  typedef HeapGraphNodeVector::const_iterator const_iterator;
+  HeapGraphNodeSet();
+  // Sizes the table for |count| nodes.  Optional, the table grows on demand.
+  void Reserve(size_t count);
+  // Returns false if a node with the same id is already in the set.
+  bool Insert(const HeapGraphNodeWrap& wrap);
+  void Sort();
+  const_iterator begin() const;
+  const_iterator end() const;
+  size_t size() const;
+  // Only valid after Sort().  Returns the position of the node with the
+  // given id in the sorted array or size() when there is no such node.
+  size_t Find(v8::SnapshotObjectId id) const;
+  const HeapGraphNodeWrap& operator[](size_t index) const;
+ private:
+  void Resize(size_t capacity);
+  HeapGraphNodeVector slots_;
+  size_t size_;
+  unsigned shift_;
+  bool sorted_;
+  // Forbid copy and assigment.
+  HeapGraphNodeSet(const HeapGraphNodeSet&);
+  void operator=(const HeapGraphNodeSet&);
+};
+
+// Returns true if the object with this id is part of a 1 in |sample| sample
+// of the heap.  Object ids are stable across snapshots, an object that is
+// sampled in one snapshot is sampled in the next one too.
+bool IsSampled(v8::SnapshotObjectId id, uint32_t sample);
+
+// Adds the object nodes of |snapshot| that are part of a 1 in |sample| sample
+// to |set|.  Unlike HeapGraphWalker, it doesn't walk the graph from the root
+// but scans the edges of every node in the snapshot's node list.  Objects
+// are sampled when they're the target of an edge that the walk would follow,
+// so objects that are only retained through internal, weak or shortcut edges
+// are left out like they are in a full diff.  What remains of the bias are
+// objects retained by unreachable ones; V8 collects garbage before taking a
+// snapshot, there are few of those.  When |counts| isn't NULL, every node of
+// the snapshot is counted, not only the sampled objects.
+void SampleObjects(const v8::HeapSnapshot* snapshot,
+                   uint32_t sample,
+                   HeapGraphNodeSet* set,
+                   TypeCounts* counts);
+
+// Returns true if the heap graph walk should follow edges of this type.
+bool IsInterestingEdge(v8::HeapGraphEdge::Type type);
+
+// Iterative depth-first walk over the heap graph.  Deeply nested structures
+// like long linked lists or promise chains would blow up the native stack
+// if the walk was recursive so pending nodes are kept on an explicit stack
+// instead.  The stack retains its capacity between walks so a single walker
+// can be used for several snapshots without reallocating.
+class HeapGraphWalker {
+ public:
+  HeapGraphWalker();
+  // Adds |root| and all nodes that are reachable from it to |set|.  Counts
+  // them in |counts| unless it's NULL, heap numbers included.
+  void Walk(const v8::HeapGraphNode* root,
+            HeapGraphNodeSet* set,
+            TypeCounts* counts);
+ private:
+  void Visit(const v8::HeapGraphNode* node, HeapGraphNodeSet* set);
+  std::vector<const v8::HeapGraphNode*> stack_;
+  // Only set while Walk() counts nodes.  Heap numbers aren't added to the
+  // walk's set, |numbers_| makes sure that each one is counted once.
+  TypeCounts* counts_;
+  HeapGraphNodeSet* numbers_;
+  // Forbid copy and assigment.
+  HeapGraphWalker(const HeapGraphWalker&);
+  void operator=(const HeapGraphWalker&);
+};
+
+// Compact adjacency list of the heap graph, using the same edge filter as
+// HeapGraphWalker.  Nodes are identified by their position in a sorted
+// HeapGraphNodeSet and edges are stored back to back in one flat array, at
+// four bytes per node and per edge.
+class HeapGraph {
+ public:
+  static const uint32_t kNone = static_cast<uint32_t>(-1);
+  HeapGraph();
+  // Returns false, leaving the graph incomplete, when the clock passes
+  // |deadline| (a uv_hrtime() timestamp.)
+  bool Build(const HeapGraphNodeSet& nodes, uint64_t deadline);
+  // Builds the reverse of |graph|: an edge from a to b becomes one from b to a.
+  void Reverse(const HeapGraph& graph);
+  uint32_t size() const;
+  const uint32_t* begin(uint32_t index) const;
+  const uint32_t* end(uint32_t index) const;
+ private:
+  std::vector<uint32_t> offsets_;  // Has size() + 1 elements.
+  std::vector<uint32_t> edges_;
+  // Forbid copy and assigment.
+  HeapGraph(const HeapGraph&);
+  void operator=(const HeapGraph&);
+};
+
+// Dominator tree of a HeapGraph, computed with the Lengauer-Tarjan algorithm
+// (the simple variant with path compression, O(E log V).)  Object x dominates
+// object y when every path from the root to y goes through x; the retained
+// size of x is the sum of the self sizes of all the objects it dominates.
+class DominatorTree {
+ public:
+  DominatorTree();
+  // Returns false, leaving the tree empty, when the clock passes |deadline|.
+  bool Build(const HeapGraph& graph, uint32_t root, uint64_t deadline);
+  // Returns HeapGraph::kNone for the root and for unreachable nodes.
+  uint32_t idom(uint32_t index) const;
+  // Reachable nodes in depth-first order.  Dominators precede the nodes
+  // they dominate.
+  const std::vector<uint32_t>& order() const;
+ private:
+  uint32_t Eval(uint32_t v);
+  void Compress(uint32_t v);
+  // Releases everything, used when Build() runs out of time.
+  void Reset();
+  std::vector<uint32_t> idom_;
+  std::vector<uint32_t> order_;
+  // Scratch space for Build(), indexed by depth-first number.
+  std::vector<uint32_t> ancestor_;
+  std::vector<uint32_t> label_;
+  std::vector<uint32_t> semi_;
+  std::vector<uint32_t> stack_;
+  // Forbid copy and assigment.
+  DominatorTree(const DominatorTree&);
+  void operator=(const DominatorTree&);
+};
+
+struct Options {
+  Options();
+  // Report the retained size of this many of the fastest growing classes.
+  uint32_t retained;
+  // Report the shortest retainer paths of this many of the fastest growing
+  // classes, at most |retainer_paths| paths per class.
+  uint32_t retainers;
+  uint32_t retainer_paths;
+  // Give up on the retained sizes and the retainer path search after this
+  // many milliseconds.
+  uint32_t retainer_time;
+  // Only look at 1 in |sample| objects.  Used by startHeapDiff().
+  uint32_t sample;
+  // Return the summary as columns instead of an object per class.
+  bool columnar;
+  // Report the age distribution of the live instances of each class.
+  bool ages;
+  // Report this many of the most duplicated strings.  Reads at most
+  // |string_budget| bytes of string contents.
+  uint32_t strings;
+  uint32_t string_budget;
+  // Report the growth of closures and contexts at this many locations.
+  // Only startHeapDiff() reads it, the diff uses the start digest's value.
+  uint32_t closures;
+  // Report the growth of each node type.  Must be passed to startHeapDiff()
+  // too.
+  bool types;
+  // Abort snapshots that take more than |snapshot_time| milliseconds or
+  // that have more than |snapshot_size| objects.  Zero means no limit.
+  uint32_t snapshot_time;
+  uint32_t snapshot_size;
+};
+
+void ParseOptions(v8::Isolate* isolate,
+                  v8::Handle<v8::Value> value,
+                  Options* options);
+
+// Enforces the snapshot budget from the options.  V8 reports its progress
+// every few thousand objects while it builds a snapshot, returning kAbort
+// makes it give up and return NULL.  The progress and the cost of the last
+// snapshot are recorded in |statistics|, indexed by Statistic.  The array is
+// exposed to JS as heapSnapshotStatistics.
+class SnapshotControl : public v8::ActivityControl {
+ public:
+  enum Statistic {
+    kProgressDone,
+    kProgressTotal,
+    kDuration,  // Milliseconds.
+    kSnapshots,
+    kAborted,
+    kStatisticsCount
+  };
+  SnapshotControl(const Options& options, uint32_t* statistics);
+  virtual ControlOption ReportProgressValue(int done, int total);
+  // Call when V8 is done, |snapshot| is NULL when it was aborted.
+  void Finish(const v8::HeapSnapshot* snapshot);
+  // Returns { aborted: true, reason: 'time' or 'size', done, total }.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate) const;
+ private:
+  const uint64_t start_;
+  const uint64_t deadline_;  // Zero if there is no time limit.
+  const uint32_t size_budget_;
+  const char* reason_;
+  uint32_t* const statistics_;
+  // Forbid copy and assigment.
+  SnapshotControl(const SnapshotControl&);
+  void operator=(const SnapshotControl&);
+};
+
+// Returns { aborted: true, reason: 'not started' }, the status of a diff
+// whose start snapshot was over budget or was never taken.
+v8::Local<v8::Object> NotStartedStatus(v8::Isolate* isolate);
+
+// Highest object ids of the most recent snapshots, oldest first.  V8 hands
+// out object ids in increasing order: objects with an id between two
+// watermarks were allocated between the two snapshots.  Only the last
+// kMaxSize watermarks are kept.
+class Watermarks {
+ public:
+  static const size_t kMaxSize = 8;
+  Watermarks();
+  void Add(v8::SnapshotObjectId id);
+  // Number of watermarks below |id|, between 0 and size() inclusive.
+  uint32_t Age(v8::SnapshotObjectId id) const;
+  size_t size() const;
+ private:
+  std::vector<v8::SnapshotObjectId> ids_;
+};
+
+enum EntryKind {
+  kObjectEntry,
+  kClosureEntry,
+  kContextEntry
+};
+
+struct DigestEntry {
+  // Self sizes saturate at 1 GB - 1, see DigestSize().
+  static const uint32_t kMaxSize = (1u << 30) - 1;
+  v8::SnapshotObjectId id;
+  // Index into the digest's class name table.  For closures and contexts,
+  // index into its location table, see ClosureKeys.
+  uint32_t name;
+  uint32_t size : 30;  // Self size.
+  uint32_t kind : 2;  // EntryKind.
+};
+
+// Returns the self size of |node|, clamped to DigestEntry::kMaxSize.  An
+// object of a gigabyte or more is reported as slightly smaller than that
+// instead of wrapping around.  New objects are clamped the same way so that
+// creating and later reaping one nets out to zero.
+uint32_t DigestSize(const v8::HeapGraphNode* node);
+
+// Closures and contexts are grouped by the name of the function and the
+// script that defines it, e.g. "onconnect lib/proxy.js".  V8's snapshot API
+// doesn't expose line numbers.  A context is grouped with the closure that
+// created it, its "closure" edge.  Both need the isolate to look up names.
+class ClosureKeys {
+ public:
+  static const uint32_t kNone = static_cast<uint32_t>(-1);
+  explicit ClosureKeys(v8::Isolate* isolate);
+  uint32_t ForClosure(StringTable* locations,
+                      const v8::HeapGraphNode* closure);
+  // Returns kNone if |node| is not a function context.
+  uint32_t ForContext(StringTable* locations, const v8::HeapGraphNode* node);
+  // Adds the contexts of the closures in |objects| to |contexts|.  The
+  // "context" edge of a closure is an internal edge, HeapGraphWalker doesn't
+  // follow those, so most contexts are only found this way.
+  void AddContexts(const HeapGraphNodeSet& objects, HeapGraphNodeSet* contexts);
+ private:
+  const v8::HeapGraphNode* FindInternalEdge(const v8::HeapGraphNode* node,
+                                            v8::Local<v8::String> name) const;
+  void Append(v8::Handle<v8::String> string);
+  v8::Isolate* const isolate_;
+  v8::Local<v8::String> closure_string_;
+  v8::Local<v8::String> context_string_;
+  v8::Local<v8::String> context_edge_string_;
+  v8::Local<v8::String> script_string_;
+  v8::Local<v8::String> shared_string_;
+  std::vector<uint16_t> scratch_;
+};
+
+// Compact digest of a heap snapshot: one entry per object node, ordered by
+// node id.  A full V8 heap snapshot is many times bigger than the heap it
+// describes; reducing it to a digest lets StartHeapDiff() delete the start
+// snapshot right away instead of keeping it alive until StopHeapDiff().
+class HeapDigest {
+ public:
+  HeapDigest();
+  // Only records a 1 in |options.sample| sample of the objects when it's > 1.
+  // Records closures and contexts when |options.closures| > 0 and counts
+  // nodes by type when |options.types| is true.  |history| holds the
+  // watermarks of earlier snapshots.
+  void Build(v8::Isolate* isolate,
+             const v8::HeapSnapshot* snapshot,
+             const Options& options,
+             const Watermarks& history);
+  const std::vector<DigestEntry>& entries() const;
+  uint32_t sample() const;
+  // The |options.closures| that the digest was built with, zero when it
+  // has no closures and contexts.
+  uint32_t closures() const;
+  // NULL if the digest was built without |options.types|.
+  const TypeCounts* type_counts() const;
+  // |history| plus the watermark of this snapshot.
+  const Watermarks& watermarks() const;
+  // Class names of the objects in the digest.  Summarize() adds the class
+  // names from the end snapshot to the same table.
+  StringTable* names();
+  // Closure locations, see ClosureKeys.  A table of their own so that the
+  // class names in the summary don't share indices with them.
+  StringTable* locations();
+ private:
+  std::vector<DigestEntry> entries_;
+  StringTable names_;
+  StringTable locations_;
+  uint32_t sample_;
+  uint32_t closures_;
+  bool types_;
+  TypeCounts type_counts_;
+  Watermarks watermarks_;
+  // Forbid copy and assigment.
+  HeapDigest(const HeapDigest&);
+  void operator=(const HeapDigest&);
+};
+
+// Receives the heap object statistics that V8 reports while heap object
+// tracking is enabled.  V8 assigns object ids in increasing order and starts
+// a new id interval every time the statistics are requested.  For every
+// interval whose live object count changed since the last request, it
+// reports the number and total size of the interval's live objects.
+//
+// New intervals therefore describe the objects that were allocated since the
+// previous request and are still alive, and a shrinking interval means that
+// objects from it were freed.  It's all done without building a snapshot
+// of the heap graph.  V8 doesn't report statistics per class, only per
+// interval.
+class HeapStats : public v8::OutputStream {
+ public:
+  HeapStats();
+  // Call before v8::HeapProfiler::GetHeapStats().  Zeroes the counters.
+  void Reset();
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate) const;
+  virtual void EndOfStream();
+  virtual WriteResult WriteAsciiChunk(char* data, int size);
+  virtual WriteResult WriteHeapStatsChunk(v8::HeapStatsUpdate* data,
+                                          int count);
+ private:
+  std::vector<v8::HeapStatsUpdate> intervals_;  // Indexed by interval.
+  size_t known_intervals_;  // Intervals that existed at the last Reset().
+  double allocated_count_;
+  double allocated_size_;
+  double freed_count_;
+  double freed_size_;
+  double live_count_;
+  double live_size_;
+};
 
-void AddHeapGraphNodeToSet(const v8::HeapGraphNode* node,
-                           HeapGraphNodeSet* set);
+// Diffs a heap snapshot against a digest of an earlier snapshot.  The work
+// is split in two steps.  Compute() does the heavy lifting: walking the
+// graph, merging it with the digest and, if requested, the dominator tree.
+// It only uses HeapGraphNode and HeapGraphEdge accessors that don't touch
+// the isolate on V8 3.2x, and can run on a thread pool thread on v0.12.
+// Finish() looks up the class names of new objects and builds the result,
+// it must run on the main thread.  The digest and the snapshot must stay
+// alive until Finish() returns.
+class HeapDiff {
+ public:
+  HeapDiff(HeapDigest* start_digest,
+           const v8::HeapSnapshot* end_snapshot,
+           const Options& options);
+  void Compute();
+  v8::Local<v8::Object> Finish(v8::Isolate* isolate);
+  // Appends the class histogram to |history|.  Call after Finish(), the
+  // class names of new objects are looked up there.  Classes with no net
+  // change are left out.  Returns zero or an errno code.
+  int AppendTo(HeapHistory* history, double timestamp) const;
+ private:
+  struct RetainerPath {
+    uint32_t retainer;  // Node that retains the instances.
+    uint32_t target;  // The first instance that was found.
+    uint32_t count;  // Number of instances retained by |retainer|.
+  };
+  struct StringGroup {
+    uint32_t count;  // Number of copies.
+    uint32_t first_size;  // Self size of the first copy.
+    double size;  // Self size of all copies.
+  };
+  void Touch(uint32_t name);
+  // Puts |touched_| in the order that the std::map based summary used, so
+  // the output is the same as before the classes were interned.
+  void SortTouched();
+  void CountAge(uint32_t name, v8::SnapshotObjectId id);
+  void ScoreEntry(uint32_t kind, uint32_t name, int size, bool plus);
+  // Finds the contexts of the closures in the end snapshot and scores the
+  // ones that have been created or reaped.  Adds them to |contexts|.
+  void ScoreContexts(v8::Isolate* isolate,
+                     ClosureKeys* keys,
+                     HeapGraphNodeSet* contexts);
+  void AddExtras(v8::Isolate* isolate, v8::Local<v8::Object> result);
+  v8::Local<v8::Array> ClosureGrowth(v8::Isolate* isolate) const;
+  v8::Local<v8::Array> DuplicateStrings(v8::Isolate* isolate) const;
+  v8::Local<v8::Object> ToColumns(v8::Isolate* isolate) const;
+  v8::Local<v8::Object> TypesToObject(v8::Isolate* isolate) const;
+  void TopGrowingClasses(size_t limit, std::vector<uint32_t>* names) const;
+  void ComputeRetainedSizes(const HeapGraph& graph, uint64_t deadline);
+  void AggregateRetainedSizes(std::vector<double>* sizes) const;
+  void ComputeShortestPaths(const HeapGraph& graph, uint64_t deadline);
+  void FindRetainerPaths(const std::vector<uint32_t>& names,
+                         std::vector<RetainerPath>* paths) const;
+  v8::Local<v8::Object> RetainerPathToObject(v8::Isolate* isolate,
+                                             const RetainerPath& path);
+  HeapDigest* const start_digest_;
+  // Looked up in the constructor, which runs on the main thread.
+  const v8::HeapSnapshot* const end_snapshot_;
+  const v8::HeapGraphNode* const end_root_;
+  const v8::SnapshotObjectId end_root_id_;
+  const int end_nodes_count_;
+  const uint32_t sample_;
+  Options options_;
+  HeapGraphNodeSet end_objects_;
+  std::vector<uint32_t> added_;  // Indices of new objects in |end_objects_|.
+  // Indices of the start digest's contexts that aren't in |end_objects_|.
+  // Finish() checks them against the contexts of the end snapshot.
+  std::vector<uint32_t> missing_contexts_;
+  std::vector<Score> scores_;    // Indexed by class name index.
+  // Indexed by location index.
+  std::vector<Score> closure_scores_;
+  std::vector<Score> context_scores_;
+  std::vector<uint32_t> touched_;
+  std::vector<bool> is_touched_;
+  // Live instances per class and age, |age_buckets_| per class.
+  const uint32_t age_buckets_;
+  std::vector<uint32_t> ages_;
+  // End snapshot minus start snapshot, only used with |options_.types|.
+  TypeCounts type_counts_;
+  // Only used for the retained size calculation.  |classes_| maps nodes
+  // to class name indices, |retained_| holds per node retained sizes.
+  std::vector<uint32_t> classes_;
+  std::vector<double> retained_;
+  DominatorTree tree_;
+  // Only used for the retainer paths.  Breadth-first search tree from the
+  // root and the nodes in the order they were found, i.e. by distance from
+  // the root.  Nodes that the search didn't reach have no parent.
+  std::vector<uint32_t> parents_;
+  std::vector<uint32_t> bfs_order_;
+  // Node and edge names in retainer paths.  Kept out of the digest's class
+  // names, property names would otherwise pile up in a table that outlives
+  // the diff.
+  StringTable labels_;
+  std::vector<uint16_t> scratch_;
+  // Forbid copy and assigment.
+  HeapDiff(const HeapDiff&);
+  void operator=(const HeapDiff&);
+};
 
 // Returns an object that looks something like this:
 //
@@ -91,9 +539,110 @@ void AddHeapGraphNodeToSet(const v8::HeapGraphNode* node,
 // When |total| and |size| are negative, more instances have been reaped by
 // the garbage collector than were created by the application.  |total| and
 // |size| are always paired: if one is negative, then so is the other.
+//
+// When |options.retained| is non-zero, the entries of that many classes with
+// the biggest growth in |size| get a |retained| property: the aggregated
+// retained size of the class's instances in the end snapshot.  Instances
+// that are dominated by other instances of the same class are only counted
+// once, through their dominator.  Classes that shrunk are never reported
+// and at most 32 classes are.  Building the dominator tree takes about as
+// much time as the diff itself and around 40 bytes per object plus 8 bytes
+// per reference.
+//
+// When |options.retainers| is non-zero, the entries of that many of the
+// fastest growing classes get a |retainers| property, an array of up to
+// |options.retainerPaths| objects that look like this:
+//
+//  { path: '(GC roots) -> (Global handles) -> Object.timers -> Timeout',
+//    count: 1200, depth: 4 }
+//
+// |path| is the shortest path from the GC roots to an instance of the class,
+// |depth| its length and |count| the number of instances that are retained
+// by the same object.  Paths from different retainers are reported, nearest
+// first.  The search visits every object at most once but it's abandoned
+// after |options.retainerTime| milliseconds, classes whose instances weren't
+// reached in time have fewer or no paths.
+//
+// |options.retainerTime| is one budget for the whole graph stage: building
+// the graph, the dominator tree and the path search.  When the graph or the
+// dominator tree can't be finished in time, |retained| is left out and, if
+// the graph itself wasn't finished, |retainers| is an empty array.
+//
+// When the start digest was built with |options.sample| > 1, only the objects
+// in the sample are diffed.  |total| and |size| are scaled up estimates and
+// every entry gets |totalError| and |sizeError| properties, the half-width
+// of their 95% confidence interval.  The sample doesn't include the edges
+// between objects, |retained| and |retainers| aren't reported.
+//
+// When |options.columnar| is true, the result is an object with a column
+// per field instead:
+//
+//  { type: [ 'Timeout', 'Timer', 'Array' ],
+//    total: Int32Array [ 1, 2, 1 ],
+//    size: Int32Array [ 136, 64, 32 ],
+//    sample: 1 }
+//
+// Both typed arrays share one ArrayBuffer.  Sampled counts and sizes are not
+// scaled, multiply them by |sample|.  Retained sizes, retainer paths and
+// error bounds aren't reported in this format.
+//
+// When |options.ages| is true, every entry gets an |ages| property with the
+// number of live instances of the class in the end snapshot, bucketed by the
+// interval in which they were allocated.  The first bucket counts instances
+// that predate the oldest of the last eight startHeapDiff() snapshots and
+// the last bucket counts instances that were allocated since the most
+// recent one, i.e. since the start of this diff.  Instances that churn only
+// show up in the last bucket; a cache that never lets go of its entries
+// fills up all buckets.
+//
+// When |options.strings| is non-zero, the result gets a |strings| property
+// that lists the string values with the most bytes spent on copies:
+//
+//  [ { value: 'content-type', count: 5000, size: 120000, wasted: 119976 } ]
+//
+// |size| is the total self size of the copies, |wasted| what would be saved
+// if they were all one string.  V8 truncates string values in snapshots to
+// 1024 characters, |value| is further cut to 256 characters.  Reading string
+// values is slow and has to happen on the main thread, the scan stops after
+// |options.stringBudget| bytes (default 8 MB.)  It needs the full snapshot,
+// there's no string report in sampled mode.
+//
+// When |options.closures| was non-zero when startHeapDiff() was called, the
+// result gets a |closures| property with the growth of closures and their
+// contexts at that many locations, biggest growth first.  The value passed to
+// stopHeapDiff() is ignored; the start digest decides, else closures that
+// were or weren't recorded at the start would be scored inconsistently:
+//
+//  [ { location: 'onconnect lib/proxy.js', total: 100, size: 7200,
+//      contexts: 100, contextsSize: 5600 } ]
+//
+// Recording closures and contexts looks up the names of all closures and
+// hidden objects in the start snapshot; it makes startHeapDiff() slower.
+// Not available in sampled mode.
+//
+// When |history| isn't NULL, the class histogram is appended to it too.
+// If that fails, the result gets a |historyError| property with the Error.
+// The history file stays valid, the next diff tries again.
+//
+// When |options.types| is true and was passed to startHeapDiff() too, the
+// result gets a |types| property with the growth per node type, including
+// the heap numbers that the rest of the diff ignores:
+//
+//  { type: [ 'hidden', 'array', 'string', 'object', ... ],
+//    total: Float64Array [ 12, 40, 1800, 300, ... ],
+//    size: Float64Array [ 480, 3200, 96000, 24000, ... ] }
+//
+// The arrays have one element per node type that the V8 version knows of.
+// The full diff counts the nodes that the heap walk reaches, the same nodes
+// the class report is based on.  In sampled mode, there's no walk and every
+// node in the snapshot is counted, unreachable garbage and the nodes behind
+// internal and weak edges included.  The numbers are exact, not scaled, but
+// they're not comparable with those of a full diff.
 v8::Local<v8::Object> Summarize(v8::Isolate* isolate,
-                                const v8::HeapSnapshot* start_snapshot,
-                                const v8::HeapSnapshot* end_snapshot);
+                                HeapDigest* start_digest,
+                                const v8::HeapSnapshot* end_snapshot,
+                                const Options& options,
+                                HeapHistory* history);
 
 }  // namespace heapdiff
 }  // namespace agent
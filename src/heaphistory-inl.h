@@ -0,0 +1,617 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_HEAPHISTORY_INL_H_
+#define AGENT_SRC_HEAPHISTORY_INL_H_
+
+#include "heaphistory.h"
+#include "util-inl.h"
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+namespace strongloop {
+namespace agent {
+namespace heapdiff {
+
+static const char kHistoryMagic[] = { 'S', 'L', 'H', 'H' };
+static const size_t kHistoryHeaderSize = 8;
+static const size_t kIntervalHeaderSize = 16;
+static const size_t kRecordSize = 12;
+
+HistoryTrend::HistoryTrend()
+    : total(0), size(0), intervals(0), first(0), last(0) {
+}
+
+v8::Local<v8::Object> HistoryTrend::ToObject(v8::Isolate* isolate) const {
+  const struct {
+    v8::Local<v8::String> name;
+    double value;
+  } fields[] = {
+    { FixedString(isolate, "total"), total },
+    { FixedString(isolate, "size"), size },
+    { FixedString(isolate, "intervals"), static_cast<double>(intervals) },
+    { FixedString(isolate, "first"), first },
+    { FixedString(isolate, "last"), last },
+  };
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name,
+                v8::Number::New(isolate, fields[index].value));
+  }
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name, v8::Number::New(fields[index].value));
+  }
+#endif
+  return object;
+}
+
+HeapHistoryReader::HeapHistoryReader()
+    : data_(NULL), size_(0), valid_size_(0) {
+}
+
+HeapHistoryReader::~HeapHistoryReader() {
+  Close();
+}
+
+#ifdef _WIN32
+
+// The history file is mapped and written with POSIX calls.  The bindings
+// don't export startHeapHistory() and queryHeapHistory() on Windows, the
+// file is never opened there.
+int HeapHistoryReader::Open(const char*) {
+  return ENOSYS;
+}
+
+void HeapHistoryReader::Close() {
+}
+
+#else
+
+int HeapHistoryReader::Open(const char* path) {
+  Close();
+  const int fd = ::open(path, O_RDONLY);
+  if (fd == -1) {
+    return errno;
+  }
+  struct stat s;
+  if (::fstat(fd, &s) == -1) {
+    const int err = errno;
+    ::close(fd);
+    return err;
+  }
+  if (s.st_size > 0) {
+    void* data = ::mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      const int err = errno;
+      ::close(fd);
+      return err;
+    }
+    data_ = static_cast<const char*>(data);
+    size_ = s.st_size;
+  }
+  ::close(fd);  // The mapping stays valid.
+  if (Parse() == false) {
+    Close();
+    return EINVAL;
+  }
+  return 0;
+}
+
+void HeapHistoryReader::Close() {
+  if (data_ != NULL) {
+    ::munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  valid_size_ = 0;
+  strings_.clear();
+  intervals_.clear();
+}
+
+#endif  // _WIN32
+
+size_t HeapHistoryReader::valid_size() const {
+  return valid_size_;
+}
+
+size_t HeapHistoryReader::strings_count() const {
+  return strings_.size();
+}
+
+size_t HeapHistoryReader::intervals_count() const {
+  return intervals_.size();
+}
+
+void HeapHistoryReader::GetInterval(size_t index,
+                                    double* timestamp,
+                                    uint32_t* sample,
+                                    std::vector<HistoryRecord>* records) const {
+  const size_t offset = intervals_[index];
+  *timestamp = ReadDouble(offset);
+  *sample = ReadUint32(offset + 8);
+  records->resize(ReadUint32(offset + 12));
+  if (records->empty() == false) {
+    ::memcpy(&records->front(),
+             data_ + offset + kIntervalHeaderSize,
+             kRecordSize * records->size());
+  }
+}
+
+void HeapHistoryReader::GetString(size_t index,
+                                  std::vector<uint16_t>* out) const {
+  const size_t offset = strings_[index];
+  out->resize(ReadUint32(offset));
+  if (out->empty() == false) {
+    ::memcpy(&out->front(), data_ + offset + 4, 2 * out->size());
+  }
+}
+
+HistoryTrend HeapHistoryReader::Query(const uint16_t* name,
+                                      size_t size,
+                                      double since) const {
+  HistoryTrend trend;
+  uint32_t index = 0;
+  while (index < strings_.size()) {
+    const size_t offset = strings_[index];
+    if (ReadUint32(offset) == size &&
+        ::memcmp(data_ + offset + 4, name, 2 * size) == 0) {
+      break;
+    }
+    index += 1;
+  }
+  if (index == strings_.size()) {
+    return trend;  // Never seen this class.
+  }
+  // Intervals are appended in chronological order, walk back from the most
+  // recent one until we're past |since|.
+  for (size_t interval = intervals_.size(); interval > 0; interval -= 1) {
+    const size_t offset = intervals_[interval - 1];
+    const double timestamp = ReadDouble(offset);
+    if (timestamp < since) {
+      break;
+    }
+    if (trend.intervals == 0) {
+      trend.last = timestamp;
+    }
+    trend.first = timestamp;
+    trend.intervals += 1;
+    HistoryRecord record;
+    if (FindRecord(interval - 1, index, &record)) {
+      const double sample = ReadUint32(offset + 8);
+      trend.total += sample * record.total;
+      trend.size += sample * record.size;
+    }
+  }
+  return trend;
+}
+
+bool HeapHistoryReader::Parse() {
+  if (size_ == 0) {
+    return true;
+  }
+  if (size_ < kHistoryHeaderSize) {
+    // The header write was torn.  There are no intervals yet.
+    const size_t size = std::min(size_, sizeof(kHistoryMagic));
+    return ::memcmp(data_, kHistoryMagic, size) == 0;
+  }
+  if (::memcmp(data_, kHistoryMagic, sizeof(kHistoryMagic)) != 0 ||
+      ReadUint32(4) != HeapHistory::kVersion) {
+    return false;
+  }
+  size_t offset = kHistoryHeaderSize;
+  valid_size_ = offset;
+  while (size_ - offset >= 8) {
+    const uint32_t tag = ReadUint32(offset);
+    const uint32_t length = ReadUint32(offset + 4);
+    const size_t payload = offset + 8;
+    const size_t end = payload + length;
+    if (length > size_ - payload) {
+      break;  // Torn block.
+    }
+    if (tag == kStringsBlock) {
+      // Only the last block can be torn but stop at anything that's off,
+      // everything after it would be suspect.
+      size_t position = payload;
+      while (position < end) {
+        if (end - position < 4 ||
+            ReadUint32(position) > (end - position - 4) / 2) {
+          return true;
+        }
+        strings_.push_back(position);
+        position += 4 + 2 * ReadUint32(position);
+      }
+    } else if (tag == kIntervalBlock) {
+      if (length < kIntervalHeaderSize ||
+          ReadUint32(payload + 12) >
+              (length - kIntervalHeaderSize) / kRecordSize) {
+        return true;
+      }
+      intervals_.push_back(payload);
+    }
+    // Skip blocks we don't know about, newer versions may add some.
+    offset = end;
+    valid_size_ = offset;
+  }
+  return true;
+}
+
+uint32_t HeapHistoryReader::ReadUint32(size_t offset) const {
+  // memcpy() because blocks are not aligned.  Compilers turn it into a load.
+  uint32_t value;
+  ::memcpy(&value, data_ + offset, sizeof(value));
+  return value;
+}
+
+double HeapHistoryReader::ReadDouble(size_t offset) const {
+  double value;
+  ::memcpy(&value, data_ + offset, sizeof(value));
+  return value;
+}
+
+bool HeapHistoryReader::FindRecord(size_t interval,
+                                   uint32_t name,
+                                   HistoryRecord* record) const {
+  // Records are ordered by name, binary search them.
+  const size_t offset = intervals_[interval];
+  const size_t records = offset + kIntervalHeaderSize;
+  size_t low = 0;
+  size_t high = ReadUint32(offset + 12);
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    const uint32_t value = ReadUint32(records + middle * kRecordSize);
+    if (value < name) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == ReadUint32(offset + 12) ||
+      ReadUint32(records + low * kRecordSize) != name) {
+    return false;
+  }
+  ::memcpy(record, data_ + records + low * kRecordSize, sizeof(*record));
+  return true;
+}
+
+const size_t HeapHistory::kDefaultMaxSize;
+
+HeapHistory::HeapHistory()
+    : max_size_(0), fd_(-1), size_(0), strings_written_(0) {
+}
+
+HeapHistory::~HeapHistory() {
+  Close();
+}
+
+#ifdef _WIN32
+
+int HeapHistory::Open(const char*, size_t) {
+  return ENOSYS;
+}
+
+void HeapHistory::Close() {
+}
+
+int HeapHistory::Compact() {
+  return ENOSYS;
+}
+
+#else
+
+// Writes all of |data| at |offset|, retrying short writes.  Returns zero on
+// success, an errno code otherwise.
+int WriteAll(int fd, const std::vector<char>& data, size_t offset) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = ::pwrite(fd,
+                               &data[written],
+                               data.size() - written,
+                               offset + written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      return errno;
+    }
+    written += n;
+  }
+  return 0;
+}
+
+int HeapHistory::Open(const char* path, size_t max_size) {
+  path_.assign(path, path + ::strlen(path) + 1);
+  max_size_ = max_size;
+  // Continue the string table of the existing file, if there is one.
+  HeapHistoryReader reader;
+  size_t size = 0;
+  int err = reader.Open(path);
+  if (err == 0) {
+    std::vector<uint16_t> name;
+    for (size_t index = 0; index < reader.strings_count(); index += 1) {
+      reader.GetString(index, &name);
+      names_.Intern(name.empty() ? NULL : &name.front(), name.size());
+    }
+    size = reader.valid_size();
+    reader.Close();
+  } else if (err != ENOENT) {
+    return err;
+  }
+  strings_written_ = names_.size();
+  fd_ = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd_ == -1) {
+    return errno;
+  }
+  // Cut off the torn block, if any.
+  if (::ftruncate(fd_, size) == -1) {
+    err = errno;
+    Close();
+    return err;
+  }
+  size_ = size;
+  if (size_ == 0) {
+    buffer_.clear();
+    PutHeader();
+    err = WriteOut();
+    if (err != 0) {
+      Close();
+      return err;
+    }
+  }
+  return 0;
+}
+
+void HeapHistory::Close() {
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+  fd_ = -1;
+}
+
+int HeapHistory::Compact() {
+  HeapHistoryReader reader;
+  int err = reader.Open(&path_[0]);
+  if (err != 0) {
+    return err;
+  }
+  // Keep the newest intervals that fit in half the maximum size, so the
+  // file has room for many appends before it's compacted again.
+  std::vector<Interval> intervals;
+  size_t bytes = 0;
+  for (size_t index = reader.intervals_count(); index > 0; index -= 1) {
+    Interval interval;
+    reader.GetInterval(index - 1,
+                       &interval.timestamp,
+                       &interval.sample,
+                       &interval.records);
+    bytes += 8 + kIntervalHeaderSize + kRecordSize * interval.records.size();
+    if (bytes > max_size_ / 2) {
+      break;
+    }
+    intervals.push_back(interval);
+  }
+  std::reverse(intervals.begin(), intervals.end());
+  // Renumber the strings that are still in use.  New indices are handed out
+  // in the order of the old ones, the records stay sorted by name.
+  const uint32_t kNone = static_cast<uint32_t>(-1);
+  std::vector<uint32_t> remap(reader.strings_count(), kNone);
+  for (std::vector<Interval>::const_iterator it = intervals.begin(),
+       end = intervals.end(); it != end; ++it) {
+    for (size_t k = 0; k < it->records.size(); k += 1) {
+      if (it->records[k].name < remap.size()) {
+        remap[it->records[k].name] = 0;
+      }
+    }
+  }
+  std::vector<uint16_t> name;
+  StringTable names;
+  for (size_t index = 0; index < remap.size(); index += 1) {
+    if (remap[index] != kNone) {
+      reader.GetString(index, &name);
+      remap[index] = names.Intern(name.empty() ? NULL : &name.front(),
+                                  name.size());
+    }
+  }
+  reader.Close();
+
+  buffer_.clear();
+  PutHeader();
+  if (names.size() > 0) {
+    size_t length = 0;
+    for (size_t index = 0; index < names.size(); index += 1) {
+      length += 4 + 2 * names.size(index);
+    }
+    PutBlockHeader(kStringsBlock, length);
+    for (size_t index = 0; index < names.size(); index += 1) {
+      const char* data = reinterpret_cast<const char*>(names.data(index));
+      PutUint32(static_cast<uint32_t>(names.size(index)));
+      buffer_.insert(buffer_.end(), data, data + 2 * names.size(index));
+    }
+  }
+  for (std::vector<Interval>::iterator it = intervals.begin(),
+       end = intervals.end(); it != end; ++it) {
+    // Records that refer to a string that isn't in the file are dropped.
+    std::vector<HistoryRecord>& records = it->records;
+    size_t kept = 0;
+    for (size_t k = 0; k < records.size(); k += 1) {
+      if (records[k].name < remap.size()) {
+        records[kept] = records[k];
+        records[kept].name = remap[records[k].name];
+        kept += 1;
+      }
+    }
+    records.resize(kept);
+    PutInterval(it->timestamp, it->sample, it->records);
+  }
+
+  // Write the new file next to the old one and rename it over the old one,
+  // readers see either file but never a half written one.
+  std::vector<char> path(path_);
+  std::vector<char> temp(path_.begin(), path_.end() - 1);
+  static const char kSuffix[] = ".compact";
+  temp.insert(temp.end(), kSuffix, kSuffix + sizeof(kSuffix));
+  const int fd = ::open(&temp[0], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return errno;
+  }
+  err = WriteAll(fd, buffer_, 0);
+  if (err == 0 && ::fsync(fd) == -1) {
+    err = errno;
+  }
+  if (::close(fd) == -1 && err == 0) {
+    err = errno;
+  }
+  if (err == 0 && ::rename(&temp[0], &path[0]) == -1) {
+    err = errno;
+  }
+  if (err != 0) {
+    ::unlink(&temp[0]);
+    return err;
+  }
+  Close();
+  names_.Clear();
+  return Open(&path[0], max_size_);
+}
+
+#endif  // _WIN32
+
+bool CompareRecordName(const HistoryRecord& a, const HistoryRecord& b) {
+  return a.name < b.name;
+}
+
+int HeapHistory::Append(double timestamp,
+                        uint32_t sample,
+                        const StringTable& names,
+                        std::vector<HistoryRecord>* records) {
+  if (fd_ == -1) {
+    return EBADF;
+  }
+  // Compact first, the records' names are translated into the string table
+  // of the compacted file.
+  int compact_err = 0;
+  if (max_size_ > 0 && size_ > max_size_) {
+    compact_err = Compact();
+    if (fd_ == -1) {
+      return compact_err;  // Reopening the compacted file failed.
+    }
+  }
+  for (std::vector<HistoryRecord>::iterator it = records->begin(),
+       end = records->end(); it != end; ++it) {
+    it->name = names_.Intern(names.data(it->name), names.size(it->name));
+  }
+  std::sort(records->begin(), records->end(), CompareRecordName);
+  buffer_.clear();
+  // New strings first, the interval refers to them.  Strings whose append
+  // failed the last time are written again now.
+  if (strings_written_ < names_.size()) {
+    size_t length = 0;
+    for (size_t index = strings_written_; index < names_.size(); index += 1) {
+      length += 4 + 2 * names_.size(index);
+    }
+    PutBlockHeader(kStringsBlock, length);
+    for (size_t index = strings_written_; index < names_.size(); index += 1) {
+      const char* data = reinterpret_cast<const char*>(names_.data(index));
+      PutUint32(static_cast<uint32_t>(names_.size(index)));
+      buffer_.insert(buffer_.end(), data, data + 2 * names_.size(index));
+    }
+  }
+  PutInterval(timestamp, sample, *records);
+  const int err = WriteOut();
+  if (err != 0) {
+    return err;
+  }
+  strings_written_ = names_.size();
+  return compact_err;
+}
+
+void HeapHistory::PutHeader() {
+  buffer_.insert(buffer_.end(),
+                 kHistoryMagic,
+                 kHistoryMagic + sizeof(kHistoryMagic));
+  PutUint32(kVersion);
+}
+
+void HeapHistory::PutUint32(uint32_t value) {
+  const char* data = reinterpret_cast<const char*>(&value);
+  buffer_.insert(buffer_.end(), data, data + sizeof(value));
+}
+
+void HeapHistory::PutDouble(double value) {
+  const char* data = reinterpret_cast<const char*>(&value);
+  buffer_.insert(buffer_.end(), data, data + sizeof(value));
+}
+
+void HeapHistory::PutBlockHeader(HistoryBlock tag, size_t length) {
+  PutUint32(tag);
+  PutUint32(static_cast<uint32_t>(length));
+}
+
+void HeapHistory::PutInterval(double timestamp,
+                              uint32_t sample,
+                              const std::vector<HistoryRecord>& records) {
+  PutBlockHeader(kIntervalBlock,
+                 kIntervalHeaderSize + kRecordSize * records.size());
+  PutDouble(timestamp);
+  PutUint32(sample);
+  PutUint32(static_cast<uint32_t>(records.size()));
+  for (std::vector<HistoryRecord>::const_iterator it = records.begin(),
+       end = records.end(); it != end; ++it) {
+    PutUint32(it->name);
+    PutUint32(static_cast<uint32_t>(it->total));
+    PutUint32(static_cast<uint32_t>(it->size));
+  }
+}
+
+#ifdef _WIN32
+
+int HeapHistory::WriteOut() {
+  return ENOSYS;
+}
+
+#else
+
+int HeapHistory::WriteOut() {
+  const int err = WriteAll(fd_, buffer_, size_);
+  if (err != 0) {
+    // Roll back the partial write so the next append starts on a block
+    // boundary again.
+    if (::ftruncate(fd_, size_) == -1) {
+      Close();  // Can't recover, stop appending to a damaged file.
+    }
+    return err;
+  }
+  size_ += buffer_.size();
+  return 0;
+}
+
+#endif  // _WIN32
+
+v8::Local<v8::Value> HistoryErrorToValue(v8::Isolate* isolate, int err) {
+  const char* message =
+      err == EINVAL ? "Not a heap history file." : ::strerror(err);
+#if SL_NODE_VERSION == 12
+  return v8::Exception::Error(v8::String::NewFromUtf8(isolate, message));
+#elif SL_NODE_VERSION == 10
+  Use(isolate);
+  return v8::Exception::Error(v8::String::New(message));
+#endif
+}
+
+}  // namespace heapdiff
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_HEAPHISTORY_INL_H_
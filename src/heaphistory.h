@@ -0,0 +1,177 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_HEAPHISTORY_H_
+#define AGENT_SRC_HEAPHISTORY_H_
+
+#include "strong-agent.h"
+#include "util.h"
+#include "v8.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace strongloop {
+namespace agent {
+namespace heapdiff {
+
+// The class histograms of successive heap diffs, kept in an append-only file
+// so that they survive the process and can be queried without parsing JSON.
+// The file starts with an eight byte header, the magic "SLHH" and a uint32
+// version number, followed by blocks of the form:
+//
+//   uint32 tag, uint32 length, |length| bytes of payload
+//
+// There are two kinds of blocks:
+//
+//  - kStringsBlock adds strings to the file's string table, they get the
+//    next free indices.  Every string is a uint32 length followed by that
+//    many UTF-16 code units.
+//  - kIntervalBlock holds the histogram of one diff: a double timestamp in
+//    milliseconds since the epoch, the uint32 sample rate and the uint32
+//    number of records, followed by the fixed-width records themselves,
+//    ordered by name.
+//
+// A class name is written once, the first time it's seen, and after that
+// it's 12 bytes per class per interval.  Integers are in native byte order,
+// the file is meant to be read back on the same machine.
+//
+// An append writes its blocks at the end of the file, with as many pwrite()
+// calls as it takes.  When one fails, the file is truncated back to where
+// the append started.  When the process dies halfway, the file ends in a
+// torn block.  Nothing before it is ever rewritten in place, so readers
+// stop at the first block that doesn't fit in the file and only lose that
+// one interval; HeapHistory::Open() cuts it off.
+//
+// The file doesn't grow without bound.  Once it's bigger than its maximum
+// size, the next append first compacts it: the newest intervals that fit in
+// half the maximum size are written to a new file, with a single strings
+// block that holds only the class names they use, and the new file is
+// renamed over the old one.  Older intervals are lost.
+enum HistoryBlock {
+  kStringsBlock = 0x53,  // 'S'
+  kIntervalBlock = 0x49  // 'I'
+};
+
+struct HistoryRecord {
+  uint32_t name;  // Index into the string table.
+  int32_t total;  // Growth in instances, not scaled by the sample rate.
+  int32_t size;  // Growth in bytes, not scaled by the sample rate.
+};
+
+// The sums of the records of one class over a range of intervals.
+struct HistoryTrend {
+  HistoryTrend();
+  double total;  // Scaled by the sample rate.
+  double size;  // Scaled by the sample rate.
+  uint32_t intervals;  // Number of intervals in the range.
+  double first;  // Timestamp of the oldest interval in the range.
+  double last;  // Timestamp of the newest interval in the range.
+  // Returns a { total, size, intervals, first, last } object.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate) const;
+};
+
+// Maps a history file into memory and answers queries about it.  Opening
+// the file only indexes the blocks, the records are read when they're
+// queried.
+class HeapHistoryReader {
+ public:
+  HeapHistoryReader();
+  ~HeapHistoryReader();
+  // Returns zero on success, an errno code otherwise.  EINVAL means that
+  // the file isn't a history file.
+  int Open(const char* path);
+  void Close();
+  // Size of the file up to the end of the last complete block.
+  size_t valid_size() const;
+  size_t strings_count() const;
+  // Returns the string's UTF-16 code units, copied into |out|.
+  void GetString(size_t index, std::vector<uint16_t>* out) const;
+  size_t intervals_count() const;
+  // Copies the interval's header fields and records, oldest interval first.
+  void GetInterval(size_t index,
+                   double* timestamp,
+                   uint32_t* sample,
+                   std::vector<HistoryRecord>* records) const;
+  // Sums the records of the class |name| over the intervals that were
+  // recorded at or after |since|.
+  HistoryTrend Query(const uint16_t* name, size_t size, double since) const;
+ private:
+  bool Parse();
+  uint32_t ReadUint32(size_t offset) const;
+  double ReadDouble(size_t offset) const;
+  bool FindRecord(size_t interval, uint32_t name, HistoryRecord* record) const;
+  const char* data_;
+  size_t size_;
+  size_t valid_size_;
+  std::vector<size_t> strings_;  // Offsets of the string table entries.
+  std::vector<size_t> intervals_;  // Offsets of the interval payloads.
+  // Forbid copy and assigment.
+  HeapHistoryReader(const HeapHistoryReader&);
+  void operator=(const HeapHistoryReader&);
+};
+
+// Appends class histograms to a history file.  The writes are small, a few
+// kB per interval, and happen synchronously on the main thread.
+class HeapHistory {
+ public:
+  static const uint32_t kVersion = 1;
+  static const size_t kDefaultMaxSize = 16 * 1024 * 1024;
+  HeapHistory();
+  ~HeapHistory();
+  // Opens or creates the file at |path| and continues its string table.
+  // The file is compacted when it grows past |max_size| bytes, zero means
+  // no limit.  Returns zero on success, an errno code otherwise.  Call once.
+  int Open(const char* path, size_t max_size);
+  void Close();
+  // Appends one interval.  The |name| fields of |records| are indices into
+  // |names|, they're translated to indices into the file's string table.
+  // Returns zero on success, an errno code otherwise.  A failed append is
+  // rolled back, the file stays valid and the next append tries again.
+  // When compacting the file fails, the interval is still appended and the
+  // compaction's error is returned.
+  int Append(double timestamp,
+             uint32_t sample,
+             const StringTable& names,
+             std::vector<HistoryRecord>* records);
+ private:
+  struct Interval {
+    double timestamp;
+    uint32_t sample;
+    std::vector<HistoryRecord> records;
+  };
+  // Rewrites the file with the newest intervals that fit in half of
+  // |max_size_| and reopens it.
+  int Compact();
+  void PutHeader();
+  void PutUint32(uint32_t value);
+  void PutDouble(double value);
+  void PutBlockHeader(HistoryBlock tag, size_t length);
+  void PutInterval(double timestamp,
+                   uint32_t sample,
+                   const std::vector<HistoryRecord>& records);
+  int WriteOut();
+  std::vector<char> path_;
+  size_t max_size_;  // Zero if there is no limit.
+  int fd_;
+  size_t size_;  // Bytes in the file.
+  StringTable names_;
+  size_t strings_written_;  // Strings of |names_| that are in the file.
+  std::vector<char> buffer_;
+  // Forbid copy and assigment.
+  HeapHistory(const HeapHistory&);
+  void operator=(const HeapHistory&);
+};
+
+// Returns an Error object for the errno code from HeapHistory::Open() or
+// HeapHistoryReader::Open().
+v8::Local<v8::Value> HistoryErrorToValue(v8::Isolate* isolate, int err);
+
+}  // namespace heapdiff
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_HEAPHISTORY_H_
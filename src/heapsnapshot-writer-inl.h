@@ -0,0 +1,334 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_HEAPSNAPSHOT_WRITER_INL_H_
+#define AGENT_SRC_HEAPSNAPSHOT_WRITER_INL_H_
+
+#include "heapsnapshot-writer.h"
+#include "strong-agent.h"
+#include <errno.h>
+#include <string.h>
+
+namespace strongloop {
+namespace agent {
+namespace heapdiff {
+
+WriterOptions::WriterOptions()
+    : compress(true), level(Z_DEFAULT_COMPRESSION), buffer_size(64 * 1024) {
+}
+
+void ParseWriterOptions(v8::Isolate* isolate,
+                        v8::Handle<v8::Value> value,
+                        WriterOptions* options) {
+  if (value->IsObject() == false) {
+    return;
+  }
+  v8::Handle<v8::Object> object = value.As<v8::Object>();
+  v8::Local<v8::Value> compress = object->Get(FixedString(isolate, "compress"));
+  if (compress->IsUndefined() == false) {
+    options->compress = compress->BooleanValue();
+  }
+  v8::Local<v8::Value> level = object->Get(FixedString(isolate, "level"));
+  if (level->IsNumber()) {
+    const int32_t value = level->Int32Value();
+    if (value >= 0 && value <= 9) {
+      options->level = value;
+    }
+  }
+  v8::Local<v8::Value> buffer_size =
+      object->Get(FixedString(isolate, "bufferSize"));
+  if (buffer_size->IsNumber()) {
+    // Small buffers make the queue thrash, big ones waste memory.
+    const uint32_t value = buffer_size->Uint32Value();
+    if (value >= 4096 && value <= 16 * 1024 * 1024) {
+      options->buffer_size = value;
+    }
+  }
+}
+
+const size_t SnapshotWriter::kMaxQueued;
+
+SnapshotWriter::SnapshotWriter(const char* path,
+                               const WriterOptions& options,
+                               uv_async_t* progress)
+    : path_(path, path + ::strlen(path) + 1),
+      options_(options),
+      progress_(progress),
+      finished_(false),
+      error_(0),
+      bytes_in_(0),
+      bytes_out_(0),
+      buffers_(0),
+      current_(NULL),
+      opened_(false),
+      closed_(false),
+      file_(NULL) {
+  uv_mutex_init(&mutex_);
+  uv_mutex_init(&write_mutex_);
+  uv_cond_init(&cond_);
+  ::memset(&stream_, 0, sizeof(stream_));
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  while (queue_.empty() == false) {
+    delete queue_.front();
+    queue_.pop_front();
+  }
+  delete current_;
+  uv_cond_destroy(&cond_);
+  uv_mutex_destroy(&write_mutex_);
+  uv_mutex_destroy(&mutex_);
+}
+
+void SnapshotWriter::Run() {
+  do {
+    uv_mutex_lock(&mutex_);
+    while (queue_.empty() && finished_ == false && error_ == 0) {
+      uv_cond_wait(&cond_, &mutex_);
+    }
+    uv_mutex_unlock(&mutex_);
+  } while (Drain());
+}
+
+bool SnapshotWriter::Drain() {
+  uv_mutex_lock(&write_mutex_);
+  bool more = true;
+  while (closed_ == false) {
+    uv_mutex_lock(&mutex_);
+    Buffer* buffer = NULL;
+    if (queue_.empty() == false && error_ == 0) {
+      buffer = queue_.front();
+      queue_.pop_front();
+    }
+    const bool last = queue_.empty() && finished_;
+    int err = error_;
+    uv_mutex_unlock(&mutex_);
+    if (err == 0 && buffer == NULL && last == false) {
+      break;  // Caught up with the serializer.
+    }
+    if (err == 0 && opened_ == false) {
+      err = Open();
+    }
+    if (err == 0) {
+      err = Write(buffer, last);
+    }
+    uv_mutex_lock(&mutex_);
+    if (buffer != NULL && err == 0) {
+      bytes_in_ += buffer->size();
+      buffers_ += 1;
+    }
+    if (err != 0 && error_ == 0) {
+      error_ = err;
+    }
+    err = error_;
+    uv_mutex_unlock(&mutex_);
+    delete buffer;
+    if (progress_ != NULL) {
+      uv_async_send(progress_);
+    }
+    if (last || err != 0) {
+      Close(err != 0);
+    }
+  }
+  if (closed_) {
+    more = false;
+  }
+  uv_mutex_unlock(&write_mutex_);
+  return more;
+}
+
+int SnapshotWriter::Open() {
+  opened_ = true;
+  file_ = ::fopen(&path_[0], "wb");
+  if (file_ == NULL) {
+    return errno;
+  }
+  if (options_.compress) {
+    // 15 + 16 selects the maximum window size and a gzip header.
+    const int err = deflateInit2(&stream_, options_.level, Z_DEFLATED,
+                                 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+      return err;
+    }
+    output_.resize(options_.buffer_size);
+  }
+  return 0;
+}
+
+void SnapshotWriter::Close(bool failed) {
+  closed_ = true;
+  if (file_ == NULL) {
+    return;  // Never opened, or fopen() failed.  Nothing to clean up.
+  }
+  if (options_.compress && stream_.state != Z_NULL) {
+    deflateEnd(&stream_);
+  }
+  if (::fclose(file_) != 0 && failed == false) {
+    uv_mutex_lock(&mutex_);
+    error_ = errno;
+    uv_mutex_unlock(&mutex_);
+    failed = true;
+  }
+  file_ = NULL;
+  if (failed) {
+    ::remove(&path_[0]);  // Don't leave a truncated snapshot behind.
+  }
+}
+
+void SnapshotWriter::Finish() {
+  uv_mutex_lock(&mutex_);
+  if (finished_ == false) {
+    if (current_ != NULL) {
+      queue_.push_back(current_);
+      current_ = NULL;
+    }
+    finished_ = true;
+    uv_cond_signal(&cond_);
+  }
+  uv_mutex_unlock(&mutex_);
+}
+
+int SnapshotWriter::GetChunkSize() {
+  return static_cast<int>(options_.buffer_size);
+}
+
+void SnapshotWriter::EndOfStream() {
+  Finish();
+}
+
+v8::OutputStream::WriteResult SnapshotWriter::WriteAsciiChunk(char* data,
+                                                              int size) {
+  size_t left = size > 0 ? size : 0;
+  while (left > 0) {
+    if (current_ == NULL) {
+      current_ = new Buffer;
+      current_->reserve(options_.buffer_size);
+    }
+    const size_t room = options_.buffer_size - current_->size();
+    const size_t n = left < room ? left : room;
+    current_->insert(current_->end(), data, data + n);
+    data += n, left -= n;
+    if (current_->size() == options_.buffer_size) {
+      Enqueue();
+    }
+  }
+  return error() == 0 ? kContinue : kAbort;
+}
+
+int SnapshotWriter::error() {
+  uv_mutex_lock(&mutex_);
+  const int err = error_;
+  uv_mutex_unlock(&mutex_);
+  return err;
+}
+
+v8::Local<v8::Value> SnapshotWriter::ErrorToValue(v8::Isolate* isolate) {
+  const int err = error();
+  if (err == 0) {
+#if SL_NODE_VERSION == 12
+    return v8::Undefined(isolate);
+#elif SL_NODE_VERSION == 10
+    return v8::Local<v8::Value>::New(v8::Undefined());
+#endif
+  }
+  // zlib error codes are negative, errno codes are positive.
+  const char* message = err > 0 ? ::strerror(err) : zError(err);
+#if SL_NODE_VERSION == 12
+  return v8::Exception::Error(v8::String::NewFromUtf8(isolate, message));
+#elif SL_NODE_VERSION == 10
+  Use(isolate);
+  return v8::Exception::Error(v8::String::New(message));
+#endif
+}
+
+v8::Local<v8::Object> SnapshotWriter::ProgressToObject(v8::Isolate* isolate) {
+  uv_mutex_lock(&mutex_);
+  struct {
+    v8::Local<v8::String> name;
+    double value;
+  } fields[] = {
+    { FixedString(isolate, "bytesIn"), bytes_in_ },
+    { FixedString(isolate, "bytesOut"), bytes_out_ },
+    { FixedString(isolate, "buffers"), buffers_ },
+  };
+  uv_mutex_unlock(&mutex_);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name,
+                v8::Number::New(isolate, fields[index].value));
+  }
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  for (size_t index = 0; index < SL_ARRAY_SIZE(fields); index += 1) {
+    object->Set(fields[index].name, v8::Number::New(fields[index].value));
+  }
+#endif
+  return object;
+}
+
+void SnapshotWriter::Enqueue() {
+  uv_mutex_lock(&mutex_);
+  queue_.push_back(current_);
+  current_ = NULL;
+  const bool full = queue_.size() >= kMaxQueued;
+  uv_cond_signal(&cond_);
+  uv_mutex_unlock(&mutex_);
+  if (full) {
+    Drain();  // The thread pool is behind, write on this thread.
+  }
+}
+
+int SnapshotWriter::Write(const Buffer* buffer, bool last) {
+  const char* data = NULL;
+  size_t size = 0;
+  if (buffer != NULL && buffer->empty() == false) {
+    data = &(*buffer)[0];
+    size = buffer->size();
+  }
+  if (options_.compress == false) {
+    return WriteOut(data, size);
+  }
+  stream_.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(data));
+  stream_.avail_in = static_cast<unsigned>(size);
+  const int flush = last ? Z_FINISH : Z_NO_FLUSH;
+  for (;;) {
+    stream_.next_out = reinterpret_cast<unsigned char*>(&output_[0]);
+    stream_.avail_out = static_cast<unsigned>(output_.size());
+    const int rc = deflate(&stream_, flush);
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+      return rc;
+    }
+    const int err = WriteOut(&output_[0], output_.size() - stream_.avail_out);
+    if (err != 0) {
+      return err;
+    }
+    if (rc == Z_STREAM_END) {
+      return 0;
+    }
+    if (stream_.avail_out != 0 && (last == false || rc == Z_BUF_ERROR)) {
+      return 0;  // Consumed all input.
+    }
+  }
+}
+
+int SnapshotWriter::WriteOut(const char* data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (::fwrite(data, 1, size, file_) != size) {
+    return errno;
+  }
+  uv_mutex_lock(&mutex_);
+  bytes_out_ += size;
+  uv_mutex_unlock(&mutex_);
+  return 0;
+}
+
+}  // namespace heapdiff
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_HEAPSNAPSHOT_WRITER_INL_H_
@@ -0,0 +1,111 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_HEAPSNAPSHOT_WRITER_H_
+#define AGENT_SRC_HEAPSNAPSHOT_WRITER_H_
+
+#include "strong-agent.h"
+#include "v8-profiler.h"
+#include "v8.h"
+#include "zlib.h"
+#include <stdio.h>
+
+#include <deque>
+#include <vector>
+
+namespace strongloop {
+namespace agent {
+namespace heapdiff {
+
+struct WriterOptions {
+  WriterOptions();
+  bool compress;  // Write gzipped JSON, defaults to true.
+  int level;  // The zlib compression level.
+  uint32_t buffer_size;  // Size of the queued buffers.
+};
+
+void ParseWriterOptions(v8::Isolate* isolate,
+                        v8::Handle<v8::Value> value,
+                        WriterOptions* options);
+
+// Streams a serialized heap snapshot to disk.  V8 serializes the snapshot
+// on the main thread and hands it over in chunks through WriteAsciiChunk().
+// The chunks are copied into buffers and queued, Run() drains the queue on
+// a thread pool thread, optionally gzips the data and writes it out.
+//
+// At most |kMaxQueued| buffers are queued.  When the thread pool can't keep
+// up, or hasn't even started the job yet because all its threads are busy,
+// WriteAsciiChunk() drains the queue itself, on the main thread.  Memory
+// use stays bounded no matter how big the snapshot is, and the main thread
+// never waits for more than the buffer that the thread pool is writing.
+// Whichever thread writes holds |write_mutex_| while it takes buffers off
+// the queue and writes them, so they're written in order.
+//
+// The file is removed again when writing fails, no partial snapshots are
+// left behind.
+class SnapshotWriter : public v8::OutputStream {
+ public:
+  static const size_t kMaxQueued = 4;
+  // |progress| is signalled every time a buffer has been written, can be
+  // NULL.
+  SnapshotWriter(const char* path,
+                 const WriterOptions& options,
+                 uv_async_t* progress);
+  ~SnapshotWriter();
+  // Call from the thread pool.  Returns when the last buffer is written.
+  void Run();
+  // Marks the end of the stream.  Safe to call more than once, V8 doesn't
+  // call EndOfStream() when the serialization is aborted.
+  void Finish();
+  virtual int GetChunkSize();
+  virtual void EndOfStream();
+  virtual WriteResult WriteAsciiChunk(char* data, int size);
+  // Zero on success, an errno or zlib error code otherwise.  Thread-safe.
+  int error();
+  // Returns an Error object, or undefined when there was no error.
+  v8::Local<v8::Value> ErrorToValue(v8::Isolate* isolate);
+  // Returns the uncompressed and written byte counts and the number of
+  // buffers written so far as a { bytesIn, bytesOut, buffers } object.
+  v8::Local<v8::Object> ProgressToObject(v8::Isolate* isolate);
+ private:
+  typedef std::vector<char> Buffer;
+  void Enqueue();
+  // Writes the queued buffers, and finishes the file when the stream has
+  // ended.  Returns false when there's nothing left to do.  Takes
+  // |write_mutex_|.
+  bool Drain();
+  int Open();
+  void Close(bool failed);
+  int Write(const Buffer* buffer, bool last);
+  int WriteOut(const char* data, size_t size);
+  const std::vector<char> path_;
+  const WriterOptions options_;
+  uv_async_t* const progress_;
+  uv_mutex_t mutex_;
+  uv_cond_t cond_;
+  std::deque<Buffer*> queue_;  // Guarded by |mutex_|.
+  bool finished_;  // Guarded by |mutex_|.
+  int error_;  // Guarded by |mutex_|.
+  double bytes_in_;  // Guarded by |mutex_|.
+  double bytes_out_;  // Guarded by |mutex_|.
+  double buffers_;  // Guarded by |mutex_|.
+  Buffer* current_;  // Only used on the main thread.
+  // Guarded by |write_mutex_|.
+  uv_mutex_t write_mutex_;
+  bool opened_;
+  bool closed_;
+  FILE* file_;
+  z_stream stream_;
+  std::vector<char> output_;
+  // Forbid copy and assigment.
+  SnapshotWriter(const SnapshotWriter&);
+  void operator=(const SnapshotWriter&);
+};
+
+}  // namespace heapdiff
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_HEAPSNAPSHOT_WRITER_H_
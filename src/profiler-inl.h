@@ -0,0 +1,1302 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_PROFILER_INL_H_
+#define AGENT_SRC_PROFILER_INL_H_
+
+#include "profiler.h"
+#include "util-inl.h"
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace strongloop {
+namespace agent {
+namespace profiler {
+
+Options::Options()
+    : sampling_interval(0),
+      samples(false),
+      format(kTreeFormat),
+      top(20),
+      callers(0),
+      collapse(kCollapseNone),
+      slice_time(5) {
+}
+
+void ParseOptions(v8::Isolate* isolate,
+                  v8::Handle<v8::Value> value,
+                  Options* options) {
+  if (value->IsObject() == false) {
+    return;
+  }
+  v8::Handle<v8::Object> object = value.As<v8::Object>();
+  v8::Local<v8::Value> title = object->Get(FixedString(isolate, "title"));
+  if (title->IsString()) {
+    options->title = title.As<v8::String>();
+  }
+  options->sampling_interval =
+      object->Get(FixedString(isolate, "samplingInterval"))->Uint32Value();
+  options->samples =
+      object->Get(FixedString(isolate, "samples"))->BooleanValue();
+  v8::Local<v8::Value> format = object->Get(FixedString(isolate, "format"));
+  if (format->IsString() &&
+      format->StrictEquals(FixedString(isolate, "flat"))) {
+    options->format = kFlatFormat;
+  }
+  if (format->IsString() &&
+      format->StrictEquals(FixedString(isolate, "top"))) {
+    options->format = kTopFormat;
+  }
+  if (format->IsString() &&
+      format->StrictEquals(FixedString(isolate, "folded"))) {
+    options->format = kFoldedFormat;
+  }
+  if (format->IsString() &&
+      format->StrictEquals(FixedString(isolate, "baseline"))) {
+    options->format = kBaselineFormat;
+  }
+  if (format->IsString() &&
+      format->StrictEquals(FixedString(isolate, "diff"))) {
+    options->format = kDiffFormat;
+  }
+  v8::Local<v8::Value> collapse =
+      object->Get(FixedString(isolate, "collapse"));
+  if (collapse->IsString() &&
+      collapse->StrictEquals(FixedString(isolate, "script"))) {
+    options->collapse = kCollapseScript;
+  }
+  if (collapse->IsString() &&
+      collapse->StrictEquals(FixedString(isolate, "package"))) {
+    options->collapse = kCollapsePackage;
+  }
+  v8::Local<v8::Value> top = object->Get(FixedString(isolate, "top"));
+  if (top->IsNumber()) {
+    options->top = std::min(top->Uint32Value(), 1000u);
+  }
+  options->callers =
+      std::min(object->Get(FixedString(isolate, "callers"))->Uint32Value(),
+               16u);
+  v8::Local<v8::Value> slice_time =
+      object->Get(FixedString(isolate, "sliceTime"));
+  if (slice_time->IsNumber()) {
+    options->slice_time = std::max(slice_time->Uint32Value(), 1u);
+  }
+}
+
+FlatProfile::FlatProfile() {
+  bailouts_.InternAscii("");  // Index 0 means no bailout.
+}
+
+void FlatProfile::Build(v8::Isolate* isolate,
+                        const v8::CpuProfileNode* root) {
+  // Iterative, deep recursion in JS code makes for deep call trees.
+  std::vector<std::pair<const v8::CpuProfileNode*, int32_t> > stack;
+  stack.push_back(std::make_pair(root, -1));
+  while (stack.empty() == false) {
+    const v8::CpuProfileNode* node = stack.back().first;
+    const int32_t parent = stack.back().second;
+    stack.pop_back();
+    // The name getters create new handles, release them as we go.
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+#elif SL_NODE_VERSION == 10
+    Use(isolate);
+    v8::HandleScope handle_scope;
+#endif
+    const int32_t index = static_cast<int32_t>(size());
+    nodes_.push_back(node);
+    columns_[kParent].push_back(parent);
+    columns_[kFunction].push_back(functions_.Intern(node->GetFunctionName()));
+    columns_[kScript].push_back(
+        scripts_.Intern(node->GetScriptResourceName()));
+    columns_[kLine].push_back(node->GetLineNumber());
+#if SL_NODE_VERSION == 12
+    columns_[kColumn].push_back(node->GetColumnNumber());
+    columns_[kHits].push_back(node->GetHitCount());
+    const char* const bailout_reason = node->GetBailoutReason();
+    if (bailout_reason != NULL &&
+        ::strcmp(bailout_reason, "no reason") != 0) {
+      columns_[kBailout].push_back(bailouts_.InternAscii(bailout_reason));
+    } else {
+      columns_[kBailout].push_back(0);
+    }
+#elif SL_NODE_VERSION == 10
+    columns_[kColumn].push_back(0);
+    columns_[kHits].push_back(
+        static_cast<int32_t>(node->GetSelfSamplesCount()));
+    columns_[kBailout].push_back(0);
+#endif
+    // Push the children in reverse so they're numbered in order.
+    for (int child = node->GetChildrenCount(); child > 0; child -= 1) {
+      stack.push_back(std::make_pair(node->GetChild(child - 1), index));
+    }
+  }
+}
+
+size_t FlatProfile::size() const {
+  return columns_[kParent].size();
+}
+
+int32_t FlatProfile::Get(Column column, size_t index) const {
+  return columns_[column][index];
+}
+
+const v8::CpuProfileNode* FlatProfile::node(size_t index) const {
+  return nodes_[index];
+}
+
+const StringTable& FlatProfile::functions() const {
+  return functions_;
+}
+
+const StringTable& FlatProfile::scripts() const {
+  return scripts_;
+}
+
+v8::Local<v8::Object> FlatProfile::ToObject(v8::Isolate* isolate) const {
+  static const char* const names[] = {
+    "parent", "function", "script", "line", "column", "hits", "bailout",
+  };
+  const size_t length = size();
+  std::vector<int32_t> data;
+  data.reserve(kColumnCount * length);
+  for (size_t column = 0; column < kColumnCount; column += 1) {
+    data.insert(data.end(), columns_[column].begin(), columns_[column].end());
+  }
+  v8::Local<v8::Object> arrays[kColumnCount];
+  NewInt32Columns(isolate,
+                  data.empty() ? NULL : &data[0],
+                  length,
+                  kColumnCount,
+                  arrays);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+  for (size_t column = 0; column < kColumnCount; column += 1) {
+    result->Set(v8::String::NewFromUtf8(isolate, names[column]),
+                arrays[column]);
+  }
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+  for (size_t column = 0; column < kColumnCount; column += 1) {
+    result->Set(v8::String::New(names[column]), arrays[column]);
+  }
+#endif
+  result->Set(FixedString(isolate, "functions"), functions_.ToArray(isolate));
+  result->Set(FixedString(isolate, "scripts"), scripts_.ToArray(isolate));
+  result->Set(FixedString(isolate, "bailouts"), bailouts_.ToArray(isolate));
+  return result;
+}
+
+SampleTimeline::SampleTimeline() : start_time_(0) {
+}
+
+void SampleTimeline::Build(const v8::CpuProfile* profile,
+                           const FlatProfile& flat) {
+#if SL_NODE_VERSION == 12
+  // Profile timestamps come from a monotonic clock with an unspecified
+  // origin.  The profile was stopped a moment ago, anchor its end time to
+  // the wall clock.
+  const int64_t start = profile->GetStartTime();
+  const int64_t end = profile->GetEndTime();
+  start_time_ = WallClockTime() - 1e-3 * (end - start);
+  const int count = profile->GetSamplesCount();
+  if (count <= 0) {
+    return;
+  }
+  // Map the sampled nodes back to their rows.
+  std::vector<std::pair<const v8::CpuProfileNode*, int32_t> > rows;
+  rows.reserve(flat.size());
+  for (size_t index = 0; index < flat.size(); index += 1) {
+    rows.push_back(std::make_pair(flat.node(index),
+                                  static_cast<int32_t>(index)));
+  }
+  std::sort(rows.begin(), rows.end());
+  nodes_.reserve(count);
+  deltas_.reserve(count);
+  int64_t previous = start;
+  for (int index = 0; index < count; index += 1) {
+    const std::pair<const v8::CpuProfileNode*, int32_t> key(
+        profile->GetSample(index), -1);
+    std::vector<std::pair<const v8::CpuProfileNode*, int32_t> >::iterator it =
+        std::lower_bound(rows.begin(), rows.end(), key);
+    if (it == rows.end() || it->first != key.first) {
+      continue;  // Shouldn't happen, every sample is a node in the tree.
+    }
+    const int64_t timestamp = profile->GetSampleTimestamp(index);
+    nodes_.push_back(it->second);
+    deltas_.push_back(static_cast<int32_t>(timestamp - previous));
+    previous = timestamp;
+  }
+#elif SL_NODE_VERSION == 10
+  Use(profile);
+  Use(flat);
+  start_time_ = WallClockTime();
+#endif
+}
+
+v8::Local<v8::Object> SampleTimeline::ToObject(v8::Isolate* isolate) const {
+  const size_t length = nodes_.size();
+  std::vector<int32_t> data;
+  data.reserve(2 * length);
+  data.insert(data.end(), nodes_.begin(), nodes_.end());
+  data.insert(data.end(), deltas_.begin(), deltas_.end());
+  v8::Local<v8::Object> arrays[2];
+  NewInt32Columns(isolate,
+                  data.empty() ? NULL : &data[0],
+                  length,
+                  SL_ARRAY_SIZE(arrays),
+                  arrays);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+  result->Set(FixedString(isolate, "startTime"),
+              v8::Number::New(isolate, start_time_));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+  result->Set(FixedString(isolate, "startTime"),
+              v8::Number::New(start_time_));
+#endif
+  result->Set(FixedString(isolate, "nodes"), arrays[0]);
+  result->Set(FixedString(isolate, "timeDeltas"), arrays[1]);
+  return result;
+}
+
+void AppendString(v8::Handle<v8::String> string, std::vector<uint16_t>* out) {
+  const int length = string->Length();
+  if (length == 0) {
+    return;
+  }
+  const size_t offset = out->size();
+  out->resize(offset + length);
+  string->Write(&(*out)[offset], 0, length, v8::String::NO_NULL_TERMINATION);
+}
+
+void AppendAscii(const char* data, std::vector<uint16_t>* out) {
+  out->insert(out->end(), data, data + ::strlen(data));
+}
+
+void AppendNumber(uint32_t value, std::vector<uint16_t>* out) {
+  char digits[16];
+  size_t count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (count > 0) {
+    out->push_back(digits[--count]);
+  }
+}
+
+// Replaces the script path in |out|, starting at |offset|, with the name of
+// the npm package it belongs to.  Scoped packages keep their scope.
+void PathToPackage(size_t offset, std::vector<uint16_t>* out) {
+  static const char node_modules[] = "node_modules/";
+  const size_t length = SL_ARRAY_SIZE(node_modules) - 1;
+  size_t begin = out->size();
+  for (size_t index = offset; index + length <= out->size(); index += 1) {
+    if (std::equal(node_modules, node_modules + length,
+                   out->begin() + index)) {
+      begin = index + length;
+    }
+  }
+  if (begin == out->size()) {
+    const bool path =
+        std::find(out->begin() + offset, out->end(), '/') != out->end();
+    out->resize(offset);
+    AppendAscii(path ? "(app)" : "(node)", out);
+    return;
+  }
+  size_t end = std::find(out->begin() + begin, out->end(), '/') - out->begin();
+  if (end < out->size() && (*out)[begin] == '@') {
+    end = std::find(out->begin() + end + 1, out->end(), '/') - out->begin();
+  }
+  out->erase(out->begin() + end, out->end());
+  out->erase(out->begin() + offset, out->begin() + begin);
+}
+
+FoldedStacks::FoldedStacks(Collapse collapse) : collapse_(collapse) {
+}
+
+void FoldedStacks::Build(v8::Isolate* isolate,
+                         const v8::CpuProfileNode* root) {
+  // Iterative, like FlatProfile::Build().  Each node is pushed with the
+  // length of its caller's path.  The root isn't a frame.
+  std::vector<std::pair<const v8::CpuProfileNode*, size_t> > stack;
+  for (int child = root->GetChildrenCount(); child > 0; child -= 1) {
+    stack.push_back(std::make_pair(root->GetChild(child - 1), 0));
+  }
+  std::vector<uint32_t> path;
+  std::vector<uint16_t> key;
+  while (stack.empty() == false) {
+    const v8::CpuProfileNode* node = stack.back().first;
+    path.resize(stack.back().second);
+    stack.pop_back();
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate);
+    const uint32_t hits = node->GetHitCount();
+#elif SL_NODE_VERSION == 10
+    Use(isolate);
+    v8::HandleScope handle_scope;
+    const uint32_t hits = static_cast<uint32_t>(node->GetSelfSamplesCount());
+#endif
+    const uint32_t frame = Frame(node);
+    if (collapse_ == kCollapseNone || path.empty() || path.back() != frame) {
+      path.push_back(frame);
+    }
+    if (hits > 0) {
+      key.clear();
+      for (size_t index = 0; index < path.size(); index += 1) {
+        key.push_back(static_cast<uint16_t>(path[index] >> 16));
+        key.push_back(static_cast<uint16_t>(path[index]));
+      }
+      const uint32_t index = stacks_.Intern(&key[0], key.size());
+      if (index == hits_.size()) {
+        hits_.push_back(0);
+      }
+      hits_[index] += hits;
+    }
+    for (int child = node->GetChildrenCount(); child > 0; child -= 1) {
+      stack.push_back(std::make_pair(node->GetChild(child - 1), path.size()));
+    }
+  }
+}
+
+uint32_t FoldedStacks::Frame(const v8::CpuProfileNode* node) {
+  scratch_.clear();
+  v8::Handle<v8::String> script_name = node->GetScriptResourceName();
+  if (collapse_ == kCollapseNone || script_name->Length() == 0) {
+    AppendString(node->GetFunctionName(), &scratch_);
+    if (scratch_.empty()) {
+      AppendAscii("(anonymous function)", &scratch_);
+    }
+    if (collapse_ == kCollapseNone && script_name->Length() > 0) {
+      AppendAscii(" (", &scratch_);
+      AppendString(script_name, &scratch_);
+      scratch_.push_back(':');
+      AppendNumber(node->GetLineNumber(), &scratch_);
+      scratch_.push_back(')');
+    }
+  } else {
+    AppendString(script_name, &scratch_);
+    if (collapse_ == kCollapsePackage) {
+      PathToPackage(0, &scratch_);
+    }
+  }
+  // Semicolons separate frames.
+  std::replace(scratch_.begin(), scratch_.end(), uint16_t(';'), uint16_t(','));
+  return frames_.Intern(&scratch_[0], scratch_.size());
+}
+
+v8::Local<v8::String> FoldedStacks::ToString(v8::Isolate* isolate) const {
+  std::vector<uint16_t> text;
+  for (uint32_t stack = 0; stack < hits_.size(); stack += 1) {
+    const uint16_t* key = stacks_.data(stack);
+    const size_t size = stacks_.size(stack);
+    for (size_t index = 0; index < size; index += 2) {
+      const uint32_t frame =
+          static_cast<uint32_t>(key[index]) << 16 | key[index + 1];
+      if (index > 0) {
+        text.push_back(';');
+      }
+      const uint16_t* label = frames_.data(frame);
+      text.insert(text.end(), label, label + frames_.size(frame));
+    }
+    text.push_back(' ');
+    AppendNumber(hits_[stack], &text);
+    text.push_back('\n');
+  }
+#if SL_NODE_VERSION == 12
+  if (text.empty()) {
+    return v8::String::Empty(isolate);
+  }
+  return v8::String::NewFromTwoByte(isolate,
+                                    &text[0],
+                                    v8::String::kNormalString,
+                                    text.size());
+#elif SL_NODE_VERSION == 10
+  Use(isolate);
+  if (text.empty()) {
+    return v8::String::Empty();
+  }
+  return v8::String::New(&text[0], text.size());
+#endif
+}
+
+// Orders nodes by function, script and line, then by node index.
+class CompareLocation {
+ public:
+  explicit CompareLocation(const FlatProfile* flat) : flat_(flat) {
+  }
+  bool operator()(uint32_t a, uint32_t b) const {
+    const int order = Compare(a, b);
+    return order < 0 || (order == 0 && a < b);
+  }
+  bool Equal(uint32_t a, uint32_t b) const {
+    return Compare(a, b) == 0;
+  }
+ private:
+  int Compare(uint32_t a, uint32_t b) const {
+    static const FlatProfile::Column columns[] = {
+      FlatProfile::kFunction, FlatProfile::kScript, FlatProfile::kLine,
+    };
+    for (size_t index = 0; index < SL_ARRAY_SIZE(columns); index += 1) {
+      const int32_t x = flat_->Get(columns[index], a);
+      const int32_t y = flat_->Get(columns[index], b);
+      if (x != y) {
+        return x < y ? -1 : 1;
+      }
+    }
+    return 0;
+  }
+  const FlatProfile* flat_;
+};
+
+bool CompareCall(const std::pair<uint64_t, uint32_t>& a,
+                 const std::pair<uint64_t, uint32_t>& b) {
+  return a.first < b.first;
+}
+
+BottomUpProfile::BottomUpProfile() : samples_(0) {
+}
+
+void BottomUpProfile::Build(const FlatProfile& flat, bool callers) {
+  const uint32_t count = static_cast<uint32_t>(flat.size());
+  if (count == 0) {
+    return;
+  }
+
+  // Sort the nodes by location, then number the distinct locations.
+  std::vector<uint32_t> order(count);
+  for (uint32_t node = 0; node < count; node += 1) {
+    order[node] = node;
+  }
+  CompareLocation compare(&flat);
+  std::sort(order.begin(), order.end(), compare);
+  keys_.resize(count);
+  for (uint32_t index = 0; index < count; index += 1) {
+    const uint32_t node = order[index];
+    if (index == 0 || compare.Equal(order[index - 1], node) == false) {
+      Entry entry = { node, 0, 0 };
+      entries_.push_back(entry);
+    }
+    keys_[node] = static_cast<uint32_t>(entries_.size() - 1);
+  }
+
+  // Hits per subtree.  Children come after their parents, sum them up in
+  // reverse order.
+  std::vector<uint32_t> subtree(count);
+  for (uint32_t node = 0; node < count; node += 1) {
+    subtree[node] = flat.Get(FlatProfile::kHits, node);
+    entries_[keys_[node]].self += subtree[node];
+    samples_ += subtree[node];
+  }
+  for (uint32_t node = count - 1; node > 0; node -= 1) {
+    subtree[flat.Get(FlatProfile::kParent, node)] += subtree[node];
+  }
+
+  // A function's total is the sum of the subtrees of its outermost frames.
+  // Walk the nodes in depth-first order and keep track of the functions on
+  // the path from the root; frames of functions that are already on the
+  // path are recursive calls, their hits have been counted.
+  std::vector<uint32_t> path;
+  std::vector<uint32_t> active(entries_.size());
+  std::vector<std::pair<uint64_t, uint32_t> > calls;
+  for (uint32_t node = 0; node < count; node += 1) {
+    const int32_t parent = flat.Get(FlatProfile::kParent, node);
+    while (path.empty() == false &&
+           static_cast<int32_t>(path.back()) != parent) {
+      active[keys_[path.back()]] -= 1;
+      path.pop_back();
+    }
+    const uint32_t key = keys_[node];
+    if (active[key] == 0) {
+      entries_[key].total += subtree[node];
+      if (callers && parent >= 0 && subtree[node] > 0) {
+        const uint64_t call =
+            static_cast<uint64_t>(key) << 32 | keys_[parent];
+        calls.push_back(std::make_pair(call, subtree[node]));
+      }
+    }
+    active[key] += 1;
+    path.push_back(node);
+  }
+
+  // Merge the calls per callee and caller pair, then order the callers of
+  // each callee by hits.
+  std::sort(calls.begin(), calls.end(), CompareCall);
+  for (size_t index = 0; index < calls.size(); index += 1) {
+    const uint32_t callee = static_cast<uint32_t>(calls[index].first >> 32);
+    const uint32_t caller = static_cast<uint32_t>(calls[index].first);
+    if (calls_.empty() == false &&
+        calls_.back().callee == callee && calls_.back().caller == caller) {
+      calls_.back().hits += calls[index].second;
+    } else {
+      Call call = { callee, caller, calls[index].second };
+      calls_.push_back(call);
+    }
+  }
+  first_call_.assign(entries_.size() + 1, 0);
+  for (size_t index = 0; index < calls_.size(); index += 1) {
+    first_call_[calls_[index].callee + 1] += 1;
+  }
+  for (size_t entry = 0; entry < entries_.size(); entry += 1) {
+    first_call_[entry + 1] += first_call_[entry];
+    std::vector<Call>::iterator begin = calls_.begin() + first_call_[entry];
+    std::vector<Call>::iterator end = calls_.begin() + first_call_[entry + 1];
+    for (std::vector<Call>::iterator it = begin; it != end; ++it) {
+      // Insertion sort, most functions have a handful of callers.
+      for (std::vector<Call>::iterator k = it;
+           k != begin && (k - 1)->hits < k->hits; --k) {
+        std::iter_swap(k - 1, k);
+      }
+    }
+  }
+}
+
+v8::Local<v8::Object> BottomUpProfile::ToObject(v8::Isolate* isolate,
+                                                const FlatProfile& flat,
+                                                const Options& options) const {
+  std::vector<v8::Local<v8::Object> > objects(entries_.size());
+  v8::Local<v8::String> names[] = {
+    FixedString(isolate, "self"),
+    FixedString(isolate, "total"),
+  };
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+  result->Set(FixedString(isolate, "samples"),
+              v8::Integer::NewFromUnsigned(isolate, samples_));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+  result->Set(FixedString(isolate, "samples"),
+              v8::Integer::NewFromUnsigned(samples_));
+#endif
+  for (size_t list = 0; list < SL_ARRAY_SIZE(names); list += 1) {
+    std::vector<uint32_t> top;
+    TopEntries(options.top, list == 0, &top);
+#if SL_NODE_VERSION == 12
+    v8::Local<v8::Array> array = v8::Array::New(isolate, top.size());
+#elif SL_NODE_VERSION == 10
+    v8::Local<v8::Array> array = v8::Array::New(top.size());
+#endif
+    for (size_t index = 0; index < top.size(); index += 1) {
+      const uint32_t entry = top[index];
+      if (objects[entry].IsEmpty()) {
+        objects[entry] = EntryToObject(isolate, flat, entry, options.callers);
+      }
+      array->Set(index, objects[entry]);
+    }
+    result->Set(names[list], array);
+  }
+  return result;
+}
+
+bool CompareHits(const std::pair<uint32_t, uint32_t>& a,
+                 const std::pair<uint32_t, uint32_t>& b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+void BottomUpProfile::TopEntries(size_t limit,
+                                 bool self,
+                                 std::vector<uint32_t>* out) const {
+  // Entry 0 is the root node, which isn't a function.
+  std::vector<std::pair<uint32_t, uint32_t> > hits;
+  for (uint32_t entry = 0; entry < entries_.size(); entry += 1) {
+    const uint32_t value = self ? entries_[entry].self : entries_[entry].total;
+    if (value > 0 && entries_[entry].node != 0) {
+      hits.push_back(std::make_pair(value, entry));
+    }
+  }
+  limit = std::min(limit, hits.size());
+  std::partial_sort(hits.begin(), hits.begin() + limit, hits.end(),
+                    CompareHits);
+  for (size_t index = 0; index < limit; index += 1) {
+    out->push_back(hits[index].second);
+  }
+}
+
+void BottomUpProfile::CopyTop(const FlatProfile& flat,
+                              size_t limit,
+                              ProfileWindow* window) const {
+  std::vector<uint32_t> top;
+  TopEntries(limit, true, &top);
+  TopEntries(limit, false, &top);
+  // Functions that rank in both lists are copied once.
+  std::vector<bool> copied(entries_.size());
+  for (size_t index = 0; index < top.size(); index += 1) {
+    const uint32_t entry = top[index];
+    if (copied[entry]) {
+      continue;
+    }
+    copied[entry] = true;
+    const uint32_t node = entries_[entry].node;
+    window->Add(flat.functions(),
+                flat.Get(FlatProfile::kFunction, node),
+                flat.scripts(),
+                flat.Get(FlatProfile::kScript, node),
+                flat.Get(FlatProfile::kLine, node),
+                entries_[entry].self,
+                entries_[entry].total);
+  }
+}
+
+uint32_t BottomUpProfile::samples() const {
+  return samples_;
+}
+
+v8::Local<v8::Object> BottomUpProfile::EntryToObject(v8::Isolate* isolate,
+                                                     const FlatProfile& flat,
+                                                     uint32_t entry,
+                                                     size_t callers) const {
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  object->Set(FixedString(isolate, "selfHits"),
+              v8::Integer::NewFromUnsigned(isolate, entries_[entry].self));
+  object->Set(FixedString(isolate, "totalHits"),
+              v8::Integer::NewFromUnsigned(isolate, entries_[entry].total));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  object->Set(FixedString(isolate, "selfHits"),
+              v8::Integer::NewFromUnsigned(entries_[entry].self));
+  object->Set(FixedString(isolate, "totalHits"),
+              v8::Integer::NewFromUnsigned(entries_[entry].total));
+#endif
+  SetLocation(isolate, flat, entries_[entry].node, object);
+  if (first_call_.empty()) {
+    return object;  // Callers weren't collected.
+  }
+  const size_t begin = first_call_[entry];
+  const size_t end = std::min<size_t>(first_call_[entry + 1], begin + callers);
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> array = v8::Array::New(isolate, end - begin);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> array = v8::Array::New(end - begin);
+#endif
+  for (size_t index = begin; index < end; index += 1) {
+    const Call& call = calls_[index];
+#if SL_NODE_VERSION == 12
+    v8::Local<v8::Object> caller = v8::Object::New(isolate);
+    caller->Set(FixedString(isolate, "hits"),
+                v8::Integer::NewFromUnsigned(isolate, call.hits));
+#elif SL_NODE_VERSION == 10
+    v8::Local<v8::Object> caller = v8::Object::New();
+    caller->Set(FixedString(isolate, "hits"),
+                v8::Integer::NewFromUnsigned(call.hits));
+#endif
+    SetLocation(isolate, flat, entries_[call.caller].node, caller);
+    array->Set(index - begin, caller);
+  }
+  object->Set(FixedString(isolate, "callers"), array);
+  return object;
+}
+
+void BottomUpProfile::SetLocation(v8::Isolate* isolate,
+                                  const FlatProfile& flat,
+                                  uint32_t node,
+                                  v8::Local<v8::Object> object) const {
+  const uint32_t function = flat.Get(FlatProfile::kFunction, node);
+  const uint32_t script = flat.Get(FlatProfile::kScript, node);
+  const int32_t line = flat.Get(FlatProfile::kLine, node);
+  object->Set(FixedString(isolate, "functionName"),
+              flat.functions().Get(isolate, function));
+  object->Set(FixedString(isolate, "scriptName"),
+              flat.scripts().Get(isolate, script));
+#if SL_NODE_VERSION == 12
+  object->Set(FixedString(isolate, "lineNumber"),
+              v8::Integer::New(isolate, line));
+#elif SL_NODE_VERSION == 10
+  object->Set(FixedString(isolate, "lineNumber"), v8::Integer::New(line));
+#endif
+}
+
+ProfileWindow::ProfileWindow(double start, double end, uint32_t samples)
+    : start_(start), end_(end), samples_(samples) {
+}
+
+void ProfileWindow::Add(const StringTable& functions,
+                        uint32_t function,
+                        const StringTable& scripts,
+                        uint32_t script,
+                        int32_t line,
+                        uint32_t self,
+                        uint32_t total) {
+  Entry entry;
+  entry.function =
+      names_.Intern(functions.data(function), functions.size(function));
+  entry.script = names_.Intern(scripts.data(script), scripts.size(script));
+  entry.line = line;
+  entry.self = self;
+  entry.total = total;
+  entries_.push_back(entry);
+}
+
+size_t ProfileWindow::bytes() const {
+  return sizeof(*this) + names_.bytes() + entries_.capacity() * sizeof(Entry);
+}
+
+uint32_t ProfileWindow::samples() const {
+  return samples_;
+}
+
+void ProfileWindow::AddTo(ProfileDiff* diff, size_t side) const {
+  for (size_t index = 0; index < entries_.size(); index += 1) {
+    const Entry& entry = entries_[index];
+    diff->Add(side,
+              names_,
+              entry.function,
+              entry.script,
+              entry.line,
+              entry.self,
+              entry.total);
+  }
+}
+
+v8::Local<v8::Object> ProfileWindow::ToObject(v8::Isolate* isolate) const {
+  std::vector<v8::Local<v8::String> > names(names_.size());
+  for (uint32_t index = 0; index < names.size(); index += 1) {
+    names[index] = names_.Get(isolate, index);
+  }
+  v8::Local<v8::String> function_name = FixedString(isolate, "functionName");
+  v8::Local<v8::String> script_name = FixedString(isolate, "scriptName");
+  v8::Local<v8::String> line_number = FixedString(isolate, "lineNumber");
+  v8::Local<v8::String> self_hits = FixedString(isolate, "selfHits");
+  v8::Local<v8::String> total_hits = FixedString(isolate, "totalHits");
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+  result->Set(FixedString(isolate, "start"), v8::Number::New(isolate, start_));
+  result->Set(FixedString(isolate, "end"), v8::Number::New(isolate, end_));
+  result->Set(FixedString(isolate, "samples"),
+              v8::Integer::NewFromUnsigned(isolate, samples_));
+  v8::Local<v8::Array> functions = v8::Array::New(isolate, entries_.size());
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+  result->Set(FixedString(isolate, "start"), v8::Number::New(start_));
+  result->Set(FixedString(isolate, "end"), v8::Number::New(end_));
+  result->Set(FixedString(isolate, "samples"),
+              v8::Integer::NewFromUnsigned(samples_));
+  v8::Local<v8::Array> functions = v8::Array::New(entries_.size());
+#endif
+  for (size_t index = 0; index < entries_.size(); index += 1) {
+    const Entry& entry = entries_[index];
+#if SL_NODE_VERSION == 12
+    v8::Local<v8::Object> object = v8::Object::New(isolate);
+    object->Set(line_number, v8::Integer::New(isolate, entry.line));
+    object->Set(self_hits, v8::Integer::NewFromUnsigned(isolate, entry.self));
+    object->Set(total_hits,
+                v8::Integer::NewFromUnsigned(isolate, entry.total));
+#elif SL_NODE_VERSION == 10
+    v8::Local<v8::Object> object = v8::Object::New();
+    object->Set(line_number, v8::Integer::New(entry.line));
+    object->Set(self_hits, v8::Integer::NewFromUnsigned(entry.self));
+    object->Set(total_hits, v8::Integer::NewFromUnsigned(entry.total));
+#endif
+    object->Set(function_name, names[entry.function]);
+    object->Set(script_name, names[entry.script]);
+    functions->Set(index, object);
+  }
+  result->Set(FixedString(isolate, "functions"), functions);
+  return result;
+}
+
+ProfileWindow* ReduceProfile(v8::Isolate* isolate,
+                             const v8::CpuProfile* profile,
+                             double start,
+                             double end,
+                             size_t limit) {
+  FlatProfile flat;
+  flat.Build(isolate, profile->GetTopDownRoot());
+  BottomUpProfile bottom_up;
+  bottom_up.Build(flat, false);
+  ProfileWindow* window = new ProfileWindow(start, end, bottom_up.samples());
+  bottom_up.CopyTop(flat, limit, window);
+  return window;
+}
+
+ProfileDiff::ProfileDiff() {
+  samples_[kBaseline] = 0;
+  samples_[kCurrent] = 0;
+}
+
+void ProfileDiff::Build(const ProfileWindow& baseline,
+                        const ProfileWindow& current) {
+  samples_[kBaseline] = baseline.samples();
+  samples_[kCurrent] = current.samples();
+  baseline.AddTo(this, kBaseline);
+  current.AddTo(this, kCurrent);
+}
+
+void ProfileDiff::Add(size_t side,
+                      const StringTable& names,
+                      uint32_t function,
+                      uint32_t script,
+                      int32_t line,
+                      uint32_t self,
+                      uint32_t total) {
+  function = names_.Intern(names.data(function), names.size(function));
+  script = names_.Intern(names.data(script), names.size(script));
+  // The interned names are small integers, the key is a fixed size.
+  const uint32_t words[] = { function, script, static_cast<uint32_t>(line) };
+  key_.clear();
+  for (size_t index = 0; index < SL_ARRAY_SIZE(words); index += 1) {
+    key_.push_back(static_cast<uint16_t>(words[index] >> 16));
+    key_.push_back(static_cast<uint16_t>(words[index]));
+  }
+  const uint32_t index = keys_.Intern(&key_[0], key_.size());
+  if (index == rows_.size()) {
+    Row row = { function, script, line, { 0, 0 }, { 0, 0 } };
+    rows_.push_back(row);
+  }
+  rows_[index].self[side] += self;
+  rows_[index].total[side] += total;
+}
+
+double ProfileDiff::Share(const Row& row, bool self, size_t side) const {
+  if (samples_[side] == 0) {
+    return 0;
+  }
+  return static_cast<double>(self ? row.self[side] : row.total[side]) /
+         samples_[side];
+}
+
+bool CompareDelta(const std::pair<double, uint32_t>& a,
+                  const std::pair<double, uint32_t>& b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+void ProfileDiff::TopRows(size_t limit,
+                          bool self,
+                          std::vector<uint32_t>* out) const {
+  std::vector<std::pair<double, uint32_t> > deltas;
+  for (uint32_t index = 0; index < rows_.size(); index += 1) {
+    const Row& row = rows_[index];
+    const double delta =
+        Share(row, self, kCurrent) - Share(row, self, kBaseline);
+    if (delta > 0) {
+      deltas.push_back(std::make_pair(delta, index));
+    }
+  }
+  limit = std::min(limit, deltas.size());
+  std::partial_sort(deltas.begin(), deltas.begin() + limit, deltas.end(),
+                    CompareDelta);
+  for (size_t index = 0; index < limit; index += 1) {
+    out->push_back(deltas[index].second);
+  }
+}
+
+v8::Local<v8::Object> ProfileDiff::ToObject(v8::Isolate* isolate,
+                                            size_t limit) const {
+  std::vector<v8::Local<v8::Object> > objects(rows_.size());
+  v8::Local<v8::String> names[] = {
+    FixedString(isolate, "self"),
+    FixedString(isolate, "total"),
+  };
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> result = v8::Object::New(isolate);
+  result->Set(FixedString(isolate, "baselineSamples"),
+              v8::Integer::NewFromUnsigned(isolate, samples_[kBaseline]));
+  result->Set(FixedString(isolate, "samples"),
+              v8::Integer::NewFromUnsigned(isolate, samples_[kCurrent]));
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> result = v8::Object::New();
+  result->Set(FixedString(isolate, "baselineSamples"),
+              v8::Integer::NewFromUnsigned(samples_[kBaseline]));
+  result->Set(FixedString(isolate, "samples"),
+              v8::Integer::NewFromUnsigned(samples_[kCurrent]));
+#endif
+  for (size_t list = 0; list < SL_ARRAY_SIZE(names); list += 1) {
+    std::vector<uint32_t> top;
+    TopRows(limit, list == 0, &top);
+#if SL_NODE_VERSION == 12
+    v8::Local<v8::Array> array = v8::Array::New(isolate, top.size());
+#elif SL_NODE_VERSION == 10
+    v8::Local<v8::Array> array = v8::Array::New(top.size());
+#endif
+    for (size_t index = 0; index < top.size(); index += 1) {
+      const uint32_t row = top[index];
+      if (objects[row].IsEmpty()) {
+        objects[row] = RowToObject(isolate, row);
+      }
+      array->Set(index, objects[row]);
+    }
+    result->Set(names[list], array);
+  }
+  return result;
+}
+
+v8::Local<v8::Object> ProfileDiff::RowToObject(v8::Isolate* isolate,
+                                               uint32_t index) const {
+  const Row& row = rows_[index];
+  const double shares[] = {
+    Share(row, true, kBaseline),
+    Share(row, true, kCurrent),
+    Share(row, true, kCurrent) - Share(row, true, kBaseline),
+    Share(row, false, kBaseline),
+    Share(row, false, kCurrent),
+    Share(row, false, kCurrent) - Share(row, false, kBaseline),
+  };
+  v8::Local<v8::String> keys[] = {
+    FixedString(isolate, "selfBefore"),
+    FixedString(isolate, "selfAfter"),
+    FixedString(isolate, "selfDelta"),
+    FixedString(isolate, "totalBefore"),
+    FixedString(isolate, "totalAfter"),
+    FixedString(isolate, "totalDelta"),
+  };
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Object> object = v8::Object::New(isolate);
+  object->Set(FixedString(isolate, "lineNumber"),
+              v8::Integer::New(isolate, row.line));
+  for (size_t key = 0; key < SL_ARRAY_SIZE(keys); key += 1) {
+    object->Set(keys[key], v8::Number::New(isolate, shares[key]));
+  }
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Object> object = v8::Object::New();
+  object->Set(FixedString(isolate, "lineNumber"), v8::Integer::New(row.line));
+  for (size_t key = 0; key < SL_ARRAY_SIZE(keys); key += 1) {
+    object->Set(keys[key], v8::Number::New(shares[key]));
+  }
+#endif
+  object->Set(FixedString(isolate, "functionName"),
+              names_.Get(isolate, row.function));
+  object->Set(FixedString(isolate, "scriptName"),
+              names_.Get(isolate, row.script));
+  return object;
+}
+
+RollingOptions::RollingOptions()
+    : window(10 * 1000),
+      windows(30),
+      top(50),
+      sampling_interval(0),
+      max_bytes(4 << 20) {
+}
+
+void ParseRollingOptions(v8::Isolate* isolate,
+                         v8::Handle<v8::Value> value,
+                         RollingOptions* options) {
+  if (value->IsObject() == false) {
+    return;
+  }
+  v8::Handle<v8::Object> object = value.As<v8::Object>();
+  v8::Local<v8::Value> window = object->Get(FixedString(isolate, "window"));
+  if (window->IsNumber()) {
+    options->window = std::max(window->Uint32Value(), 100u);
+  }
+  v8::Local<v8::Value> windows = object->Get(FixedString(isolate, "windows"));
+  if (windows->IsNumber()) {
+    options->windows = std::min(std::max(windows->Uint32Value(), 1u), 1000u);
+  }
+  v8::Local<v8::Value> top = object->Get(FixedString(isolate, "top"));
+  if (top->IsNumber()) {
+    options->top = std::min(top->Uint32Value(), 1000u);
+  }
+  options->sampling_interval =
+      object->Get(FixedString(isolate, "samplingInterval"))->Uint32Value();
+  v8::Local<v8::Value> max_bytes =
+      object->Get(FixedString(isolate, "maxBytes"));
+  if (max_bytes->IsNumber()) {
+    options->max_bytes = max_bytes->Uint32Value();
+  }
+}
+
+RollingProfiler::RollingProfiler(v8::Isolate* isolate,
+                                 const RollingOptions& options)
+    : isolate_(isolate),
+      options_(options),
+      current_(0),
+      started_(0),
+      bytes_(0) {
+  uv_timer_init(uv_default_loop(), &timer_);
+  // Don't keep the event loop alive just for the profiler.
+  uv_unref(reinterpret_cast<uv_handle_t*>(&timer_));
+  timer_.data = this;
+}
+
+RollingProfiler::~RollingProfiler() {
+  for (size_t index = 0; index < windows_.size(); index += 1) {
+    delete windows_[index];
+  }
+}
+
+void RollingProfiler::Start() {
+#if SL_NODE_VERSION == 12
+  v8::HandleScope handle_scope(isolate_);
+  // Only takes effect when no other profile is running.
+  if (options_.sampling_interval > 0) {
+    isolate_->GetCpuProfiler()->SetSamplingInterval(
+        options_.sampling_interval);
+  }
+#elif SL_NODE_VERSION == 10
+  v8::HandleScope handle_scope;
+#endif
+  StartProfile(current_);
+  started_ = WallClockTime();
+  uv_timer_start(&timer_, OnTimer, options_.window, options_.window);
+}
+
+void RollingProfiler::Rotate() {
+#if SL_NODE_VERSION == 12
+  v8::HandleScope handle_scope(isolate_);
+#elif SL_NODE_VERSION == 10
+  v8::HandleScope handle_scope;
+#endif
+  // Start the next profile before stopping the current one.  The profiler
+  // thread keeps running, no samples fall between two windows.
+  const int next = 1 - current_;
+  StartProfile(next);
+  const v8::CpuProfile* profile = StopProfile(current_);
+  const double start = started_;
+  started_ = WallClockTime();
+  current_ = next;
+  if (profile == NULL) {
+    return;
+  }
+  ProfileWindow* window =
+      ReduceProfile(isolate_, profile, start, started_, options_.top);
+  // See https://code.google.com/p/v8/issues/detail?id=3213.
+  const_cast<v8::CpuProfile*>(profile)->Delete();
+  windows_.push_back(window);
+  bytes_ += window->bytes();
+  // The cap is hard, a window that doesn't fit by itself is dropped too.
+  while (windows_.empty() == false &&
+         (windows_.size() > options_.windows ||
+          bytes_ > options_.max_bytes)) {
+    bytes_ -= windows_.front()->bytes();
+    delete windows_.front();
+    windows_.pop_front();
+  }
+}
+
+void RollingProfiler::Dispose() {
+  uv_timer_stop(&timer_);
+  {
+#if SL_NODE_VERSION == 12
+    v8::HandleScope handle_scope(isolate_);
+#elif SL_NODE_VERSION == 10
+    v8::HandleScope handle_scope;
+#endif
+    const v8::CpuProfile* profile = StopProfile(current_);
+    if (profile != NULL) {
+      const_cast<v8::CpuProfile*>(profile)->Delete();
+    }
+  }
+  uv_close(reinterpret_cast<uv_handle_t*>(&timer_), OnClose);
+}
+
+v8::Local<v8::Array> RollingProfiler::ToArray(v8::Isolate* isolate) const {
+  const uint32_t count = static_cast<uint32_t>(windows_.size());
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> array = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> array = v8::Array::New(count);
+#endif
+  for (uint32_t index = 0; index < count; index += 1) {
+    array->Set(index, windows_[index]->ToObject(isolate));
+  }
+  return array;
+}
+
+void RollingProfiler::OnTimer(uv_timer_t* handle, int) {
+  static_cast<RollingProfiler*>(handle->data)->Rotate();
+}
+
+void RollingProfiler::OnClose(uv_handle_t* handle) {
+  delete static_cast<RollingProfiler*>(handle->data);
+}
+
+v8::Local<v8::String> RollingProfiler::Title(int slot) const {
+  if (slot == 0) {
+    return FixedString(isolate_, "strong-agent rolling profile 0");
+  }
+  return FixedString(isolate_, "strong-agent rolling profile 1");
+}
+
+void RollingProfiler::StartProfile(int slot) {
+#if SL_NODE_VERSION == 12
+  isolate_->GetCpuProfiler()->StartCpuProfiling(Title(slot));
+#elif SL_NODE_VERSION == 10
+  v8::CpuProfiler::StartProfiling(Title(slot));
+#endif
+}
+
+const v8::CpuProfile* RollingProfiler::StopProfile(int slot) {
+#if SL_NODE_VERSION == 12
+  return isolate_->GetCpuProfiler()->StopCpuProfiling(Title(slot));
+#elif SL_NODE_VERSION == 10
+  return v8::CpuProfiler::StopProfiling(Title(slot));
+#endif
+}
+
+StallOptions::StallOptions()
+    : threshold(100),
+      count(3),
+      within(10 * 1000),
+      duration(2 * 1000),
+      cooldown(60 * 1000),
+      top(50),
+      keep(5) {
+}
+
+void ParseStallOptions(v8::Isolate* isolate,
+                       v8::Handle<v8::Value> value,
+                       StallOptions* options) {
+  if (value->IsObject() == false) {
+    return;
+  }
+  v8::Handle<v8::Object> object = value.As<v8::Object>();
+  v8::Local<v8::Value> threshold =
+      object->Get(FixedString(isolate, "threshold"));
+  if (threshold->IsNumber()) {
+    options->threshold = std::max(threshold->Uint32Value(), 1u);
+  }
+  v8::Local<v8::Value> count = object->Get(FixedString(isolate, "count"));
+  if (count->IsNumber()) {
+    options->count = std::min(std::max(count->Uint32Value(), 1u), 1000u);
+  }
+  v8::Local<v8::Value> within = object->Get(FixedString(isolate, "within"));
+  if (within->IsNumber()) {
+    options->within = within->Uint32Value();
+  }
+  v8::Local<v8::Value> duration =
+      object->Get(FixedString(isolate, "duration"));
+  if (duration->IsNumber()) {
+    options->duration = std::max(duration->Uint32Value(), 10u);
+  }
+  v8::Local<v8::Value> cooldown =
+      object->Get(FixedString(isolate, "cooldown"));
+  if (cooldown->IsNumber()) {
+    options->cooldown = cooldown->Uint32Value();
+  }
+  v8::Local<v8::Value> top = object->Get(FixedString(isolate, "top"));
+  if (top->IsNumber()) {
+    options->top = std::min(top->Uint32Value(), 1000u);
+  }
+  v8::Local<v8::Value> keep = object->Get(FixedString(isolate, "keep"));
+  if (keep->IsNumber()) {
+    options->keep = std::min(std::max(keep->Uint32Value(), 1u), 100u);
+  }
+}
+
+StallProfiler::StallProfiler(v8::Isolate* isolate,
+                             const StallOptions& options)
+    : isolate_(isolate),
+      options_(options),
+      profiling_(false),
+      started_(0),
+      quiet_until_(0) {
+  uv_timer_init(uv_default_loop(), &timer_);
+  // Don't keep the event loop alive just for the profiler.
+  uv_unref(reinterpret_cast<uv_handle_t*>(&timer_));
+  timer_.data = this;
+}
+
+StallProfiler::~StallProfiler() {
+  for (size_t index = 0; index < profiles_.size(); index += 1) {
+    delete profiles_[index];
+  }
+}
+
+void StallProfiler::OnLoopDelay(uint64_t now, uint32_t delay) {
+  if (profiling_ || delay < options_.threshold || now < quiet_until_) {
+    return;
+  }
+  stalls_.push_back(now);
+  while (stalls_.size() > options_.count ||
+         now - stalls_.front() > options_.within) {
+    stalls_.pop_front();
+  }
+  if (stalls_.size() == options_.count) {
+    stalls_.clear();
+    StartProfile(now);
+  }
+}
+
+v8::Local<v8::Array> StallProfiler::Take(v8::Isolate* isolate) {
+  const uint32_t count = static_cast<uint32_t>(profiles_.size());
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> array = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> array = v8::Array::New(count);
+#endif
+  for (uint32_t index = 0; index < count; index += 1) {
+    array->Set(index, profiles_[index]->ToObject(isolate));
+    delete profiles_[index];
+  }
+  profiles_.clear();
+  return array;
+}
+
+void StallProfiler::Dispose() {
+  uv_timer_stop(&timer_);
+  if (profiling_) {
+    const v8::CpuProfile* profile = StopProfile();
+    if (profile != NULL) {
+      const_cast<v8::CpuProfile*>(profile)->Delete();
+    }
+  }
+  uv_close(reinterpret_cast<uv_handle_t*>(&timer_), OnClose);
+}
+
+void StallProfiler::OnTimer(uv_timer_t* handle, int) {
+  StallProfiler* self = static_cast<StallProfiler*>(handle->data);
+#if SL_NODE_VERSION == 12
+  v8::HandleScope handle_scope(self->isolate_);
+#elif SL_NODE_VERSION == 10
+  v8::HandleScope handle_scope;
+#endif
+  const v8::CpuProfile* profile = self->StopProfile();
+  if (profile == NULL) {
+    return;
+  }
+  ProfileWindow* window = ReduceProfile(self->isolate_,
+                                        profile,
+                                        self->started_,
+                                        WallClockTime(),
+                                        self->options_.top);
+  const_cast<v8::CpuProfile*>(profile)->Delete();
+  self->profiles_.push_back(window);
+  if (self->profiles_.size() > self->options_.keep) {
+    delete self->profiles_.front();
+    self->profiles_.pop_front();
+  }
+}
+
+void StallProfiler::OnClose(uv_handle_t* handle) {
+  delete static_cast<StallProfiler*>(handle->data);
+}
+
+v8::Local<v8::String> StallProfiler::Title() const {
+  return FixedString(isolate_, "strong-agent stall profile");
+}
+
+void StallProfiler::StartProfile(uint64_t now) {
+#if SL_NODE_VERSION == 12
+  v8::HandleScope handle_scope(isolate_);
+  isolate_->GetCpuProfiler()->StartCpuProfiling(Title());
+#elif SL_NODE_VERSION == 10
+  v8::HandleScope handle_scope;
+  v8::CpuProfiler::StartProfiling(Title());
+#endif
+  profiling_ = true;
+  started_ = WallClockTime();
+  quiet_until_ = now + options_.duration + options_.cooldown;
+  uv_timer_start(&timer_, OnTimer, options_.duration, 0);
+}
+
+// Call with a valid HandleScope.
+const v8::CpuProfile* StallProfiler::StopProfile() {
+  profiling_ = false;
+#if SL_NODE_VERSION == 12
+  return isolate_->GetCpuProfiler()->StopCpuProfiling(Title());
+#elif SL_NODE_VERSION == 10
+  return v8::CpuProfiler::StopProfiling(Title());
+#endif
+}
+
+}  // namespace profiler
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_PROFILER_INL_H_
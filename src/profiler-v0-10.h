@@ -6,6 +6,8 @@
 #ifndef AGENT_SRC_PROFILER_V0_10_H_
 #define AGENT_SRC_PROFILER_V0_10_H_
 
+#include "profiler.h"
+#include "profiler-inl.h"
 #include "strong-agent.h"
 #include "v8-profiler.h"
 
@@ -15,128 +17,142 @@ namespace profiler {
 
 using v8::Arguments;
 using v8::Array;
+using v8::Context;
 using v8::CpuProfile;
 using v8::CpuProfileNode;
 using v8::CpuProfiler;
+using v8::Function;
 using v8::FunctionTemplate;
 using v8::Handle;
 using v8::HandleScope;
 using v8::Integer;
 using v8::Isolate;
 using v8::Local;
+using v8::Null;
 using v8::Number;
 using v8::Object;
+using v8::Persistent;
 using v8::String;
 using v8::Undefined;
 using v8::Value;
 
-Local<Object> ToObject(Isolate* isolate, const CpuProfileNode* node) {
-  // Use a helper that caches the property strings.
-  struct ToObjectHelper {
-    explicit ToObjectHelper(Isolate* isolate) : isolate_(isolate) {
-      call_uid_sym_ = FixedString(isolate, "callUid");
-      children_count_sym_ = FixedString(isolate, "childrenCount");
-      children_sym_ = FixedString(isolate, "children");
-      function_name_sym_ = FixedString(isolate, "functionName");
-      line_number_sym_ = FixedString(isolate, "lineNumber");
-      script_name_sym_ = FixedString(isolate, "scriptName");
-      self_samples_count_sym_ = FixedString(isolate, "selfSamplesCount");
-      self_time_sym_ = FixedString(isolate, "selfTime");
-      total_samples_count_sym_ = FixedString(isolate, "totalSamplesCount");
-      total_time_sym_ = FixedString(isolate, "totalTime");
-    }
+// Converts profile nodes to objects.  Caches the property strings.
+struct ToObjectHelper {
+  explicit ToObjectHelper(Isolate* isolate) : isolate_(isolate) {
+    call_uid_sym_ = FixedString(isolate, "callUid");
+    children_count_sym_ = FixedString(isolate, "childrenCount");
+    children_sym_ = FixedString(isolate, "children");
+    function_name_sym_ = FixedString(isolate, "functionName");
+    line_number_sym_ = FixedString(isolate, "lineNumber");
+    script_name_sym_ = FixedString(isolate, "scriptName");
+    self_samples_count_sym_ = FixedString(isolate, "selfSamplesCount");
+    self_time_sym_ = FixedString(isolate, "selfTime");
+    total_samples_count_sym_ = FixedString(isolate, "totalSamplesCount");
+    total_time_sym_ = FixedString(isolate, "totalTime");
+  }
 
-    bool IsConstructed() const {
-      return call_uid_sym_.IsEmpty() == false &&
-             children_count_sym_.IsEmpty() == false &&
-             children_sym_.IsEmpty() == false &&
-             function_name_sym_.IsEmpty() == false &&
-             line_number_sym_.IsEmpty() == false &&
-             script_name_sym_.IsEmpty() == false &&
-             self_samples_count_sym_.IsEmpty() == false &&
-             self_time_sym_.IsEmpty() == false &&
-             total_samples_count_sym_.IsEmpty() == false &&
-             total_time_sym_.IsEmpty() == false;
-    }
+  bool IsConstructed() const {
+    return call_uid_sym_.IsEmpty() == false &&
+           children_count_sym_.IsEmpty() == false &&
+           children_sym_.IsEmpty() == false &&
+           function_name_sym_.IsEmpty() == false &&
+           line_number_sym_.IsEmpty() == false &&
+           script_name_sym_.IsEmpty() == false &&
+           self_samples_count_sym_.IsEmpty() == false &&
+           self_time_sym_.IsEmpty() == false &&
+           total_samples_count_sym_.IsEmpty() == false &&
+           total_time_sym_.IsEmpty() == false;
+  }
 
-    Local<Object> ToObject(const CpuProfileNode* node) const {
-      HandleScope handle_scope;
-      const int children_count = node->GetChildrenCount();
-
-      // Guard against out-of-memory situations, they're not unlikely when
-      // the DAG is big.
-      Local<Object> o = Object::New();
-      if (o.IsEmpty()) return Local<Object>();
-
-      Local<Number> self_samples_count_val =
-          Number::New(node->GetSelfSamplesCount());
-      if (self_samples_count_val.IsEmpty()) return Local<Object>();
-
-      Local<Number> self_time_val = Number::New(node->GetSelfTime());
-      if (self_time_val.IsEmpty()) return Local<Object>();
-
-      Local<Number> total_samples_count_val =
-          Number::New(node->GetTotalSamplesCount());
-      if (total_samples_count_val.IsEmpty()) return Local<Object>();
-
-      Local<Number> total_time_val = Number::New(node->GetTotalTime());
-      if (total_time_val.IsEmpty()) return Local<Object>();
-
-      Local<Integer> call_uid_val =
-          Integer::NewFromUnsigned(node->GetCallUid(), isolate_);
-      if (call_uid_val.IsEmpty()) return Local<Object>();
-
-      Local<Integer> children_count_val =
-          Integer::New(children_count, isolate_);
-      if (children_count_val.IsEmpty()) return Local<Object>();
-
-      Local<Integer> line_number_val =
-          Integer::New(node->GetLineNumber(), isolate_);
-      if (line_number_val.IsEmpty()) return Local<Object>();
-
-      // The next two cannot really fail but the extra checks don't hurt.
-      Handle<String> script_name_val = node->GetScriptResourceName();
-      if (script_name_val.IsEmpty()) return Local<Object>();
-
-      Handle<String> function_name_val = node->GetFunctionName();
-      if (function_name_val.IsEmpty()) return Local<Object>();
-
-      // Field order compatible with strong-cpu-profiler.
-      o->Set(children_count_sym_, children_count_val);
-      o->Set(call_uid_sym_, call_uid_val);
-      o->Set(self_samples_count_sym_, self_samples_count_val);
-      o->Set(total_samples_count_sym_, total_samples_count_val);
-      o->Set(self_time_sym_, self_time_val);
-      o->Set(total_time_sym_, total_time_val);
-      o->Set(line_number_sym_, line_number_val);
-      o->Set(script_name_sym_, script_name_val);
-      o->Set(function_name_sym_, function_name_val);
-
-      Local<Array> children = Array::New(children_count);
-      if (children.IsEmpty()) return Local<Object>();
-      for (int index = 0; index < children_count; ++index) {
-        Local<Object> child = this->ToObject(node->GetChild(index));
-        if (child.IsEmpty()) return Local<Object>();
-        children->Set(index, child);
-      }
-      o->Set(children_sym_, children);
+  // Creates the object for |node| and its (still empty) children array,
+  // which is stored in |children|.  Call with a valid HandleScope.
+  Local<Object> NewNode(const CpuProfileNode* node,
+                        Local<Array>* children) const {
+    const int children_count = node->GetChildrenCount();
+
+    // Guard against out-of-memory situations, they're not unlikely when
+    // the DAG is big.
+    Local<Object> o = Object::New();
+    if (o.IsEmpty()) return Local<Object>();
+
+    Local<Number> self_samples_count_val =
+        Number::New(node->GetSelfSamplesCount());
+    if (self_samples_count_val.IsEmpty()) return Local<Object>();
+
+    Local<Number> self_time_val = Number::New(node->GetSelfTime());
+    if (self_time_val.IsEmpty()) return Local<Object>();
+
+    Local<Number> total_samples_count_val =
+        Number::New(node->GetTotalSamplesCount());
+    if (total_samples_count_val.IsEmpty()) return Local<Object>();
+
+    Local<Number> total_time_val = Number::New(node->GetTotalTime());
+    if (total_time_val.IsEmpty()) return Local<Object>();
+
+    Local<Integer> call_uid_val =
+        Integer::NewFromUnsigned(node->GetCallUid(), isolate_);
+    if (call_uid_val.IsEmpty()) return Local<Object>();
 
-      return handle_scope.Close(o);
+    Local<Integer> children_count_val =
+        Integer::New(children_count, isolate_);
+    if (children_count_val.IsEmpty()) return Local<Object>();
+
+    Local<Integer> line_number_val =
+        Integer::New(node->GetLineNumber(), isolate_);
+    if (line_number_val.IsEmpty()) return Local<Object>();
+
+    // The next two cannot really fail but the extra checks don't hurt.
+    Handle<String> script_name_val = node->GetScriptResourceName();
+    if (script_name_val.IsEmpty()) return Local<Object>();
+
+    Handle<String> function_name_val = node->GetFunctionName();
+    if (function_name_val.IsEmpty()) return Local<Object>();
+
+    // Field order compatible with strong-cpu-profiler.
+    o->Set(children_count_sym_, children_count_val);
+    o->Set(call_uid_sym_, call_uid_val);
+    o->Set(self_samples_count_sym_, self_samples_count_val);
+    o->Set(total_samples_count_sym_, total_samples_count_val);
+    o->Set(self_time_sym_, self_time_val);
+    o->Set(total_time_sym_, total_time_val);
+    o->Set(line_number_sym_, line_number_val);
+    o->Set(script_name_sym_, script_name_val);
+    o->Set(function_name_sym_, function_name_val);
+
+    *children = Array::New(children_count);
+    if (children->IsEmpty()) return Local<Object>();
+    o->Set(children_sym_, *children);
+
+    return o;
+  }
+
+  Local<Object> ToObject(const CpuProfileNode* node) const {
+    HandleScope handle_scope;
+    Local<Array> children;
+    Local<Object> o = NewNode(node, &children);
+    if (o.IsEmpty()) return Local<Object>();
+    for (int index = 0; index < node->GetChildrenCount(); ++index) {
+      Local<Object> child = this->ToObject(node->GetChild(index));
+      if (child.IsEmpty()) return Local<Object>();
+      children->Set(index, child);
     }
+    return handle_scope.Close(o);
+  }
 
-    Isolate* isolate_;
-    Local<String> call_uid_sym_;
-    Local<String> children_count_sym_;
-    Local<String> children_sym_;
-    Local<String> function_name_sym_;
-    Local<String> line_number_sym_;
-    Local<String> script_name_sym_;
-    Local<String> self_samples_count_sym_;
-    Local<String> self_time_sym_;
-    Local<String> total_samples_count_sym_;
-    Local<String> total_time_sym_;
-  };
+  Isolate* isolate_;
+  Local<String> call_uid_sym_;
+  Local<String> children_count_sym_;
+  Local<String> children_sym_;
+  Local<String> function_name_sym_;
+  Local<String> line_number_sym_;
+  Local<String> script_name_sym_;
+  Local<String> self_samples_count_sym_;
+  Local<String> self_time_sym_;
+  Local<String> total_samples_count_sym_;
+  Local<String> total_time_sym_;
+};
 
+Local<Object> ToObject(Isolate* isolate, const CpuProfileNode* node) {
   HandleScope handle_scope;
   ToObjectHelper helper(isolate);
   if (helper.IsConstructed() == false) {
@@ -145,32 +161,299 @@ Local<Object> ToObject(Isolate* isolate, const CpuProfileNode* node) {
   return handle_scope.Close(helper.ToObject(node));
 }
 
-Handle<Value> StartCpuProfiling(const Arguments&) {
+// The baseline for stopCpuProfiling({ format: 'diff' }).
+ProfileWindow* baseline_profile;
+
+// startCpuProfiling([options])
+//
+// Pass { title: 'name' } to run more than one profile at a time.  V8 3.14
+// has a fixed sampling interval, { samplingInterval } is ignored.
+Handle<Value> StartCpuProfiling(const Arguments& args) {
   HandleScope handle_scope;
-  CpuProfiler::StartProfiling(String::Empty());
+  Options options;
+  ParseOptions(NULL, args[0], &options);
+  CpuProfiler::StartProfiling(
+      options.title.IsEmpty() ? String::Empty() : options.title);
   return Undefined();
 }
 
-Handle<Value> StopCpuProfiling(const Arguments&) {
+// Converts |profile| to the format that |options| asks for and deletes it.
+// Returns an empty handle when it runs out of memory.
+Local<Value> ProfileToValue(const Options& options,
+                            const CpuProfile* profile) {
   HandleScope handle_scope;
-  const CpuProfile* profile = CpuProfiler::StopProfiling(String::Empty());
-  if (profile == NULL) {
-    return Undefined();  // Not started or preempted by another profiler.
+  if (options.format == kBaselineFormat || options.format == kDiffFormat) {
+    const double now = WallClockTime();
+    ProfileWindow* window =
+        ReduceProfile(NULL, profile, now, now, static_cast<size_t>(-1));
+    const_cast<CpuProfile*>(profile)->Delete();
+    if (options.format == kBaselineFormat) {
+      delete baseline_profile;
+      baseline_profile = window;
+      return handle_scope.Close(Integer::NewFromUnsigned(window->samples()));
+    }
+    if (baseline_profile == NULL) {
+      delete window;
+      return handle_scope.Close(Null());
+    }
+    ProfileDiff diff;
+    diff.Build(*baseline_profile, *window);
+    delete window;
+    return handle_scope.Close(diff.ToObject(NULL, options.top));
+  }
+  if (options.format == kFoldedFormat) {
+    FoldedStacks folded(options.collapse);
+    folded.Build(NULL, profile->GetTopDownRoot());
+    const_cast<CpuProfile*>(profile)->Delete();
+    return handle_scope.Close(folded.ToString(NULL));
+  }
+  if (options.format == kFlatFormat || options.format == kTopFormat) {
+    FlatProfile flat;
+    flat.Build(NULL, profile->GetTopDownRoot());
+    const_cast<CpuProfile*>(profile)->Delete();
+    if (options.format == kFlatFormat) {
+      return handle_scope.Close(flat.ToObject(NULL));
+    }
+    BottomUpProfile bottom_up;
+    bottom_up.Build(flat, options.callers > 0);
+    return handle_scope.Close(bottom_up.ToObject(NULL, flat, options));
   }
   Local<Object> top_root = ToObject(Isolate::GetCurrent(),
                                     profile->GetTopDownRoot());
-  CpuProfiler::DeleteAllProfiles();
-  if (top_root.IsEmpty() == true) {
-    return Undefined();  // Out of memory.
-  }
+  // Not DeleteAllProfiles(), that also stops other running profiles.
+  const_cast<CpuProfile*>(profile)->Delete();
   return handle_scope.Close(top_root);
 }
 
+// See the v0.12 version.
+struct SerializeJob {
+  uv_idle_t idle_handle;
+  const CpuProfile* profile;  // NULL once deleted.
+  uint64_t slice_time;  // Nanoseconds.
+  // Node, number of the parent node and index into the parent's children.
+  std::vector<std::pair<const CpuProfileNode*, std::pair<uint32_t, int> > >
+      stack;
+  uint32_t count;  // Nodes converted.
+  Persistent<Array> children;
+  Persistent<Value> result;
+  Persistent<Function> callback;
+};
+
+void SerializeClose(uv_handle_t* handle) {
+  delete static_cast<SerializeJob*>(handle->data);
+}
+
+// Converts nodes until the stack is empty or the slice is used up.
+// Returns false when it runs out of memory.
+bool SerializeSlice(SerializeJob* job) {
+  ToObjectHelper helper(Isolate::GetCurrent());
+  if (helper.IsConstructed() == false) {
+    return false;
+  }
+  const uint64_t deadline = uv_hrtime() + job->slice_time;
+  do {
+    // Check the clock every so many nodes, uv_hrtime() isn't free.
+    HandleScope handle_scope;
+    for (int n = 0; n < 64 && job->stack.empty() == false; n += 1) {
+      const CpuProfileNode* node = job->stack.back().first;
+      const uint32_t parent = job->stack.back().second.first;
+      const int index = job->stack.back().second.second;
+      job->stack.pop_back();
+      Local<Array> children;
+      Local<Object> o = helper.NewNode(node, &children);
+      if (o.IsEmpty()) {
+        return false;
+      }
+      const uint32_t number = job->count;
+      job->count += 1;
+      if (number == 0) {
+        job->result = Persistent<Value>::New(o);
+      } else {
+        job->children->Get(parent).As<Array>()->Set(index, o);
+      }
+      job->children->Set(number, children);
+      for (int child = node->GetChildrenCount(); child > 0; child -= 1) {
+        job->stack.push_back(std::make_pair(
+            node->GetChild(child - 1), std::make_pair(number, child - 1)));
+      }
+    }
+  } while (job->stack.empty() == false && uv_hrtime() < deadline);
+  return true;
+}
+
+void SerializeIdle(uv_idle_t* handle, int) {
+  SerializeJob* job = static_cast<SerializeJob*>(handle->data);
+  HandleScope handle_scope;
+  if (SerializeSlice(job) == false) {
+    job->stack.clear();  // Out of memory, the result is undefined.
+    if (job->result.IsEmpty() == false) {
+      job->result.Dispose();
+      job->result.Clear();
+    }
+  }
+  if (job->stack.empty() == false) {
+    return;  // More next time.
+  }
+  if (job->profile != NULL) {
+    const_cast<CpuProfile*>(job->profile)->Delete();
+    job->profile = NULL;
+  }
+  Local<Value> argv[] = { Local<Value>::New(job->result) };
+  if (argv[0].IsEmpty()) {
+    argv[0] = Local<Value>::New(Undefined());
+  }
+  Persistent<Function> callback = job->callback;
+  job->children.Dispose();
+  if (job->result.IsEmpty() == false) {
+    job->result.Dispose();
+  }
+  uv_idle_stop(&job->idle_handle);
+  uv_close(reinterpret_cast<uv_handle_t*>(&job->idle_handle), SerializeClose);
+  callback->Call(Context::GetCurrent()->Global(), SL_ARRAY_SIZE(argv), argv);
+  callback.Dispose();
+}
+
+// stopCpuProfiling([options], [callback])
+//
+// Returns the top-down call tree as nested objects, see ToObject().  Pass
+// { format: 'flat' } to get a node table instead, see FlatProfile, or
+// { format: 'top', top: n, callers: m } to get the hottest functions only,
+// see BottomUpProfile.  Pass the { title } that was passed to
+// startCpuProfiling(), if any.  Pass { format: 'folded', collapse: 'script'
+// or 'package' } to get the folded stacks for flamegraph tools as a string,
+// see FoldedStacks.  { format: 'baseline' } and { format: 'diff' } work
+// like they do in the v0.12 version, and so does the callback.
+Handle<Value> StopCpuProfiling(const Arguments& args) {
+  HandleScope handle_scope;
+  Local<Value> options_arg = args[0];
+  Local<Value> callback_arg = args[1];
+  if (options_arg->IsFunction()) {
+    callback_arg = options_arg;
+    options_arg = Local<Value>::New(Undefined());
+  }
+  Options options;
+  ParseOptions(NULL, options_arg, &options);
+  const CpuProfile* profile = CpuProfiler::StopProfiling(
+      options.title.IsEmpty() ? String::Empty() : options.title);
+  if (callback_arg->IsFunction() == false) {
+    if (profile == NULL) {
+      return Undefined();  // Not started or preempted by another profiler.
+    }
+    Local<Value> result = ProfileToValue(options, profile);
+    if (result.IsEmpty() == true) {
+      return Undefined();  // Out of memory.
+    }
+    return handle_scope.Close(result);
+  }
+  SerializeJob* job = new SerializeJob;
+  job->profile = NULL;
+  job->slice_time = options.slice_time * static_cast<uint64_t>(1e6);
+  job->count = 0;
+  job->children = Persistent<Array>::New(Array::New());
+  job->callback = Persistent<Function>::New(callback_arg.As<Function>());
+  if (profile != NULL && options.format == kTreeFormat) {
+    job->profile = profile;
+    job->stack.push_back(std::make_pair(profile->GetTopDownRoot(),
+                                        std::make_pair(0u, 0)));
+  } else if (profile != NULL) {
+    Local<Value> result = ProfileToValue(options, profile);
+    if (result.IsEmpty() == false) {
+      job->result = Persistent<Value>::New(result);
+    }
+  }
+  job->idle_handle.data = job;
+  uv_idle_init(uv_default_loop(), &job->idle_handle);
+  uv_idle_start(&job->idle_handle, SerializeIdle);
+  return Undefined();
+}
+
+RollingProfiler* rolling_profiler;
+
+// startRollingProfiler([options]), see the v0.12 version.
+Handle<Value> StartRollingProfiler(const Arguments& args) {
+  HandleScope handle_scope;
+  if (rolling_profiler == NULL) {
+    RollingOptions options;
+    ParseRollingOptions(NULL, args[0], &options);
+    rolling_profiler = new RollingProfiler(Isolate::GetCurrent(), options);
+    rolling_profiler->Start();
+  }
+  return Undefined();
+}
+
+// pollRollingProfiler([rotate]), see the v0.12 version.
+Handle<Value> PollRollingProfiler(const Arguments& args) {
+  HandleScope handle_scope;
+  if (rolling_profiler == NULL) {
+    return Undefined();
+  }
+  if (args[0]->BooleanValue()) {
+    rolling_profiler->Rotate();
+  }
+  return handle_scope.Close(rolling_profiler->ToArray(NULL));
+}
+
+// stopRollingProfiler(), see the v0.12 version.
+Handle<Value> StopRollingProfiler(const Arguments&) {
+  HandleScope handle_scope;
+  if (rolling_profiler == NULL) {
+    return Undefined();
+  }
+  Local<Array> windows = rolling_profiler->ToArray(NULL);
+  rolling_profiler->Dispose();
+  rolling_profiler = NULL;
+  return handle_scope.Close(windows);
+}
+
+// Armed by armStallProfiler(), fed by uvmon::OnCheck().
+StallProfiler* stall_profiler;
+
+// armStallProfiler([options]), see the v0.12 version.
+Handle<Value> ArmStallProfiler(const Arguments& args) {
+  HandleScope handle_scope;
+  if (stall_profiler == NULL) {
+    StallOptions options;
+    ParseStallOptions(NULL, args[0], &options);
+    stall_profiler = new StallProfiler(Isolate::GetCurrent(), options);
+  }
+  return Undefined();
+}
+
+// takeStallProfiles(), see the v0.12 version.
+Handle<Value> TakeStallProfiles(const Arguments&) {
+  HandleScope handle_scope;
+  if (stall_profiler == NULL) {
+    return Undefined();
+  }
+  return handle_scope.Close(stall_profiler->Take(NULL));
+}
+
+Handle<Value> DisarmStallProfiler(const Arguments&) {
+  HandleScope handle_scope;
+  if (stall_profiler != NULL) {
+    stall_profiler->Dispose();
+    stall_profiler = NULL;
+  }
+  return Undefined();
+}
+
 void Initialize(Isolate* isolate, Handle<Object> o) {
   o->Set(FixedString(isolate, "startCpuProfiling"),
          FunctionTemplate::New(StartCpuProfiling)->GetFunction());
   o->Set(FixedString(isolate, "stopCpuProfiling"),
          FunctionTemplate::New(StopCpuProfiling)->GetFunction());
+  o->Set(FixedString(isolate, "startRollingProfiler"),
+         FunctionTemplate::New(StartRollingProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "pollRollingProfiler"),
+         FunctionTemplate::New(PollRollingProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "stopRollingProfiler"),
+         FunctionTemplate::New(StopRollingProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "armStallProfiler"),
+         FunctionTemplate::New(ArmStallProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "takeStallProfiles"),
+         FunctionTemplate::New(TakeStallProfiles)->GetFunction());
+  o->Set(FixedString(isolate, "disarmStallProfiler"),
+         FunctionTemplate::New(DisarmStallProfiler)->GetFunction());
 }
 
 }  // namespace profiler
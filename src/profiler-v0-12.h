@@ -6,6 +6,8 @@
 #ifndef AGENT_SRC_PROFILER_V0_12_H_
 #define AGENT_SRC_PROFILER_V0_12_H_
 
+#include "profiler.h"
+#include "profiler-inl.h"
 #include "strong-agent.h"
 #include "v8-profiler.h"
 #include <string.h>
@@ -19,6 +21,7 @@ using v8::CpuProfile;
 using v8::CpuProfileNode;
 using v8::CpuProfiler;
 using v8::EscapableHandleScope;
+using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
 using v8::Handle;
@@ -26,145 +29,160 @@ using v8::HandleScope;
 using v8::Integer;
 using v8::Isolate;
 using v8::Local;
+using v8::Null;
 using v8::Number;
 using v8::Object;
+using v8::Persistent;
 using v8::String;
 using v8::Value;
 
-// Call with a valid HandleScope.
-Local<Object> ToObject(Isolate* isolate, const CpuProfileNode* node) {
-  // Use a helper that caches the property strings.
-  struct ToObjectHelper {
-    explicit ToObjectHelper(Isolate* isolate) : isolate_(isolate) {
-      // Only collect information that exists both in v0.10 and v0.11.
-      bailout_reason_sym_ = FixedString(isolate, "bailoutReason");
-      children_sym_ = FixedString(isolate, "children");
-      column_number_sym_ = FixedString(isolate, "columnNumber");
-      function_name_sym_ = FixedString(isolate, "functionName");
-      hit_count_sym_ = FixedString(isolate, "hitCount");
-      line_number_sym_ = FixedString(isolate, "lineNumber");
-      script_name_sym_ = FixedString(isolate, "scriptName");
+// Converts profile nodes to objects.  Caches the property strings.
+struct ToObjectHelper {
+  explicit ToObjectHelper(Isolate* isolate) : isolate_(isolate) {
+    // Only collect information that exists both in v0.10 and v0.11.
+    bailout_reason_sym_ = FixedString(isolate, "bailoutReason");
+    children_sym_ = FixedString(isolate, "children");
+    column_number_sym_ = FixedString(isolate, "columnNumber");
+    function_name_sym_ = FixedString(isolate, "functionName");
+    hit_count_sym_ = FixedString(isolate, "hitCount");
+    line_number_sym_ = FixedString(isolate, "lineNumber");
+    script_name_sym_ = FixedString(isolate, "scriptName");
+  }
+
+  bool IsConstructed() const {
+    return bailout_reason_sym_.IsEmpty() == false &&
+           children_sym_.IsEmpty() == false &&
+           column_number_sym_.IsEmpty() == false &&
+           function_name_sym_.IsEmpty() == false &&
+           hit_count_sym_.IsEmpty() == false &&
+           line_number_sym_.IsEmpty() == false &&
+           script_name_sym_.IsEmpty() == false;
+  }
+
+  // Creates the object for |node| without its children.  Stores the
+  // (still empty) children array in |children| if the node has children.
+  // Call with a valid HandleScope.
+  Local<Object> NewNode(const CpuProfileNode* node,
+                        Local<Array>* children) const {
+    // Guard against out-of-memory situations, they're not unlikely when
+    // the DAG is big.
+    Local<Object> o = Object::New(isolate_);
+    if (o.IsEmpty()) return Local<Object>();
+
+    // These two cannot really fail but the extra checks don't hurt.
+    Handle<String> script_name_val = node->GetScriptResourceName();
+    if (script_name_val.IsEmpty()) return Local<Object>();
+    // Filter out empty strings.  Samples from native code don't have
+    // script names associated with them.
+    if (script_name_val->Length() > 0) {
+      o->Set(script_name_sym_, script_name_val);
     }
 
-    bool IsConstructed() const {
-      return bailout_reason_sym_.IsEmpty() == false &&
-             children_sym_.IsEmpty() == false &&
-             column_number_sym_.IsEmpty() == false &&
-             function_name_sym_.IsEmpty() == false &&
-             hit_count_sym_.IsEmpty() == false &&
-             line_number_sym_.IsEmpty() == false &&
-             script_name_sym_.IsEmpty() == false;
+    Handle<String> function_name_val = node->GetFunctionName();
+    if (function_name_val.IsEmpty()) return Local<Object>();
+    // Filter out anonymous function names, they are plentiful in most code
+    // but uninteresting and we can save quite a bit of bandwidth this way.
+    // The string comparison is done in a somewhat roundabout way for
+    // performance reasons; writing out the string like this is a little
+    // faster than using Equals() or String::AsciiValue.
+    static const uint8_t anonymous_function[] = "(anonymous function)";
+    uint8_t write_buffer[sizeof(anonymous_function) - 1] = { 0 };
+    const bool check = function_name_val->Length() == sizeof(write_buffer);
+    if (check) {
+      function_name_val->WriteOneByte(write_buffer,
+                                      0,
+                                      sizeof(write_buffer),
+                                      String::NO_NULL_TERMINATION);
+    }
+    if (check == false ||
+        memcmp(anonymous_function, write_buffer, sizeof(write_buffer)) != 0) {
+      o->Set(function_name_sym_, function_name_val);
     }
 
-    Local<Object> ToObject(const CpuProfileNode* node) const {
-      EscapableHandleScope handle_scope(isolate_);
-      // Guard against out-of-memory situations, they're not unlikely when
-      // the DAG is big.
-      Local<Object> o = Object::New(isolate_);
-      if (o.IsEmpty()) return Local<Object>();
-
-      // These two cannot really fail but the extra checks don't hurt.
-      Handle<String> script_name_val = node->GetScriptResourceName();
-      if (script_name_val.IsEmpty()) return Local<Object>();
-      // Filter out empty strings.  Samples from native code don't have
-      // script names associated with them.
-      if (script_name_val->Length() > 0) {
-        o->Set(script_name_sym_, script_name_val);
-      }
+    // The hit count is frequently zero, meaning the function was in the
+    // call tree on the stack somewhere but not actually sampled by the
+    // profiler.  A zero hit count implies that this node is not a leaf
+    // node, the actual sample is in one of its descendants.
+    const unsigned int hit_count = node->GetHitCount();
+    if (hit_count > 0) {
+      Local<Integer> hit_count_val =
+          Integer::NewFromUnsigned(isolate_, hit_count);
+      if (hit_count_val.IsEmpty()) return Local<Object>();
+      o->Set(hit_count_sym_, hit_count_val);
+    }
 
-      Handle<String> function_name_val = node->GetFunctionName();
-      if (function_name_val.IsEmpty()) return Local<Object>();
-      // Filter out anonymous function names, they are plentiful in most code
-      // but uninteresting and we can save quite a bit of bandwidth this way.
-      // The string comparison is done in a somewhat roundabout way for
-      // performance reasons; writing out the string like this is a little
-      // faster than using Equals() or String::AsciiValue.
-      static const uint8_t anonymous_function[] = "(anonymous function)";
-      uint8_t write_buffer[sizeof(anonymous_function) - 1] = { 0 };
-      const bool check = function_name_val->Length() == sizeof(write_buffer);
-      if (check) {
-        function_name_val->WriteOneByte(write_buffer,
-                                        0,
-                                        sizeof(write_buffer),
-                                        String::NO_NULL_TERMINATION);
-      }
-      if (check == false ||
-          memcmp(anonymous_function, write_buffer, sizeof(write_buffer)) != 0) {
-        o->Set(function_name_sym_, function_name_val);
-      }
+    // TODO(bnoordhuis) There is only a limited number of bailout reasons.
+    // Collect them in a tree-like structure that caches the String handles.
+    const char* const bailout_reason = node->GetBailoutReason();
+    if (bailout_reason != NULL &&
+        bailout_reason[0] != '\0' &&
+        ::strcmp(bailout_reason, "no reason") != 0) {
+      const uint8_t* const bytes =
+          reinterpret_cast<const uint8_t*>(bailout_reason);
+      Local<String> bailout_reason_val =
+          String::NewFromOneByte(isolate_, bytes);
+      if (bailout_reason_val.IsEmpty()) return Local<Object>();
+      o->Set(bailout_reason_sym_, bailout_reason_val);
+    }
 
-      // The hit count is frequently zero, meaning the function was in the
-      // call tree on the stack somewhere but not actually sampled by the
-      // profiler.  A zero hit count implies that this node is not a leaf
-      // node, the actual sample is in one of its descendants.
-      const unsigned int hit_count = node->GetHitCount();
-      if (hit_count > 0) {
-        Local<Integer> hit_count_val =
-            Integer::NewFromUnsigned(isolate_, hit_count);
-        if (hit_count_val.IsEmpty()) return Local<Object>();
-        o->Set(hit_count_sym_, hit_count_val);
-      }
+    // Note: Line and column numbers start at 1.  Skip setting the property
+    // when there is no line or column number information available for this
+    // function, saves bandwidth when sending the profile data over the
+    // network.
+    const int line_number = node->GetLineNumber();
+    if (line_number != CpuProfileNode::kNoLineNumberInfo) {
+      Local<Integer> line_number_val = Integer::New(isolate_, line_number);
+      if (line_number_val.IsEmpty()) return Local<Object>();
+      o->Set(line_number_sym_, line_number_val);
+    }
 
-      // TODO(bnoordhuis) There is only a limited number of bailout reasons.
-      // Collect them in a tree-like structure that caches the String handles.
-      const char* const bailout_reason = node->GetBailoutReason();
-      if (bailout_reason != NULL &&
-          bailout_reason[0] != '\0' &&
-          ::strcmp(bailout_reason, "no reason") != 0) {
-        const uint8_t* const bytes =
-            reinterpret_cast<const uint8_t*>(bailout_reason);
-        Local<String> bailout_reason_val =
-            String::NewFromOneByte(isolate_, bytes);
-        if (bailout_reason_val.IsEmpty()) return Local<Object>();
-        o->Set(bailout_reason_sym_, bailout_reason_val);
-      }
+    const int column_number = node->GetColumnNumber();
+    if (column_number != CpuProfileNode::kNoColumnNumberInfo) {
+      Local<Integer> column_number_val =
+          Integer::New(isolate_, column_number);
+      if (column_number_val.IsEmpty()) return Local<Object>();
+      o->Set(column_number_sym_, column_number_val);
+    }
 
-      // Note: Line and column numbers start at 1.  Skip setting the property
-      // when there is no line or column number information available for this
-      // function, saves bandwidth when sending the profile data over the
-      // network.
-      const int line_number = node->GetLineNumber();
-      if (line_number != CpuProfileNode::kNoLineNumberInfo) {
-        Local<Integer> line_number_val = Integer::New(isolate_, line_number);
-        if (line_number_val.IsEmpty()) return Local<Object>();
-        o->Set(line_number_sym_, line_number_val);
-      }
+    // Don't create the "children" property for leaf nodes, saves memory
+    // and bandwidth.
+    const int children_count = node->GetChildrenCount();
+    if (children_count > 0) {
+      *children = Array::New(isolate_, children_count);
+      if (children->IsEmpty()) return Local<Object>();
+      o->Set(children_sym_, *children);
+    }
 
-      const int column_number = node->GetColumnNumber();
-      if (column_number != CpuProfileNode::kNoColumnNumberInfo) {
-        Local<Integer> column_number_val =
-            Integer::New(isolate_, column_number);
-        if (column_number_val.IsEmpty()) return Local<Object>();
-        o->Set(column_number_sym_, column_number_val);
-      }
+    return o;
+  }
 
-      // Don't create the "children" property for leaf nodes, saves memory
-      // and bandwidth.
-      const int children_count = node->GetChildrenCount();
-      if (children_count > 0) {
-        Local<Array> children = Array::New(isolate_, children_count);
-        if (children.IsEmpty()) return Local<Object>();
-        for (int index = 0; index < children_count; ++index) {
-          Local<Object> child = this->ToObject(node->GetChild(index));
-          if (child.IsEmpty()) return Local<Object>();
-          children->Set(index, child);
-        }
-        o->Set(children_sym_, children);
+  Local<Object> ToObject(const CpuProfileNode* node) const {
+    EscapableHandleScope handle_scope(isolate_);
+    Local<Array> children;
+    Local<Object> o = NewNode(node, &children);
+    if (o.IsEmpty()) return Local<Object>();
+    if (children.IsEmpty() == false) {
+      for (int index = 0; index < node->GetChildrenCount(); ++index) {
+        Local<Object> child = this->ToObject(node->GetChild(index));
+        if (child.IsEmpty()) return Local<Object>();
+        children->Set(index, child);
       }
-
-      return handle_scope.Escape(o);
     }
+    return handle_scope.Escape(o);
+  }
 
-    Isolate* isolate_;
-    Local<String> bailout_reason_sym_;
-    Local<String> children_sym_;
-    Local<String> column_number_sym_;
-    Local<String> function_name_sym_;
-    Local<String> hit_count_sym_;
-    Local<String> line_number_sym_;
-    Local<String> script_name_sym_;
-  };
+  Isolate* isolate_;
+  Local<String> bailout_reason_sym_;
+  Local<String> children_sym_;
+  Local<String> column_number_sym_;
+  Local<String> function_name_sym_;
+  Local<String> hit_count_sym_;
+  Local<String> line_number_sym_;
+  Local<String> script_name_sym_;
+};
 
+// Call with a valid HandleScope.
+Local<Object> ToObject(Isolate* isolate, const CpuProfileNode* node) {
   EscapableHandleScope handle_scope(isolate);
   ToObjectHelper helper(isolate);
   if (helper.IsConstructed() == false) {
@@ -173,25 +191,331 @@ Local<Object> ToObject(Isolate* isolate, const CpuProfileNode* node) {
   return handle_scope.Escape(helper.ToObject(node));
 }
 
+// The baseline for stopCpuProfiling({ format: 'diff' }).
+ProfileWindow* baseline_profile;
+
+// startCpuProfiling([options])
+//
+// Pass { title: 'name' } to run more than one profile at a time and
+// { samplingInterval: us } to sample more or less often than V8's default.
+// The interval only takes effect when no other profile is running.  Pass
+// { samples: true } to record the samples for a timeline, see
+// SampleTimeline.
 void StartCpuProfiling(const FunctionCallbackInfo<Value>& args) {
   Isolate* isolate = args.GetIsolate();
   HandleScope handle_scope(isolate);
-  isolate->GetCpuProfiler()->StartCpuProfiling(String::Empty(isolate));
+  Options options;
+  ParseOptions(isolate, args[0], &options);
+  CpuProfiler* profiler = isolate->GetCpuProfiler();
+  if (options.sampling_interval > 0) {
+    profiler->SetSamplingInterval(options.sampling_interval);
+  }
+  profiler->StartCpuProfiling(
+      options.title.IsEmpty() ? String::Empty(isolate) : options.title,
+      options.samples);
+}
+
+// Converts |profile| to the format that |options| asks for and deletes it.
+Local<Value> ProfileToValue(Isolate* isolate,
+                            const Options& options,
+                            const CpuProfile* profile) {
+  EscapableHandleScope handle_scope(isolate);
+  if (options.format == kBaselineFormat || options.format == kDiffFormat) {
+    const double now = WallClockTime();
+    ProfileWindow* window =
+        ReduceProfile(isolate, profile, now, now, static_cast<size_t>(-1));
+    const_cast<CpuProfile*>(profile)->Delete();
+    if (options.format == kBaselineFormat) {
+      delete baseline_profile;
+      baseline_profile = window;
+      return handle_scope.Escape(
+          Integer::NewFromUnsigned(isolate, window->samples()));
+    }
+    if (baseline_profile == NULL) {
+      delete window;
+      return handle_scope.Escape(Null(isolate));
+    }
+    ProfileDiff diff;
+    diff.Build(*baseline_profile, *window);
+    delete window;
+    return handle_scope.Escape(diff.ToObject(isolate, options.top));
+  }
+  if (options.format == kFoldedFormat) {
+    FoldedStacks folded(options.collapse);
+    folded.Build(isolate, profile->GetTopDownRoot());
+    const_cast<CpuProfile*>(profile)->Delete();
+    return handle_scope.Escape(folded.ToString(isolate));
+  }
+  if (options.format == kFlatFormat || options.format == kTopFormat) {
+    FlatProfile flat;
+    flat.Build(isolate, profile->GetTopDownRoot());
+    SampleTimeline timeline;
+    if (options.format == kFlatFormat && options.samples) {
+      timeline.Build(profile, flat);
+    }
+    const_cast<CpuProfile*>(profile)->Delete();
+    if (options.format == kFlatFormat) {
+      Local<Object> result = flat.ToObject(isolate);
+      if (options.samples) {
+        result->Set(FixedString(isolate, "timeline"),
+                    timeline.ToObject(isolate));
+      }
+      return handle_scope.Escape(result);
+    }
+    BottomUpProfile bottom_up;
+    bottom_up.Build(flat, options.callers > 0);
+    return handle_scope.Escape(bottom_up.ToObject(isolate, flat, options));
+  }
+  Local<Object> top_root = ToObject(isolate, profile->GetTopDownRoot());
+  // See https://code.google.com/p/v8/issues/detail?id=3213.
+  const_cast<CpuProfile*>(profile)->Delete();
+  return handle_scope.Escape(top_root);
+}
+
+// Converts a profile to nested objects a slice at a time, on idle
+// callbacks.  Children are attached through |children|, which holds the
+// children array of every node converted so far, by node number.  The
+// other formats are converted in one go, the job only defers the callback.
+struct SerializeJob {
+  uv_idle_t idle_handle;
+  Isolate* isolate;
+  const CpuProfile* profile;  // NULL once deleted.
+  uint64_t slice_time;  // Nanoseconds.
+  // Node, number of the parent node and index into the parent's children.
+  std::vector<std::pair<const CpuProfileNode*, std::pair<uint32_t, int> > >
+      stack;
+  uint32_t count;  // Nodes converted.
+  Persistent<Array> children;
+  Persistent<Value> result;
+  Persistent<Function> callback;
+};
+
+void SerializeClose(uv_handle_t* handle) {
+  delete static_cast<SerializeJob*>(handle->data);
+}
+
+// Converts nodes until the stack is empty or the slice is used up.
+// Returns false when it runs out of memory.
+bool SerializeSlice(SerializeJob* job) {
+  Isolate* isolate = job->isolate;
+  ToObjectHelper helper(isolate);
+  if (helper.IsConstructed() == false) {
+    return false;
+  }
+  Local<Array> all_children = Local<Array>::New(isolate, job->children);
+  const uint64_t deadline = uv_hrtime() + job->slice_time;
+  do {
+    // Check the clock every so many nodes, uv_hrtime() isn't free.
+    HandleScope handle_scope(isolate);
+    for (int n = 0; n < 64 && job->stack.empty() == false; n += 1) {
+      const CpuProfileNode* node = job->stack.back().first;
+      const uint32_t parent = job->stack.back().second.first;
+      const int index = job->stack.back().second.second;
+      job->stack.pop_back();
+      Local<Array> children;
+      Local<Object> o = helper.NewNode(node, &children);
+      if (o.IsEmpty()) {
+        return false;
+      }
+      const uint32_t number = job->count;
+      job->count += 1;
+      if (number == 0) {
+        job->result.Reset(isolate, o);
+      } else {
+        all_children->Get(parent).As<Array>()->Set(index, o);
+      }
+      if (children.IsEmpty()) {
+        continue;
+      }
+      all_children->Set(number, children);
+      for (int child = node->GetChildrenCount(); child > 0; child -= 1) {
+        job->stack.push_back(std::make_pair(
+            node->GetChild(child - 1), std::make_pair(number, child - 1)));
+      }
+    }
+  } while (job->stack.empty() == false && uv_hrtime() < deadline);
+  return true;
+}
+
+void SerializeIdle(uv_idle_t* handle, int) {
+  SerializeJob* job = static_cast<SerializeJob*>(handle->data);
+  Isolate* isolate = job->isolate;
+  HandleScope handle_scope(isolate);
+  if (SerializeSlice(job) == false) {
+    job->stack.clear();  // Out of memory, the result is undefined.
+    job->result.Reset();
+  }
+  if (job->stack.empty() == false) {
+    return;  // More next time.
+  }
+  if (job->profile != NULL) {
+    // See https://code.google.com/p/v8/issues/detail?id=3213.
+    const_cast<CpuProfile*>(job->profile)->Delete();
+    job->profile = NULL;
+  }
+  Local<Value> argv[] = { Local<Value>::New(isolate, job->result) };
+  if (argv[0].IsEmpty()) {
+    argv[0] = v8::Undefined(isolate);
+  }
+  Local<Function> callback = Local<Function>::New(isolate, job->callback);
+  job->callback.Reset();
+  job->children.Reset();
+  job->result.Reset();
+  uv_idle_stop(&job->idle_handle);
+  uv_close(reinterpret_cast<uv_handle_t*>(&job->idle_handle), SerializeClose);
+  callback->Call(isolate->GetCurrentContext()->Global(),
+                 SL_ARRAY_SIZE(argv),
+                 argv);
 }
 
+// stopCpuProfiling([options], [callback])
+//
+// Returns the top-down call tree as nested objects, see ToObject().  Pass
+// { format: 'flat' } to get a node table instead, see FlatProfile, or
+// { format: 'top', top: n, callers: m } to get the hottest functions only,
+// see BottomUpProfile.  Pass the { title } that was passed to
+// startCpuProfiling(), if any.  With { format: 'flat', samples: true }, the
+// node table gets a |timeline| property, see SampleTimeline.  Pass
+// { format: 'folded', collapse: 'script' or 'package' } to get the folded
+// stacks for flamegraph tools as a string, see FoldedStacks.
+//
+// { format: 'baseline' } keeps the profile's hits per function as the
+// baseline for later comparisons and returns the number of samples.
+// { format: 'diff', top: n } then compares against it, see ProfileDiff.
+// Returns null if there is no baseline.
+//
+// With a callback, the profiler is stopped right away but the tree is
+// converted in slices of at most |options.sliceTime| milliseconds, one per
+// event loop iteration, and passed to the callback when it's done.  Big
+// profiles take hundreds of milliseconds to convert, that shouldn't
+// happen in one go.  Only the tree format is sliced; the other formats are
+// converted synchronously and the callback just gets the result later.
 void StopCpuProfiling(const FunctionCallbackInfo<Value>& args) {
   Isolate* isolate = args.GetIsolate();
   HandleScope handle_scope(isolate);
+  Local<Value> options_arg = args[0];
+  Local<Value> callback_arg = args[1];
+  if (options_arg->IsFunction()) {
+    callback_arg = options_arg;
+    options_arg = v8::Undefined(isolate);
+  }
+  Options options;
+  ParseOptions(isolate, options_arg, &options);
   CpuProfiler* profiler = isolate->GetCpuProfiler();
-  const CpuProfile* profile =
-      profiler->StopCpuProfiling(String::Empty(isolate));
-  if (profile == NULL) {
-    return;  // Not started or preempted by another profiler.
+  const CpuProfile* profile = profiler->StopCpuProfiling(
+      options.title.IsEmpty() ? String::Empty(isolate) : options.title);
+  if (callback_arg->IsFunction() == false) {
+    if (profile == NULL) {
+      return;  // Not started or preempted by another profiler.
+    }
+    args.GetReturnValue().Set(ProfileToValue(isolate, options, profile));
+    return;
   }
-  Local<Object> top_root = ToObject(isolate, profile->GetTopDownRoot());
-  // See https://code.google.com/p/v8/issues/detail?id=3213.
-  const_cast<CpuProfile*>(profile)->Delete();
-  args.GetReturnValue().Set(top_root);
+  SerializeJob* job = new SerializeJob;
+  job->isolate = isolate;
+  job->profile = NULL;
+  job->slice_time = options.slice_time * static_cast<uint64_t>(1e6);
+  job->count = 0;
+  job->children.Reset(isolate, Array::New(isolate));
+  job->callback.Reset(isolate, callback_arg.As<Function>());
+  if (profile != NULL && options.format == kTreeFormat) {
+    job->profile = profile;
+    job->stack.push_back(std::make_pair(profile->GetTopDownRoot(),
+                                        std::make_pair(0u, 0)));
+  } else if (profile != NULL) {
+    job->result.Reset(isolate, ProfileToValue(isolate, options, profile));
+  }
+  job->idle_handle.data = job;
+  uv_idle_init(uv_default_loop(), &job->idle_handle);
+  uv_idle_start(&job->idle_handle, SerializeIdle);
+}
+
+RollingProfiler* rolling_profiler;
+
+// startRollingProfiler([options])
+//
+// Starts a RollingProfiler.  Options are { window: ms, windows: n, top: n,
+// samplingInterval: us, maxBytes: n }, see RollingOptions for the defaults.
+void StartRollingProfiler(const FunctionCallbackInfo<Value>& args) {
+  if (rolling_profiler != NULL) {
+    return;
+  }
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  RollingOptions options;
+  ParseRollingOptions(isolate, args[0], &options);
+  rolling_profiler = new RollingProfiler(isolate, options);
+  rolling_profiler->Start();
+}
+
+// pollRollingProfiler([rotate])
+//
+// Returns the windows that have been collected so far, oldest first.  Pass
+// true to end the current window first, so it's included.
+void PollRollingProfiler(const FunctionCallbackInfo<Value>& args) {
+  if (rolling_profiler == NULL) {
+    return;
+  }
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  if (args[0]->BooleanValue()) {
+    rolling_profiler->Rotate();
+  }
+  args.GetReturnValue().Set(rolling_profiler->ToArray(isolate));
+}
+
+// stopRollingProfiler()
+//
+// Stops the rolling profiler and returns its windows, the current window
+// is discarded.
+void StopRollingProfiler(const FunctionCallbackInfo<Value>& args) {
+  if (rolling_profiler == NULL) {
+    return;
+  }
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  args.GetReturnValue().Set(rolling_profiler->ToArray(isolate));
+  rolling_profiler->Dispose();
+  rolling_profiler = NULL;
+}
+
+// Armed by armStallProfiler(), fed by uvmon::OnCheck().
+StallProfiler* stall_profiler;
+
+// armStallProfiler([options])
+//
+// Options are { threshold: ms, count: n, within: ms, duration: ms,
+// cooldown: ms, top: n, keep: n }, see StallOptions for the defaults.
+void ArmStallProfiler(const FunctionCallbackInfo<Value>& args) {
+  if (stall_profiler != NULL) {
+    return;
+  }
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  StallOptions options;
+  ParseStallOptions(isolate, args[0], &options);
+  stall_profiler = new StallProfiler(isolate, options);
+}
+
+// takeStallProfiles()
+//
+// Returns the profiles taken since the last call, see ProfileWindow.
+void TakeStallProfiles(const FunctionCallbackInfo<Value>& args) {
+  if (stall_profiler == NULL) {
+    return;
+  }
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  args.GetReturnValue().Set(stall_profiler->Take(isolate));
+}
+
+void DisarmStallProfiler(const FunctionCallbackInfo<Value>& args) {
+  if (stall_profiler == NULL) {
+    return;
+  }
+  HandleScope handle_scope(args.GetIsolate());
+  stall_profiler->Dispose();
+  stall_profiler = NULL;
 }
 
 void Initialize(Isolate* isolate, Handle<Object> o) {
@@ -199,6 +523,18 @@ void Initialize(Isolate* isolate, Handle<Object> o) {
          FunctionTemplate::New(isolate, StartCpuProfiling)->GetFunction());
   o->Set(FixedString(isolate, "stopCpuProfiling"),
          FunctionTemplate::New(isolate, StopCpuProfiling)->GetFunction());
+  o->Set(FixedString(isolate, "startRollingProfiler"),
+         FunctionTemplate::New(isolate, StartRollingProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "pollRollingProfiler"),
+         FunctionTemplate::New(isolate, PollRollingProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "stopRollingProfiler"),
+         FunctionTemplate::New(isolate, StopRollingProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "armStallProfiler"),
+         FunctionTemplate::New(isolate, ArmStallProfiler)->GetFunction());
+  o->Set(FixedString(isolate, "takeStallProfiles"),
+         FunctionTemplate::New(isolate, TakeStallProfiles)->GetFunction());
+  o->Set(FixedString(isolate, "disarmStallProfiler"),
+         FunctionTemplate::New(isolate, DisarmStallProfiler)->GetFunction());
 }
 
 }  // namespace profiler
@@ -0,0 +1,457 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_PROFILER_H_
+#define AGENT_SRC_PROFILER_H_
+
+#include "strong-agent.h"
+#include "util.h"
+#include "v8-profiler.h"
+#include "v8.h"
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+namespace strongloop {
+namespace agent {
+namespace profiler {
+
+enum Format {
+  kTreeFormat,  // An object per node, see ToObject().
+  kFlatFormat,  // See FlatProfile.
+  kTopFormat,  // See BottomUpProfile.
+  kFoldedFormat,  // See FoldedStacks.
+  kBaselineFormat,  // Keep the profile as the baseline for kDiffFormat.
+  kDiffFormat  // See ProfileDiff.
+};
+
+enum Collapse {
+  kCollapseNone,  // A frame per function.
+  kCollapseScript,  // A frame per script.
+  kCollapsePackage  // A frame per npm package.
+};
+
+struct Options {
+  Options();
+  // Profile title, empty if not set.  Profiles with different titles can
+  // run at the same time.
+  v8::Local<v8::String> title;
+  // Sampling interval in microseconds, zero for V8's default.  Only used by
+  // startCpuProfiling(), V8 3.14 ignores it.
+  uint32_t sampling_interval;
+  // Record the order and time of the samples, see SampleTimeline.  Has to
+  // be passed to both startCpuProfiling() and stopCpuProfiling().
+  bool samples;
+  Format format;
+  // Number of functions to report in the top format, and the number of
+  // callers to report per function.
+  uint32_t top;
+  uint32_t callers;
+  Collapse collapse;  // For the folded format.
+  // Milliseconds per slice when stopCpuProfiling() converts the profile
+  // asynchronously.
+  uint32_t slice_time;
+};
+
+void ParseOptions(v8::Isolate* isolate,
+                  v8::Handle<v8::Value> value,
+                  Options* options);
+
+class ProfileDiff;
+class ProfileWindow;
+
+// Flattens the top-down call tree of a CPU profile into a node table with
+// one row per node.  Nodes are numbered in depth-first order, starting with
+// the root at zero, so a node's parent always comes before it.  Function
+// names, script names and bailout reasons are interned, a function that
+// shows up in thousands of nodes is stored once.
+//
+// The tree format creates an object with up to seven properties and a
+// children array per node; big profiles can run the process out of memory
+// while they're being converted.  The flat format creates a fixed number of
+// objects, no matter how big the profile is.
+class FlatProfile {
+ public:
+  enum Column {
+    kParent,  // Index of the parent node, -1 for the root.
+    kFunction,  // Index into the function name table.
+    kScript,  // Index into the script name table.
+    kLine,  // Line number, 0 if unknown.
+    kColumn,  // Column number, 0 if unknown.  Always 0 on v0.10.
+    kHits,  // Number of samples in which the node was on top of the stack.
+    kBailout,  // Index into the bailout reason table.  Always 0 on v0.10.
+    kColumnCount
+  };
+  FlatProfile();
+  void Build(v8::Isolate* isolate, const v8::CpuProfileNode* root);
+  size_t size() const;
+  int32_t Get(Column column, size_t index) const;
+  // The profile node of row |index|.  Only valid until the profile is
+  // deleted.
+  const v8::CpuProfileNode* node(size_t index) const;
+  const StringTable& functions() const;
+  const StringTable& scripts() const;
+  // Returns an object that looks like this:
+  //
+  //  { parent: Int32Array, function: Int32Array, script: Int32Array,
+  //    line: Int32Array, column: Int32Array, hits: Int32Array,
+  //    bailout: Int32Array, functions: [ '(root)', 'main', ... ],
+  //    scripts: [ '', '/app/server.js', ... ], bailouts: [ '', ... ] }
+  //
+  // All typed arrays share one ArrayBuffer.  Index 0 of the bailout table
+  // is the empty string, nodes without a bailout reason point there.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate) const;
+ private:
+  std::vector<int32_t> columns_[kColumnCount];
+  std::vector<const v8::CpuProfileNode*> nodes_;
+  StringTable functions_;
+  StringTable scripts_;
+  StringTable bailouts_;
+  // Forbid copy and assigment.
+  FlatProfile(const FlatProfile&);
+  void operator=(const FlatProfile&);
+};
+
+// The samples of a CPU profile in the order they were taken, as indices
+// into the node table of a FlatProfile.  The aggregated tree says where the
+// time went, the timeline says when.  Lined up with the event loop
+// statistics or with the start and end of a slow request, it shows what
+// the process was doing at that moment.
+//
+// Timestamps are delta-encoded: each one is stored as the number of
+// microseconds since the previous sample, which fits easily in 32 bits.
+// Only V8 3.26 and up record samples, the timeline is always empty on v0.10.
+class SampleTimeline {
+ public:
+  SampleTimeline();
+  // Call before the profile is deleted, |flat| has to be built from it.
+  void Build(const v8::CpuProfile* profile, const FlatProfile& flat);
+  // Returns { startTime, nodes: Int32Array, timeDeltas: Int32Array }.
+  // |startTime| is in milliseconds since the epoch, the first delta is
+  // relative to it.  Both typed arrays share one ArrayBuffer.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate) const;
+ private:
+  double start_time_;
+  std::vector<int32_t> nodes_;
+  std::vector<int32_t> deltas_;
+  // Forbid copy and assigment.
+  SampleTimeline(const SampleTimeline&);
+  void operator=(const SampleTimeline&);
+};
+
+// Folded stacks, the input format of flamegraph tools: one line per
+// distinct stack with the frames separated by semicolons, followed by the
+// number of samples.
+//
+//  (program) 120
+//  main (/app/server.js:10);parse (/app/lib/parser.js:42) 300
+//
+// The tree is walked once and the text is written straight from the
+// profile nodes, no JS objects are created.  Frame labels are interned and
+// stacks are stored as frame indices until the text is written.  With
+// kCollapseScript or kCollapsePackage, frames are labeled with their
+// script or package name instead, consecutive frames with the same label
+// are merged and so are stacks that end up the same.  Code outside
+// node_modules is labeled (app), node's own code (node).
+class FoldedStacks {
+ public:
+  explicit FoldedStacks(Collapse collapse);
+  void Build(v8::Isolate* isolate, const v8::CpuProfileNode* root);
+  // Returns the stacks in order of first appearance, one per line.
+  v8::Local<v8::String> ToString(v8::Isolate* isolate) const;
+ private:
+  uint32_t Frame(const v8::CpuProfileNode* node);
+  const Collapse collapse_;
+  StringTable frames_;  // Frame labels.
+  StringTable stacks_;  // Frame indices, two code units per frame.
+  std::vector<uint32_t> hits_;  // Per stack.
+  std::vector<uint16_t> scratch_;
+  // Forbid copy and assigment.
+  FoldedStacks(const FoldedStacks&);
+  void operator=(const FoldedStacks&);
+};
+
+// Bottom-up view of a FlatProfile: nodes are merged by function, script and
+// line.  A function's self hits are the samples in which it was on top of
+// the stack, its total hits the samples in which it was anywhere on the
+// stack.  Recursive calls are counted once per sample, not once per frame.
+// Optionally, the total hits are broken down by immediate caller.
+class BottomUpProfile {
+ public:
+  BottomUpProfile();
+  void Build(const FlatProfile& flat, bool callers);
+  // Returns an object with the |options.top| functions with the most self
+  // hits and the most total hits:
+  //
+  //  { samples: 1200,
+  //    self: [ { functionName: 'parse', scriptName: '/app/lib/parser.js',
+  //              lineNumber: 42, selfHits: 300, totalHits: 340,
+  //              callers: [ { functionName: 'onData', ..., hits: 280 } ] } ],
+  //    total: [ ... ] }
+  //
+  // |callers| lists up to |options.callers| callers, most hits first, and is
+  // only present when Build() was asked to collect them.  Functions that
+  // rank in both lists are the same object.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate,
+                                 const FlatProfile& flat,
+                                 const Options& options) const;
+  // Copies the |limit| functions with the most self hits and the |limit|
+  // functions with the most total hits to |window|.
+  void CopyTop(const FlatProfile& flat,
+               size_t limit,
+               ProfileWindow* window) const;
+  uint32_t samples() const;
+ private:
+  struct Entry {
+    uint32_t node;  // The first node of the function, for its name.
+    uint32_t self;
+    uint32_t total;
+  };
+  struct Call {
+    uint32_t callee;  // Entry indices.
+    uint32_t caller;
+    uint32_t hits;
+  };
+  void TopEntries(size_t limit, bool self, std::vector<uint32_t>* out) const;
+  v8::Local<v8::Object> EntryToObject(v8::Isolate* isolate,
+                                      const FlatProfile& flat,
+                                      uint32_t entry,
+                                      size_t callers) const;
+  void SetLocation(v8::Isolate* isolate,
+                   const FlatProfile& flat,
+                   uint32_t node,
+                   v8::Local<v8::Object> object) const;
+  std::vector<uint32_t> keys_;  // Entry index per node.
+  std::vector<Entry> entries_;
+  std::vector<Call> calls_;  // Ordered by callee, then by hits.
+  std::vector<uint32_t> first_call_;  // Per entry, index into |calls_|.
+  uint32_t samples_;
+  // Forbid copy and assigment.
+  BottomUpProfile(const BottomUpProfile&);
+  void operator=(const BottomUpProfile&);
+};
+
+// The hottest functions of one window of a rolling profile.  The names are
+// copied, the window doesn't depend on the profile it was made from.
+class ProfileWindow {
+ public:
+  ProfileWindow(double start, double end, uint32_t samples);
+  void Add(const StringTable& functions,
+           uint32_t function,
+           const StringTable& scripts,
+           uint32_t script,
+           int32_t line,
+           uint32_t self,
+           uint32_t total);
+  // Number of bytes the window uses, allocated capacity included.
+  size_t bytes() const;
+  uint32_t samples() const;
+  // Adds the functions to side |side| of |diff|.
+  void AddTo(ProfileDiff* diff, size_t side) const;
+  // Returns { start, end, samples, functions: [ { functionName, scriptName,
+  // lineNumber, selfHits, totalHits } ] }, |start| and |end| in milliseconds
+  // since the epoch.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate) const;
+ private:
+  struct Entry {
+    uint32_t function;  // Index into |names_|.
+    uint32_t script;  // Index into |names_|.
+    int32_t line;
+    uint32_t self;
+    uint32_t total;
+  };
+  const double start_;
+  const double end_;
+  const uint32_t samples_;
+  StringTable names_;
+  std::vector<Entry> entries_;
+  // Forbid copy and assigment.
+  ProfileWindow(const ProfileWindow&);
+  void operator=(const ProfileWindow&);
+};
+
+// Reduces |profile| to the |limit| functions with the most self hits and
+// the |limit| functions with the most total hits.  The caller owns the
+// window, and still owns the profile.
+ProfileWindow* ReduceProfile(v8::Isolate* isolate,
+                             const v8::CpuProfile* profile,
+                             double start,
+                             double end,
+                             size_t limit);
+
+// Compares a profile against a baseline, function by function.  Functions
+// are matched on name, script and line, so they match across restarts and
+// deploys as long as the code doesn't move.  Hits are divided by the
+// number of samples of their profile, profiles of different length compare
+// fine.  Made to spot the functions that got more expensive after a deploy
+// without shipping two full profiles off the box.
+class ProfileDiff {
+ public:
+  enum Side { kBaseline, kCurrent };
+  ProfileDiff();
+  void Build(const ProfileWindow& baseline, const ProfileWindow& current);
+  // Called by ProfileWindow::AddTo().
+  void Add(size_t side,
+           const StringTable& names,
+           uint32_t function,
+           uint32_t script,
+           int32_t line,
+           uint32_t self,
+           uint32_t total);
+  // Returns the |limit| functions whose share of self and total hits grew
+  // the most:
+  //
+  //  { baselineSamples: 5000, samples: 4800,
+  //    self: [ { functionName: 'parse', scriptName: '/app/lib/parser.js',
+  //              lineNumber: 42, selfBefore: 0.05, selfAfter: 0.12,
+  //              selfDelta: 0.07, totalBefore: ..., totalAfter: ...,
+  //              totalDelta: ... } ],
+  //    total: [ ... ] }
+  //
+  // The shares are fractions of the samples.  Functions that got cheaper
+  // or didn't change are left out.  Functions that rank in both lists are
+  // the same object.
+  v8::Local<v8::Object> ToObject(v8::Isolate* isolate, size_t limit) const;
+ private:
+  struct Row {
+    uint32_t function;  // Index into |names_|.
+    uint32_t script;  // Index into |names_|.
+    int32_t line;
+    uint32_t self[2];  // Per side.
+    uint32_t total[2];
+  };
+  double Share(const Row& row, bool self, size_t side) const;
+  void TopRows(size_t limit, bool self, std::vector<uint32_t>* out) const;
+  v8::Local<v8::Object> RowToObject(v8::Isolate* isolate,
+                                    uint32_t index) const;
+  StringTable names_;
+  StringTable keys_;  // Function, script and line of each row.
+  std::vector<Row> rows_;
+  std::vector<uint16_t> key_;
+  uint32_t samples_[2];
+  // Forbid copy and assigment.
+  ProfileDiff(const ProfileDiff&);
+  void operator=(const ProfileDiff&);
+};
+
+struct RollingOptions {
+  RollingOptions();
+  uint32_t window;  // Window length in milliseconds.
+  uint32_t windows;  // Number of windows to keep.
+  uint32_t top;  // Functions to keep per window, see CopyTop().
+  uint32_t sampling_interval;  // Microseconds, zero for V8's default.
+  uint32_t max_bytes;  // Memory cap for the finished windows.
+};
+
+void ParseRollingOptions(v8::Isolate* isolate,
+                         v8::Handle<v8::Value> value,
+                         RollingOptions* options);
+
+// Profiles continuously.  Every |options.window| milliseconds, it starts a
+// new CPU profile, stops the previous one and reduces it to a ProfileWindow.
+// The new profile is started before the old one is stopped, there are no
+// gaps between windows.  It keeps the most recent |options.windows| windows
+// but drops the oldest ones when they use more than |options.max_bytes|.
+// When something goes wrong, the last few minutes of profile data are
+// already there.
+//
+// The cap only covers the finished windows.  The profile of the window in
+// progress lives in V8 until the window ends and grows with the number of
+// distinct stacks that are sampled; a short |options.window| keeps it small.
+//
+// The profiles have their own titles so they don't interfere with profiles
+// from startCpuProfiling().
+class RollingProfiler {
+ public:
+  RollingProfiler(v8::Isolate* isolate, const RollingOptions& options);
+  void Start();
+  // Ends the current window early.
+  void Rotate();
+  // Stops profiling.  The profiler deletes itself once libuv is done with
+  // its timer.
+  void Dispose();
+  // Returns the windows, oldest first.
+  v8::Local<v8::Array> ToArray(v8::Isolate* isolate) const;
+ private:
+  ~RollingProfiler();
+  static void OnTimer(uv_timer_t* handle, int);
+  static void OnClose(uv_handle_t* handle);
+  v8::Local<v8::String> Title(int slot) const;
+  void StartProfile(int slot);
+  const v8::CpuProfile* StopProfile(int slot);
+  v8::Isolate* const isolate_;
+  const RollingOptions options_;
+  uv_timer_t timer_;
+  int current_;  // Title slot of the running profile, 0 or 1.
+  double started_;  // Start of the current window.
+  std::deque<ProfileWindow*> windows_;
+  size_t bytes_;  // Sum of the window sizes.
+  // Forbid copy and assigment.
+  RollingProfiler(const RollingProfiler&);
+  void operator=(const RollingProfiler&);
+};
+
+struct StallOptions {
+  StallOptions();
+  uint32_t threshold;  // Loop delay in milliseconds that counts as a stall.
+  uint32_t count;  // Number of stalls that arm the profiler...
+  uint32_t within;  // ...within this many milliseconds.
+  uint32_t duration;  // Profile length in milliseconds.
+  uint32_t cooldown;  // Milliseconds between the end of a profile and the
+                      // start of the next one.
+  uint32_t top;  // Functions to keep per profile, see CopyTop().
+  uint32_t keep;  // Number of profiles to keep until they're taken.
+};
+
+void ParseStallOptions(v8::Isolate* isolate,
+                       v8::Handle<v8::Value> value,
+                       StallOptions* options);
+
+// Profiles the bad moments only.  uvmon reports the delay of every loop
+// iteration.  When |options.count| iterations take longer than
+// |options.threshold| within |options.within| milliseconds, the profiler
+// starts a CPU profile and stops it again |options.duration| milliseconds
+// later.  It doesn't wait for JS timers, which are late when the loop is
+// slow.  The profile is reduced to a ProfileWindow and stashed until the
+// agent collects it.  After a profile, the profiler stays quiet for
+// |options.cooldown| milliseconds so a process that's always slow isn't
+// profiled all the time.
+class StallProfiler {
+ public:
+  StallProfiler(v8::Isolate* isolate, const StallOptions& options);
+  // Called after every loop iteration, |now| in milliseconds from a
+  // monotonic clock.
+  void OnLoopDelay(uint64_t now, uint32_t delay);
+  // Returns the stashed profiles, oldest first, and forgets them.
+  v8::Local<v8::Array> Take(v8::Isolate* isolate);
+  // Stops a running profile without keeping it.  The profiler deletes
+  // itself once libuv is done with its timer.
+  void Dispose();
+ private:
+  ~StallProfiler();
+  static void OnTimer(uv_timer_t* handle, int);
+  static void OnClose(uv_handle_t* handle);
+  v8::Local<v8::String> Title() const;
+  void StartProfile(uint64_t now);
+  const v8::CpuProfile* StopProfile();
+  v8::Isolate* const isolate_;
+  const StallOptions options_;
+  uv_timer_t timer_;
+  std::deque<uint64_t> stalls_;  // Times of recent stalls.
+  bool profiling_;
+  double started_;  // Wall clock time of the running profile's start.
+  uint64_t quiet_until_;  // End of the cooldown, monotonic.
+  std::deque<ProfileWindow*> profiles_;
+  // Forbid copy and assigment.
+  StallProfiler(const StallProfiler&);
+  void operator=(const StallProfiler&);
+};
+
+}  // namespace profiler
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_PROFILER_H_
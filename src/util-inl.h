@@ -0,0 +1,274 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_UTIL_INL_H_
+#define AGENT_SRC_UTIL_INL_H_
+
+#include "strong-agent.h"
+#include "util.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <sys/timeb.h>
+#else
+#include <sys/time.h>
+#endif
+
+namespace strongloop {
+namespace agent {
+
+double WallClockTime() {
+#ifdef _WIN32
+  struct _timeb now;
+  ::_ftime(&now);
+  return 1e3 * now.time + now.millitm;
+#else
+  struct timeval now;
+  ::gettimeofday(&now, NULL);
+  return 1e3 * now.tv_sec + 1e-3 * now.tv_usec;
+#endif
+}
+
+uint32_t HashString(const uint16_t* data, size_t size) {
+  // Multiply-rotate hash in the style of Firefox's FxHash.  It's not of
+  // cryptographic quality but it doesn't have to be, and it's fast.
+  const uint64_t k = 0x517CC1B727220A95ULL;
+  uint64_t hash = size;
+  uint64_t word;
+  for (; size >= 4; data += 4, size -= 4) {
+    ::memcpy(&word, data, sizeof(word));  // Can be unaligned.
+    hash = ((hash << 5 | hash >> 59) ^ word) * k;
+  }
+  word = 0;
+  ::memcpy(&word, data, size * sizeof(*data));
+  hash = ((hash << 5 | hash >> 59) ^ word) * k;
+  return static_cast<uint32_t>(hash >> 32 ^ hash);
+}
+
+StringTable::StringTable() : slots_(256) {
+}
+
+uint32_t StringTable::Intern(v8::Handle<v8::String> string) {
+  // The choice for String::Write() is intentional.  String::WriteAscii() and
+  // particularly String::WriteUtf8() are tremendously slow in comparison.
+  //
+  // HINT_MANY_WRITES_EXPECTED flattens cons strings before writing on the
+  // assumption that we'll be processing the same cons strings repeatedly.
+  // Seems like a reasonable assumption to make because there will normally
+  // be many objects with the same class name.  Class names are usually flat
+  // strings to start with so it might be a wash but the hint is unlikely to
+  // hurt.
+  const int options =
+      v8::String::HINT_MANY_WRITES_EXPECTED | v8::String::NO_NULL_TERMINATION;
+  const int length = string->Length();
+  if (static_cast<size_t>(length) > scratch_.size()) {
+    scratch_.resize(length);
+  }
+  if (length > 0) {
+    string->Write(&scratch_[0], 0, length, options);
+  }
+  return Intern(length > 0 ? &scratch_[0] : NULL, length);
+}
+
+uint32_t StringTable::Intern(const uint16_t* data, size_t size) {
+  const uint32_t hash = HashString(data, size);
+  const size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    const uint32_t index = slots_[slot];
+    if (index == 0) {
+      Entry entry;
+      entry.offset = pool_.size();
+      entry.size = static_cast<uint32_t>(size);
+      entry.hash = hash;
+      pool_.insert(pool_.end(), data, data + size);
+      entries_.push_back(entry);
+      slots_[slot] = static_cast<uint32_t>(entries_.size());
+      if (entries_.size() > slots_.size() / 2) {
+        Grow();
+      }
+      return static_cast<uint32_t>(entries_.size() - 1);
+    }
+    const Entry& entry = entries_[index - 1];
+    if (entry.hash == hash &&
+        entry.size == size &&
+        (size == 0 ||
+         ::memcmp(&pool_[entry.offset], data, size * sizeof(*data)) == 0)) {
+      return index - 1;
+    }
+  }
+}
+
+v8::Local<v8::String> StringTable::Get(v8::Isolate* isolate,
+                                       uint32_t index) const {
+  const size_t length = size(index);
+#if SL_NODE_VERSION == 12
+  if (length == 0) {
+    return v8::String::Empty(isolate);
+  }
+  return v8::String::NewFromTwoByte(isolate,
+                                    data(index),
+                                    v8::String::kNormalString,
+                                    length);
+#elif SL_NODE_VERSION == 10
+  Use(isolate);
+  if (length == 0) {
+    return v8::String::Empty();
+  }
+  return v8::String::New(data(index), length);
+#endif
+}
+
+uint32_t StringTable::InternAscii(const char* data) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  const size_t length = ::strlen(data);
+  scratch_.assign(bytes, bytes + length);
+  return Intern(length > 0 ? &scratch_[0] : NULL, length);
+}
+
+v8::Local<v8::Array> StringTable::ToArray(v8::Isolate* isolate) const {
+  const uint32_t count = static_cast<uint32_t>(size());
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::Array> array = v8::Array::New(isolate, count);
+#elif SL_NODE_VERSION == 10
+  v8::Local<v8::Array> array = v8::Array::New(count);
+#endif
+  for (uint32_t index = 0; index < count; index += 1) {
+    array->Set(index, Get(isolate, index));
+  }
+  return array;
+}
+
+const uint16_t* StringTable::data(uint32_t index) const {
+  const Entry& entry = entries_[index];
+  return entry.size > 0 ? &pool_[entry.offset] : NULL;
+}
+
+size_t StringTable::size(uint32_t index) const {
+  return entries_[index].size;
+}
+
+size_t StringTable::size() const {
+  return entries_.size();
+}
+
+size_t StringTable::bytes() const {
+  return pool_.capacity() * sizeof(pool_[0]) +
+         entries_.capacity() * sizeof(entries_[0]) +
+         slots_.capacity() * sizeof(slots_[0]) +
+         scratch_.capacity() * sizeof(scratch_[0]);
+}
+
+void StringTable::Clear() {
+  pool_.clear();
+  entries_.clear();
+  slots_.assign(256, 0);
+}
+
+void StringTable::Grow() {
+  std::vector<uint32_t> slots(2 * slots_.size());
+  const size_t mask = slots.size() - 1;
+  for (size_t index = 0; index < entries_.size(); index += 1) {
+    size_t slot = entries_[index].hash & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = static_cast<uint32_t>(index + 1);
+  }
+  slots_.swap(slots);
+}
+
+enum ColumnType {
+  kInt32Column,
+  kFloat64Column
+};
+
+void NewColumns(v8::Isolate* isolate,
+                ColumnType type,
+                const void* data,
+                size_t length,
+                size_t columns,
+                v8::Local<v8::Object>* arrays) {
+  const size_t element_size =
+      type == kInt32Column ? sizeof(int32_t) : sizeof(double);
+  const size_t byte_length = length * element_size;
+#if SL_NODE_VERSION == 12
+  v8::Local<v8::ArrayBuffer> buffer =
+      v8::ArrayBuffer::New(isolate, columns * byte_length);
+  for (size_t column = 0; column < columns; column += 1) {
+    if (type == kInt32Column) {
+      arrays[column] =
+          v8::Int32Array::New(buffer, column * byte_length, length);
+    } else {
+      arrays[column] =
+          v8::Float64Array::New(buffer, column * byte_length, length);
+    }
+  }
+#elif SL_NODE_VERSION == 10
+  // V8 3.14 has no typed array API, node implements them.  Call the global
+  // constructors the way JS code would.
+  Use(isolate);
+  v8::Local<v8::Object> global = v8::Context::GetCurrent()->Global();
+  v8::Local<v8::Function> array_buffer =
+      global->Get(FixedString(isolate, "ArrayBuffer")).As<v8::Function>();
+  v8::Local<v8::String> name = type == kInt32Column ?
+      FixedString(isolate, "Int32Array") :
+      FixedString(isolate, "Float64Array");
+  v8::Local<v8::Function> typed_array =
+      global->Get(name).As<v8::Function>();
+  v8::Local<v8::Value> argv[] = {
+    v8::Number::New(static_cast<double>(columns * byte_length)),
+    v8::Local<v8::Value>(),
+    v8::Number::New(static_cast<double>(length)),
+  };
+  argv[0] = array_buffer->NewInstance(1, argv);
+  for (size_t column = 0; column < columns; column += 1) {
+    argv[1] = v8::Number::New(static_cast<double>(column * byte_length));
+    arrays[column] = typed_array->NewInstance(SL_ARRAY_SIZE(argv), argv);
+  }
+#endif
+  for (size_t column = 0; column < columns; column += 1) {
+    if (length == 0) {
+      break;
+    }
+    const char* source = static_cast<const char*>(data) + column * byte_length;
+    void* target = arrays[column]->GetIndexedPropertiesExternalArrayData();
+    if (target != NULL) {
+      memcpy(target, source, byte_length);
+      continue;
+    }
+    // Shouldn't happen, typed arrays are backed by external array data.
+    for (size_t index = 0; index < length; index += 1) {
+      const double value = type == kInt32Column ?
+          reinterpret_cast<const int32_t*>(source)[index] :
+          reinterpret_cast<const double*>(source)[index];
+#if SL_NODE_VERSION == 12
+      arrays[column]->Set(index, v8::Number::New(isolate, value));
+#elif SL_NODE_VERSION == 10
+      arrays[column]->Set(index, v8::Number::New(value));
+#endif
+    }
+  }
+}
+
+void NewInt32Columns(v8::Isolate* isolate,
+                     const int32_t* data,
+                     size_t length,
+                     size_t columns,
+                     v8::Local<v8::Object>* arrays) {
+  NewColumns(isolate, kInt32Column, data, length, columns, arrays);
+}
+
+void NewFloat64Columns(v8::Isolate* isolate,
+                       const double* data,
+                       size_t length,
+                       size_t columns,
+                       v8::Local<v8::Object>* arrays) {
+  NewColumns(isolate, kFloat64Column, data, length, columns, arrays);
+}
+
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_UTIL_INL_H_
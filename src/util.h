@@ -0,0 +1,84 @@
+// Copyright (c) 2014, StrongLoop Inc.
+//
+// This software is covered by the StrongLoop License.  See StrongLoop-LICENSE
+// in the top-level directory or visit http://strongloop.com/license.
+
+#ifndef AGENT_SRC_UTIL_H_
+#define AGENT_SRC_UTIL_H_
+
+#include "v8.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace strongloop {
+namespace agent {
+
+// Milliseconds since the epoch.
+double WallClockTime();
+
+// Hashes a UTF-16 string.  Consumes four code units per round instead of
+// the one byte per round that the Jenkins one-at-a-time hash does.
+uint32_t HashString(const uint16_t* data, size_t size);
+
+// Interns UTF-16 strings.  Every distinct string is copied once into a flat
+// character pool and identified by a small integer, assigned in order of
+// first appearance.  Indices are dense, making them suitable for indexing
+// into plain arrays.  Strings are copied, so they stay valid after the
+// v8::String they were read from is gone.
+class StringTable {
+ public:
+  StringTable();
+  uint32_t Intern(v8::Handle<v8::String> string);
+  uint32_t Intern(const uint16_t* data, size_t size);
+  // For Latin-1 strings from V8's C++ API, like bailout reasons.
+  uint32_t InternAscii(const char* data);
+  v8::Local<v8::String> Get(v8::Isolate* isolate, uint32_t index) const;
+  // Returns all strings as an array, in index order.
+  v8::Local<v8::Array> ToArray(v8::Isolate* isolate) const;
+  const uint16_t* data(uint32_t index) const;
+  size_t size(uint32_t index) const;
+  size_t size() const;
+  // Heap memory in use by the table, allocated capacity included.
+  size_t bytes() const;
+  // Forgets all strings, indices start from zero again.
+  void Clear();
+ private:
+  struct Entry {
+    size_t offset;
+    uint32_t size;
+    uint32_t hash;
+  };
+  void Grow();
+  std::vector<uint16_t> pool_;
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> slots_;  // Index into |entries_| plus one, 0 if free.
+  std::vector<uint16_t> scratch_;
+  // Forbid copy and assigment.
+  StringTable(const StringTable&);
+  void operator=(const StringTable&);
+};
+
+// Copies |columns| columns of |length| elements each from |data| into a
+// single ArrayBuffer and stores an Int32Array view per column in |arrays|.
+// One buffer for all columns means one allocation on the JS heap instead of
+// an object or a number per element.
+void NewInt32Columns(v8::Isolate* isolate,
+                     const int32_t* data,
+                     size_t length,
+                     size_t columns,
+                     v8::Local<v8::Object>* arrays);
+
+// Same as NewInt32Columns() but with Float64Array views, for values that
+// don't fit in 32 bits.
+void NewFloat64Columns(v8::Isolate* isolate,
+                       const double* data,
+                       size_t length,
+                       size_t columns,
+                       v8::Local<v8::Object>* arrays);
+
+}  // namespace agent
+}  // namespace strongloop
+
+#endif  // AGENT_SRC_UTIL_H_
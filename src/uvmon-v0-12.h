@@ -6,6 +6,7 @@
 #ifndef AGENT_SRC_UVMON_V0_12_H_
 #define AGENT_SRC_UVMON_V0_12_H_
 
+#include "profiler-v0-12.h"
 #include "strong-agent.h"
 
 namespace strongloop {
@@ -33,6 +34,9 @@ void OnCheck(uv_check_t* handle, int) {
   }
   ticks += 1;
   sum += delta;
+  if (profiler::stall_profiler != NULL) {
+    profiler::stall_profiler->OnLoopDelay(now, delta);
+  }
 }
 
 void Initialize(Isolate* isolate, Handle<Object> target) {
@@ -0,0 +1,39 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff ages', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() {}
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+var live = [];
+
+tap.test('buckets live instances by the diff they appeared in', function(t) {
+  addon.startHeapDiff();
+  for (var i = 0; i < 100; i += 1) live.push(new Foo);
+  addon.stopHeapDiff(false);
+  addon.startHeapDiff();
+  for (var k = 0; k < 50; k += 1) live.push(new Foo);
+  var ages = find(addon.stopHeapDiff(true, {ages: true}), 'Foo').ages;
+  t.ok(Array.isArray(ages));
+  t.ok(ages.length >= 3, 'one bucket per start snapshot, plus one');
+  t.equal(ages[ages.length - 1], 50, 'since the last start');
+  t.equal(ages[ages.length - 2], 100, 'between the last two starts');
+  t.equal(ages.reduce(function(a, b) { return a + b; }), 150);
+  t.end();
+});
+
+tap.test('left out unless asked for', function(t) {
+  addon.startHeapDiff();
+  live.push(new Foo);
+  t.equal(find(addon.stopHeapDiff(true), 'Foo').ages, undefined);
+  t.end();
+});
@@ -0,0 +1,47 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff async', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() {}
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+var live = [];
+
+tap.test('passes the summary to the callback', function(t) {
+  addon.startHeapDiff();
+  for (var i = 0; i < 1000; i += 1) live.push(new Foo);
+  var sync = true;
+  var rc = addon.stopHeapDiff(true, {}, function(state) {
+    t.notOk(sync, 'called asynchronously');
+    t.equal(find(state, 'Foo').total, 1000);
+    t.end();
+  });
+  sync = false;
+  t.equal(rc, undefined);
+});
+
+tap.test('callback can take the place of the options', function(t) {
+  addon.startHeapDiff();
+  live = [];
+  addon.stopHeapDiff(true, function(state) {
+    t.equal(find(state, 'Foo').total, -1000);
+    t.end();
+  });
+});
+
+tap.test('reports a diff that was never started', function(t) {
+  var status = addon.stopHeapDiff(true, function() {
+    t.fail('callback should not be called');
+  });
+  t.deepEqual(status, {aborted: true, reason: 'not started'});
+  t.end();
+});
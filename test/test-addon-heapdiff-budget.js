@@ -0,0 +1,50 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff budget', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+// Indexes into heapSnapshotStatistics.
+var kProgressTotal = 1;
+var kSnapshots = 3;
+var kAborted = 4;
+
+var statistics = addon.heapSnapshotStatistics;
+
+tap.test('aborts a start snapshot over budget', function(t) {
+  var snapshots = statistics[kSnapshots];
+  var aborted = statistics[kAborted];
+  var status = addon.startHeapDiff({snapshotSize: 1});
+  t.equal(status.aborted, true);
+  t.equal(status.reason, 'size');
+  t.ok(status.total > 1);
+  t.equal(statistics[kSnapshots], snapshots + 1);
+  t.equal(statistics[kAborted], aborted + 1);
+  t.ok(statistics[kProgressTotal] > 1);
+  t.deepEqual(addon.stopHeapDiff(true),
+              {aborted: true, reason: 'not started'});
+  t.end();
+});
+
+tap.test('aborts an end snapshot over budget', function(t) {
+  t.equal(addon.startHeapDiff(), undefined);
+  var aborted = statistics[kAborted];
+  var status = addon.stopHeapDiff(true, {snapshotSize: 1});
+  t.equal(status.aborted, true);
+  t.equal(status.reason, 'size');
+  t.equal(statistics[kAborted], aborted + 1);
+  t.deepEqual(addon.stopHeapDiff(true),
+              {aborted: true, reason: 'not started'},
+              'the start snapshot is discarded');
+  t.end();
+});
+
+tap.test('zero means no limit', function(t) {
+  addon.startHeapDiff({snapshotSize: 0, snapshotTime: 0});
+  t.ok(Array.isArray(addon.stopHeapDiff(true)));
+  t.end();
+});
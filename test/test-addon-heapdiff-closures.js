@@ -0,0 +1,57 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon) {
+  tap.test('heapdiff closures', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+// Every call creates a new function context that is only reachable through
+// the "context" edge of the closure it returns.
+function makeCounter() {
+  var n = 0;
+  return function counter() {
+    return ++n;
+  };
+}
+
+tap.test('heapdiff counts one context per closure', function(t) {
+  var N = 100;
+  var options = { closures: 10 };
+  var counters = [];
+  addon.startHeapDiff(options);
+  for (var i = 0; i < N; i += 1) counters.push(makeCounter());
+  addon.stopHeapDiff(true, options, function(state) {
+    var closures = state.closures.filter(function(e) {
+      return /^counter /.test(e.location);
+    });
+    var contexts = state.closures.filter(function(e) {
+      return /^makeCounter /.test(e.location);
+    });
+    t.equal(closures.length, 1);
+    t.equal(closures[0].total, N);
+    t.equal(contexts.length, 1);
+    t.equal(contexts[0].contexts, N);
+    t.equal(counters.length, N);  // Keep them alive until now.
+    t.end();
+  });
+});
+
+tap.test('heapdiff takes the closures setting from startHeapDiff', function(t) {
+  var counters = [];
+  addon.startHeapDiff({ closures: 10 });
+  for (var i = 0; i < 10; i += 1) counters.push(makeCounter());
+  addon.stopHeapDiff(true, {}, function(state) {
+    t.ok(Array.isArray(state.closures));
+    // Locations have a table of their own, they never show up as classes.
+    t.notOk(state.some(function(e) { return /^counter /.test(e.type); }));
+    t.equal(counters.length, 10);
+    addon.startHeapDiff({});
+    addon.stopHeapDiff(true, { closures: 10 }, function(state) {
+      t.equal(state.closures, undefined);
+      t.end();
+    });
+  });
+});
@@ -0,0 +1,38 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff columnar', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() {}
+var live = [];
+
+tap.test('returns the summary as columns', function(t) {
+  addon.startHeapDiff();
+  for (var i = 0; i < 1000; i += 1) live.push(new Foo);
+  var state = addon.stopHeapDiff(true, {columnar: true});
+  t.equal(state.sample, 1);
+  t.ok(Array.isArray(state.type));
+  t.ok(state.total instanceof Int32Array);
+  t.ok(state.size instanceof Int32Array);
+  t.equal(state.total.length, state.type.length);
+  t.equal(state.size.length, state.type.length);
+  t.equal(state.total.buffer, state.size.buffer, 'one allocation');
+  var index = state.type.indexOf('Foo');
+  t.ok(index >= 0);
+  t.equal(state.total[index], 1000);
+  t.ok(state.size[index] > 0);
+  t.end();
+});
+
+tap.test('counts reaped objects as negative', function(t) {
+  addon.startHeapDiff();
+  live = [];
+  var state = addon.stopHeapDiff(true, {columnar: true});
+  t.equal(state.total[state.type.indexOf('Foo')], -1000);
+  t.end();
+});
@@ -0,0 +1,32 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff deep graphs', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Link(next) { this.next = next; }
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+// A recursive walk would need a native stack frame per link.
+tap.test('walks a long linked list without running out of stack',
+         function(t) {
+  var N = 200000;
+  addon.startHeapDiff();
+  var head = null;
+  for (var i = 0; i < N; i += 1) head = new Link(head);
+  var state = addon.stopHeapDiff(true, { retained: 1, retainers: 1,
+                                        retainerTime: 60000 });
+  var entry = find(state, 'Link');
+  t.equal(entry.total, N);
+  // The head dominates the whole list.
+  t.ok(entry.retained >= entry.size);
+  t.ok(head);
+  t.end();
+});
@@ -0,0 +1,44 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff digest', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() { this.payload = [1, 2, 3]; }
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+var live = [];
+var created;
+
+tap.test('the digest records the sizes of the start objects', function(t) {
+  addon.startHeapDiff();
+  for (var i = 0; i < 500; i += 1) live.push(new Foo);
+  created = find(addon.stopHeapDiff(true), 'Foo');
+  t.equal(created.total, 500);
+  t.ok(created.size > 0);
+  t.end();
+});
+
+tap.test('unchanged classes are not reported', function(t) {
+  addon.startHeapDiff();
+  t.notOk(find(addon.stopHeapDiff(true), 'Foo'));
+  t.end();
+});
+
+tap.test('reaped objects net out against their creation', function(t) {
+  // The reaped objects are only known from the digest, the start snapshot
+  // itself is gone by the time the diff is computed.
+  addon.startHeapDiff();
+  live = [];
+  var reaped = find(addon.stopHeapDiff(true), 'Foo');
+  t.equal(reaped.total, -created.total);
+  t.equal(reaped.size, -created.size);
+  t.end();
+});
@@ -0,0 +1,66 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff summary order', {skip: 'add-on not built'},
+           function() {});
+  return;
+}
+
+// The summary used to be a std::map keyed on the class name's hash, length
+// and contents.  The hash and the comparison only look at the first
+// |length| bytes of the UTF-16 name, in native (little endian) byte order.
+function legacyHash(bytes) {
+  var hash = 0;
+  for (var i = 0; i < bytes.length; i += 1) {
+    hash = (hash + bytes[i]) >>> 0;
+    hash = (hash + (hash << 10)) >>> 0;
+    hash = (hash ^ (hash >>> 6)) >>> 0;
+  }
+  hash = (hash + (hash << 3)) >>> 0;
+  hash = (hash ^ (hash >>> 11)) >>> 0;
+  hash = (hash + (hash << 15)) >>> 0;
+  return hash;
+}
+
+function key(type) {
+  var bytes = new Buffer(type, 'ucs2').slice(0, type.length);
+  return { hash: legacyHash(bytes), length: type.length, bytes: bytes };
+}
+
+function compare(a, b) {
+  if (a.hash !== b.hash) return a.hash < b.hash ? -1 : 1;
+  if (a.length !== b.length) return a.length < b.length ? -1 : 1;
+  for (var i = 0; i < a.bytes.length; i += 1) {
+    if (a.bytes[i] !== b.bytes[i]) return a.bytes[i] < b.bytes[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+function Alpha() {}
+function Beta() {}
+function Gamma() {}
+function Delta() {}
+var live = [];
+
+tap.test('entries come in the old map order, once per class', function(t) {
+  addon.startHeapDiff();
+  [Delta, Gamma, Beta, Alpha].forEach(function(Type) {
+    for (var i = 0; i < 10; i += 1) live.push(new Type);
+  });
+  var state = addon.stopHeapDiff(true);
+  var types = state.map(function(e) { return e.type; });
+  t.ok(types.length >= 4);
+  types.forEach(function(type, index) {
+    t.equal(types.indexOf(type), index, type + ' is reported once');
+    if (index > 0 && compare(key(types[index - 1]), key(type)) > 0) {
+      t.fail(types[index - 1] + ' before ' + type);
+    }
+  });
+  state.forEach(function(e) {
+    t.ok((e.total < 0) === (e.size < 0), e.type + ' total and size agree');
+  });
+  t.end();
+});
@@ -0,0 +1,55 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff retained sizes', {skip: 'add-on not built'},
+           function() {});
+  return;
+}
+
+function Payload() { this.data = [1, 2, 3, 4]; }
+function Leaf() { this.payload = new Payload; }
+function Holder(count) {
+  this.leaves = [];
+  for (var i = 0; i < count; i += 1) this.leaves.push(new Leaf);
+}
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+var holder;
+
+tap.test('retained sizes follow the dominator tree', function(t) {
+  addon.startHeapDiff();
+  holder = new Holder(1000);
+  var state = addon.stopHeapDiff(true, { retained: 32, retainerTime: 60000 });
+  var leaf = find(state, 'Leaf');
+  var payload = find(state, 'Payload');
+  t.equal(leaf.total, 1000);
+  // Every leaf is the only way to its payload.
+  t.ok(leaf.retained >= leaf.size + payload.size);
+  // The holder dominates its array, the leaves and their payloads.  The
+  // leaves are counted once, through the holder, not twice.
+  var entry = find(state, 'Holder');
+  t.ok(entry.retained >= leaf.retained);
+  t.end();
+});
+
+tap.test('no retained sizes unless asked for', function(t) {
+  addon.startHeapDiff();
+  holder = new Holder(10);
+  var state = addon.stopHeapDiff(true);
+  t.equal(find(state, 'Leaf').retained, undefined);
+  t.end();
+});
+
+tap.test('no retained sizes when the budget runs out', function(t) {
+  addon.startHeapDiff();
+  holder = new Holder(10);
+  var state = addon.stopHeapDiff(true, { retained: 32, retainerTime: 0 });
+  t.equal(find(state, 'Leaf').retained, undefined);
+  t.end();
+});
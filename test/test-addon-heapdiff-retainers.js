@@ -0,0 +1,41 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff retainers', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() { this.a = this.b = this.c = null; }
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+tap.test('reports the shortest retainer path', function(t) {
+  addon.startHeapDiff();
+  global.holder = {items: []};
+  for (var i = 0; i < 10000; i += 1) global.holder.items.push(new Foo);
+  var state = addon.stopHeapDiff(true, {retainers: 2, retainerTime: 60000});
+  var retainers = find(state, 'Foo').retainers;
+  t.ok(Array.isArray(retainers));
+  t.ok(retainers.length > 0);
+  var path = retainers[0];
+  t.ok(/\.items -> /.test(path.path), path.path);
+  t.ok(/Foo$/.test(path.path), path.path);
+  t.ok(path.count > 0);
+  t.ok(path.depth > 0);
+  t.end();
+});
+
+tap.test('gives up when out of time', function(t) {
+  addon.startHeapDiff();
+  global.other = {items: []};
+  for (var i = 0; i < 10000; i += 1) global.other.items.push(new Foo);
+  var state = addon.stopHeapDiff(true, {retainers: 2, retainerTime: 0});
+  t.deepEqual(find(state, 'Foo').retainers, []);
+  global.holder = global.other = null;
+  t.end();
+});
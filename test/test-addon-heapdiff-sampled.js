@@ -0,0 +1,42 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff sampled', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() {}
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+var live = [];
+
+tap.test('estimates counts within the error bounds', function(t) {
+  addon.startHeapDiff({sample: 4});
+  for (var i = 0; i < 4000; i += 1) live.push(new Foo);
+  var state = addon.stopHeapDiff(true, {retained: 5, retainers: 5});
+  var entry = find(state, 'Foo');
+  t.ok(entry.totalError > 0);
+  t.ok(entry.sizeError > 0);
+  t.ok(Math.abs(entry.total - 4000) <= 3 * entry.totalError,
+       entry.total + ' +/- ' + entry.totalError);
+  t.equal(entry.total % 4, 0, 'scaled by the sample rate');
+  t.equal(entry.retained, undefined, 'no edges in the sample');
+  t.equal(entry.retainers, undefined);
+  t.end();
+});
+
+tap.test('full diffs have no error bounds', function(t) {
+  addon.startHeapDiff();
+  live = [];
+  var entry = find(addon.stopHeapDiff(true), 'Foo');
+  t.equal(entry.total, -4000);
+  t.equal(entry.totalError, undefined);
+  t.equal(entry.sizeError, undefined);
+  t.end();
+});
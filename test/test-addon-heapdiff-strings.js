@@ -0,0 +1,43 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff strings', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+var live = [];
+var value = 'a duplicated string value';
+
+tap.test('reports duplicated strings', function(t) {
+  addon.startHeapDiff();
+  // Joined at run time so each copy is a string of its own.
+  var parts = value.split(' ');
+  for (var i = 0; i < 1000; i += 1) live.push(parts.join(' '));
+  var state = addon.stopHeapDiff(true, {strings: 5, stringBudget: 1 << 30});
+  t.ok(Array.isArray(state.strings));
+  t.ok(state.strings.length <= 5);
+  var entry = state.strings.filter(function(e) {
+    return e.value === value;
+  })[0];
+  t.ok(entry, 'found');
+  t.ok(entry.count >= 1000);
+  t.ok(entry.wasted > 0);
+  t.ok(entry.wasted < entry.size, 'one copy is not wasted');
+  t.end();
+});
+
+tap.test('stops reading at the budget', function(t) {
+  addon.startHeapDiff();
+  var state = addon.stopHeapDiff(true, {strings: 5, stringBudget: 1});
+  t.deepEqual(state.strings, []);
+  t.end();
+});
+
+tap.test('left out unless asked for', function(t) {
+  addon.startHeapDiff();
+  t.equal(addon.stopHeapDiff(true).strings, undefined);
+  t.end();
+});
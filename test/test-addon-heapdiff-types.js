@@ -0,0 +1,40 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff types', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+var live = [];
+
+tap.test('reports the growth of each node type', function(t) {
+  addon.startHeapDiff({types: true});
+  // Fractional numbers don't fit in a small integer, they're boxed.
+  for (var i = 0; i < 1000; i += 1) live.push([i + 0.5, 'x']);
+  var types = addon.stopHeapDiff(true, {types: true}).types;
+  t.ok(Array.isArray(types.type));
+  t.ok(types.total instanceof Float64Array);
+  t.ok(types.size instanceof Float64Array);
+  t.equal(types.total.length, types.type.length);
+  t.equal(types.total.buffer, types.size.buffer, 'one allocation');
+  var index = types.type.indexOf('number');
+  t.ok(index >= 0);
+  t.ok(types.total[index] >= 1000, 'heap numbers are counted');
+  t.ok(types.size[index] > 0);
+  t.end();
+});
+
+tap.test('needs the option at the start too', function(t) {
+  addon.startHeapDiff();
+  t.equal(addon.stopHeapDiff(true, {types: true}).types, undefined);
+  t.end();
+});
+
+tap.test('left out unless asked for', function(t) {
+  addon.startHeapDiff({types: true});
+  t.equal(addon.stopHeapDiff(true).types, undefined);
+  t.end();
+});
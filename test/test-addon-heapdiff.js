@@ -0,0 +1,46 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapDiff) {
+  tap.test('heapdiff', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() {}
+function Bar() { this.foo = new Foo; }
+
+function find(state, type) {
+  return state.filter(function(e) { return e.type === type; })[0];
+}
+
+var live = [];
+
+tap.test('counts created objects once each', function(t) {
+  addon.startHeapDiff();
+  for (var i = 0; i < 1000; i += 1) live.push(new Bar);
+  // Reachable twice, through |live| and through each other.
+  live.push(live.slice());
+  var state = addon.stopHeapDiff(true);
+  t.equal(find(state, 'Bar').total, 1000);
+  t.equal(find(state, 'Foo').total, 1000);
+  t.ok(find(state, 'Foo').size > 0);
+  t.end();
+});
+
+tap.test('counts reaped objects as negative', function(t) {
+  addon.startHeapDiff();
+  live = [];
+  var state = addon.stopHeapDiff(true);
+  var entry = find(state, 'Bar');
+  t.equal(entry.total, -1000);
+  t.ok(entry.size < 0);
+  t.end();
+});
+
+tap.test('without summarize, nothing is returned', function(t) {
+  addon.startHeapDiff();
+  t.equal(addon.stopHeapDiff(false), undefined);
+  t.end();
+});
@@ -0,0 +1,109 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapHistory) {
+  tap.test('heap history', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+var file = path.join(os.tmpdir(), 'test-addon-heaphistory-' + process.pid);
+var instances = [];
+
+function Foo() {}
+
+// Runs one heap diff that creates |count| Foo instances.
+function diff(count, callback) {
+  addon.startHeapDiff();
+  for (var i = 0; i < count; i += 1) instances.push(new Foo);
+  addon.stopHeapDiff(true, {}, function(state) {
+    callback(state);
+  });
+}
+
+// Number of times |string| is in |buffer| as UTF-16.
+function occurrences(buffer, string) {
+  var needle = new Buffer(string, 'ucs2');
+  var count = 0;
+  for (var i = 0; i + needle.length <= buffer.length; i += 1) {
+    var k = 0;
+    while (k < needle.length && buffer[i + k] === needle[k]) k += 1;
+    if (k === needle.length) count += 1;
+  }
+  return count;
+}
+
+tap.test('setup', function(t) {
+  try { fs.unlinkSync(file); } catch (e) {}
+  addon.startHeapHistory(file);
+  diff(100, function(state) {
+    t.notOk(state.historyError);
+    diff(50, function(state) {
+      t.notOk(state.historyError);
+      addon.stopHeapHistory();
+      t.end();
+    });
+  });
+});
+
+tap.test('readers ignore a torn block at the end', function(t) {
+  var size = fs.statSync(file).size;
+  // A block header that promises 1000 bytes of payload, followed by 4.
+  var torn = new Buffer(12);
+  torn.writeUInt32LE(0x49, 0);
+  torn.writeUInt32LE(1000, 4);
+  torn.writeUInt32LE(42, 8);
+  fs.appendFileSync(file, torn);
+  t.equal(fs.statSync(file).size, size + torn.length);
+  var trend = addon.queryHeapHistory(file, 'Foo', 0);
+  t.equal(trend.intervals, 2);
+  t.equal(trend.total, 150);
+  t.end();
+});
+
+tap.test('reopening cuts off the torn block and continues', function(t) {
+  addon.startHeapHistory(file);
+  diff(25, function(state) {
+    t.notOk(state.historyError);
+    addon.stopHeapHistory();
+    var trend = addon.queryHeapHistory(file, 'Foo', 0);
+    t.equal(trend.intervals, 3);
+    t.equal(trend.total, 175);
+    t.ok(trend.first <= trend.last);
+    // The string table was continued, the class name is in the file once.
+    t.equal(occurrences(fs.readFileSync(file), 'Foo'), 1);
+    t.end();
+  });
+});
+
+tap.test('a file past its maximum size is compacted', function(t) {
+  fs.unlinkSync(file);
+  // Any interval is bigger than half of one byte, compaction keeps none of
+  // the old ones and the file only has the newest interval.
+  addon.startHeapHistory(file, 1);
+  diff(10, function(state) {
+    t.notOk(state.historyError);
+    diff(20, function(state) {
+      t.notOk(state.historyError);
+      diff(30, function(state) {
+        t.notOk(state.historyError);
+        addon.stopHeapHistory();
+        var trend = addon.queryHeapHistory(file, 'Foo', 0);
+        t.equal(trend.intervals, 1);
+        t.equal(trend.total, 30);
+        t.equal(occurrences(fs.readFileSync(file), 'Foo'), 1);
+        t.notOk(fs.existsSync(file + '.compact'));
+        t.end();
+      });
+    });
+  });
+});
+
+tap.test('teardown', function(t) {
+  fs.unlinkSync(file);
+  t.end();
+});
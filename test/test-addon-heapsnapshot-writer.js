@@ -0,0 +1,68 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var tap = require('tap');
+var zlib = require('zlib');
+
+if (!addon || !addon.writeHeapSnapshot) {
+  tap.test('heap snapshot writer', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+var file = path.join(os.tmpdir(), 'test-addon-heapsnapshot-' + process.pid);
+
+function Marker() {}
+var marker = new Marker;
+
+tap.test('writes a gzipped snapshot', function(t) {
+  var progress = 0;
+  var options = {
+    // Small buffers so the queue fills up and the main thread has to write.
+    bufferSize: 4096,
+    progress: function(stats) {
+      t.ok(stats.bytesIn >= 0);
+      progress += 1;
+    },
+  };
+  addon.writeHeapSnapshot(file, options, function(err, stats) {
+    t.notOk(err);
+    t.ok(stats.buffers > 1);
+    t.equal(stats.bytesOut, fs.statSync(file).size);
+    t.ok(stats.bytesOut < stats.bytesIn, 'compressed');
+    zlib.gunzip(fs.readFileSync(file), function(err, data) {
+      t.notOk(err);
+      t.equal(data.length, stats.bytesIn);
+      var snapshot = JSON.parse(data);
+      t.ok(snapshot.snapshot.meta);
+      t.ok(snapshot.nodes.length > 0);
+      t.ok(snapshot.strings.indexOf('Marker') >= 0);
+      t.ok(marker);
+      fs.unlinkSync(file);
+      t.end();
+    });
+  });
+});
+
+tap.test('writes an uncompressed snapshot', function(t) {
+  addon.writeHeapSnapshot(file, { compress: false }, function(err, stats) {
+    t.notOk(err);
+    t.equal(stats.bytesOut, stats.bytesIn);
+    t.equal(fs.statSync(file).size, stats.bytesIn);
+    t.ok(JSON.parse(fs.readFileSync(file, 'utf8')).nodes.length > 0);
+    fs.unlinkSync(file);
+    t.end();
+  });
+});
+
+tap.test('reports an error and leaves no file behind', function(t) {
+  var bad = path.join(file + '-missing', 'snapshot');
+  addon.writeHeapSnapshot(bad, {}, function(err, stats) {
+    t.ok(err instanceof Error);
+    t.equal(stats.bytesOut, 0);
+    t.notOk(fs.existsSync(bad));
+    t.end();
+  });
+});
@@ -0,0 +1,43 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startHeapTracking) {
+  tap.test('heap tracking', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function Foo() {}
+var live = [];
+
+// Taking a heap snapshot runs a full garbage collection.
+function collectGarbage() {
+  addon.startHeapDiff();
+  addon.stopHeapDiff(false);
+}
+
+tap.test('not tracking', function(t) {
+  t.equal(addon.pollHeapTracking(), undefined);
+  t.end();
+});
+
+tap.test('reports allocations and frees between polls', function(t) {
+  addon.startHeapTracking();
+  addon.pollHeapTracking();
+  for (var i = 0; i < 10000; i += 1) live.push(new Foo);
+  var stats = addon.pollHeapTracking();
+  t.ok(stats.allocatedCount >= 10000, 'allocations');
+  t.ok(stats.allocatedSize > 0);
+  t.ok(stats.liveCount >= 10000);
+  var liveCount = stats.liveCount;
+  live = [];
+  collectGarbage();
+  stats = addon.pollHeapTracking();
+  t.ok(stats.freedCount >= 10000, 'frees');
+  t.ok(stats.freedSize > 0);
+  t.ok(stats.liveCount < liveCount, 'live shrank');
+  addon.stopHeapTracking();
+  t.equal(addon.pollHeapTracking(), undefined, 'stopped');
+  t.end();
+});
@@ -0,0 +1,44 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startCpuProfiling) {
+  tap.test('bottom-up profile', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+function recurse(depth, ms) {
+  if (depth === 0) return spin(ms);
+  return recurse(depth - 1, ms) + 1;
+}
+
+function find(list, name) {
+  return list.filter(function(e) { return e.functionName === name; })[0];
+}
+
+tap.test('recursive calls are counted once per sample', function(t) {
+  addon.startCpuProfiling();
+  recurse(10, 500);
+  var profile = addon.stopCpuProfiling({ format: 'top', top: 100 });
+  t.ok(profile.samples > 0);
+  var entry = find(profile.total, 'recurse');
+  t.ok(entry, 'recurse is in the total list');
+  // Ten frames per sample, counted ten times it would be about ten times
+  // the number of samples.
+  t.ok(entry.totalHits <= profile.samples, 'totalHits <= samples');
+  t.ok(entry.selfHits <= entry.totalHits, 'selfHits <= totalHits');
+  var leaf = find(profile.total, 'spin');
+  t.ok(leaf, 'spin is in the total list');
+  t.ok(entry.totalHits >= leaf.totalHits, 'recurse is on every spin stack');
+  t.end();
+});
@@ -0,0 +1,59 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startCpuProfiling) {
+  tap.test('profile diff', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+function hot(ms) { return spin(ms); }
+function cold(ms) { return spin(ms); }
+
+function find(list, name) {
+  return list.filter(function(e) { return e.functionName === name; })[0];
+}
+
+tap.test('no baseline', function(t) {
+  addon.startCpuProfiling();
+  t.equal(addon.stopCpuProfiling({ format: 'diff' }), null);
+  t.end();
+});
+
+tap.test('hits are normalized by the samples of each profile', function(t) {
+  // Baseline: half hot, half cold.  Current: all hot and three times as
+  // long.  Unnormalized, hot would have grown six fold.
+  addon.startCpuProfiling();
+  hot(200);
+  cold(200);
+  var baselineSamples = addon.stopCpuProfiling({ format: 'baseline' });
+  t.ok(baselineSamples > 0);
+  addon.startCpuProfiling();
+  hot(1200);
+  var diff = addon.stopCpuProfiling({ format: 'diff', top: 10 });
+  t.equal(diff.baselineSamples, baselineSamples);
+  t.ok(diff.samples > baselineSamples);
+  var entry = find(diff.total, 'hot');
+  t.ok(entry, 'hot grew');
+  t.ok(entry.totalBefore > 0.25 && entry.totalBefore < 0.75,
+       'about half of the baseline');
+  t.ok(entry.totalAfter > 0.75 && entry.totalAfter <= 1,
+       'about all of the current profile');
+  t.ok(Math.abs(entry.totalDelta -
+                (entry.totalAfter - entry.totalBefore)) < 1e-9);
+  t.notOk(find(diff.total, 'cold'), 'cold got cheaper');
+  diff.self.concat(diff.total).forEach(function(e) {
+    t.ok(e.selfAfter <= 1 && e.totalAfter <= 1, 'shares are fractions');
+  });
+  t.end();
+});
@@ -0,0 +1,55 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startCpuProfiling) {
+  tap.test('flat profile', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+var COLUMNS = ['parent', 'function', 'script', 'line', 'column', 'hits',
+               'bailout'];
+
+tap.test('flat profile is a node table', function(t) {
+  addon.startCpuProfiling();
+  spin(300);
+  var flat = addon.stopCpuProfiling({ format: 'flat' });
+  var size = flat.parent.length;
+  t.ok(size > 1);
+  COLUMNS.forEach(function(name) {
+    t.equal(flat[name].length, size, name + ' has a row per node');
+    t.equal(flat[name].buffer, flat.parent.buffer, name + ' shares a buffer');
+  });
+  t.equal(flat.parent[0], -1);
+  t.equal(flat.functions[flat.function[0]], '(root)');
+  for (var i = 1; i < size; i += 1) {
+    if (flat.parent[i] < 0 || flat.parent[i] >= i) {
+      t.fail('parent ' + flat.parent[i] + ' of node ' + i);
+    }
+    if (flat.bailout[i] >= flat.bailouts.length) t.fail('bailout index');
+    if (flat.script[i] >= flat.scripts.length) t.fail('script index');
+  }
+  t.equal(flat.bailouts[0], '');
+  // Names are interned, every function name is in the table once.
+  flat.functions.forEach(function(name, index) {
+    t.equal(flat.functions.indexOf(name), index, name + ' is unique');
+  });
+  var spinIndex = flat.functions.indexOf('spin');
+  t.ok(spinIndex > 0, 'spin is in the function table');
+  var hits = 0;
+  for (i = 0; i < size; i += 1) {
+    if (flat.function[i] === spinIndex) hits += flat.hits[i];
+  }
+  t.ok(hits > 0, 'spin was sampled');
+  t.end();
+});
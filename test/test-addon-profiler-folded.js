@@ -0,0 +1,68 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var tap = require('tap');
+
+if (!addon || !addon.startCpuProfiling) {
+  tap.test('folded stacks', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+// A scoped and an unscoped package that each spin for a while.
+var root = path.join(os.tmpdir(), 'test-addon-profiler-folded-' + process.pid);
+var source = [
+  'module.exports = function busy(ms) {',
+  '  var end = Date.now() + ms;',
+  '  var x = 0;',
+  '  while (Date.now() < end) {',
+  '    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);',
+  '  }',
+  '  return x;',
+  '};',
+].join('\n');
+// No recursive mkdir in node 0.10, create the parents first.
+var dirs = [
+  root,
+  path.join(root, 'node_modules'),
+  path.join(root, 'node_modules', '@scope'),
+  path.join(root, 'node_modules', '@scope', 'scoped'),
+  path.join(root, 'node_modules', 'plain'),
+];
+
+tap.test('setup', function(t) {
+  dirs.forEach(function(dir) { fs.mkdirSync(dir); });
+  fs.writeFileSync(path.join(dirs[3], 'index.js'), source);
+  fs.writeFileSync(path.join(dirs[4], 'index.js'), source);
+  t.end();
+});
+
+tap.test('frames collapse to their package', function(t) {
+  var scoped = require(path.join(dirs[3], 'index.js'));
+  var plain = require(path.join(dirs[4], 'index.js'));
+  addon.startCpuProfiling();
+  scoped(300);
+  plain(300);
+  var folded = addon.stopCpuProfiling({ format: 'folded', collapse: 'package' });
+  t.type(folded, 'string');
+  var frames = {};
+  folded.split('\n').forEach(function(line) {
+    if (line === '') return;
+    var stack = line.slice(0, line.lastIndexOf(' '));
+    stack.split(';').forEach(function(frame) { frames[frame] = true; });
+  });
+  t.ok(frames['@scope/scoped'], 'scoped package keeps its scope');
+  t.ok(frames['plain'], 'unscoped package');
+  t.ok(frames['(app)'], 'this file is application code');
+  t.notOk(folded.match(/node_modules|index\.js/), 'no paths left');
+  t.end();
+});
+
+tap.test('teardown', function(t) {
+  fs.unlinkSync(path.join(dirs[3], 'index.js'));
+  fs.unlinkSync(path.join(dirs[4], 'index.js'));
+  dirs.slice().reverse().forEach(function(dir) { fs.rmdirSync(dir); });
+  t.end();
+});
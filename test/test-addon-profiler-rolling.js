@@ -0,0 +1,62 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startRollingProfiler) {
+  tap.test('rolling profiler', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+// Keeps the CPU busy in short bursts for |ms| milliseconds so the timer
+// that rotates the windows gets to run.
+function busy(ms, callback) {
+  var end = Date.now() + ms;
+  (function next() {
+    spin(20);
+    if (Date.now() < end) return setTimeout(next, 1);
+    callback();
+  })();
+}
+
+tap.test('keeps the most recent windows, back to back', function(t) {
+  addon.startRollingProfiler({ window: 100, windows: 3, top: 10 });
+  busy(700, function() {
+    var windows = addon.pollRollingProfiler(true);
+    t.equal(windows.length, 3);
+    for (var i = 0; i < windows.length; i += 1) {
+      var w = windows[i];
+      t.ok(w.start <= w.end);
+      t.ok(w.functions.length <= 10 * 2, 'top self and top total');
+      if (i > 0) t.equal(w.start, windows[i - 1].end, 'no gap');
+    }
+    var sampled = windows.some(function(w) {
+      return w.functions.some(function(f) {
+        return f.functionName === 'spin' && f.selfHits > 0;
+      });
+    });
+    t.ok(sampled, 'spin is in a window');
+    var stopped = addon.stopRollingProfiler();
+    t.ok(stopped.length <= 3);
+    t.equal(addon.pollRollingProfiler(), undefined, 'stopped');
+    t.end();
+  });
+});
+
+tap.test('drops windows that go over the byte cap', function(t) {
+  addon.startRollingProfiler({ window: 100, windows: 10, maxBytes: 1 });
+  busy(300, function() {
+    t.deepEqual(addon.pollRollingProfiler(true), []);
+    addon.stopRollingProfiler();
+    t.end();
+  });
+});
@@ -0,0 +1,81 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startCpuProfiling) {
+  tap.test('sliced profile conversion', {skip: 'add-on not built'},
+           function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+// Deep stacks make a tree that takes more than one slice to convert.
+function recurse(depth, ms) {
+  if (depth === 0) return spin(ms);
+  return recurse(depth - 1, ms) + 1;
+}
+
+function hits(node) {
+  return node.hitCount !== undefined ? node.hitCount : node.selfSamplesCount;
+}
+
+// Maps every call path in |node|'s tree to its node.
+function paths(node, prefix, result) {
+  var key = prefix + '/' + node.functionName + ' ' + node.scriptName + ':' +
+            node.lineNumber;
+  result[key] = node;
+  node.children.forEach(function(child) { paths(child, key, result); });
+  return result;
+}
+
+tap.test('the callback gets the same tree as a synchronous stop',
+         function(t) {
+  // Profiles that run at the same time get the same samples, plus whatever
+  // the second one records between the two stop calls.
+  addon.startCpuProfiling({ title: 'sync' });
+  addon.startCpuProfiling({ title: 'sliced' });
+  for (var depth = 0; depth < 200; depth += 20) recurse(depth, 20);
+  var sync = addon.stopCpuProfiling({ title: 'sync' });
+  var returned = false;
+  var result = addon.stopCpuProfiling({ title: 'sliced', sliceTime: 1 },
+                                      function(sliced) {
+    t.ok(returned, 'called asynchronously');
+    var before = paths(sync, '', {});
+    var after = paths(sliced, '', {});
+    var keys = Object.keys(before);
+    t.ok(keys.length > 200, 'deep tree');
+    var missing = keys.filter(function(key) { return !(key in after); });
+    t.deepEqual(missing, [], 'every node was converted');
+    keys.forEach(function(key) {
+      var a = before[key];
+      var b = after[key];
+      if (!b) return;
+      if (Object.keys(a).sort().join() !== Object.keys(b).sort().join()) {
+        t.fail('different properties at ' + key);
+      }
+      if (hits(b) < hits(a)) t.fail('fewer hits at ' + key);
+      if (b.children.length < a.children.length) {
+        t.fail('fewer children at ' + key);
+      }
+    });
+    t.end();
+  });
+  t.equal(result, undefined);
+  returned = true;
+});
+
+tap.test('the callback gets undefined without a profile', function(t) {
+  addon.stopCpuProfiling({ title: 'never started' }, function(tree) {
+    t.equal(tree, undefined);
+    t.end();
+  });
+});
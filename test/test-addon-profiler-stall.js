@@ -0,0 +1,79 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.armStallProfiler) {
+  tap.test('stall profiler', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+// Blocks |count| loop iterations for |ms| milliseconds each.  Timers run
+// in the same iteration as the check that measures the delay.
+function stall(count, ms, callback) {
+  setTimeout(function() {
+    spin(ms);
+    if (count > 1) return stall(count - 1, ms, callback);
+    callback();
+  }, 1);
+}
+
+function wait(ms, callback) {
+  setTimeout(callback, ms);
+}
+
+tap.test('a run of stalls takes one profile, then cools down', function(t) {
+  addon.armStallProfiler({ threshold: 30, count: 2, within: 5000,
+                           duration: 100, cooldown: 60000, top: 10 });
+  wait(50, function() {
+    t.deepEqual(addon.takeStallProfiles(), [], 'nothing without stalls');
+    // Two stalls start a profile, the third one gets sampled.
+    stall(3, 60, function() {
+      wait(200, function() {
+        var profiles = addon.takeStallProfiles();
+        t.equal(profiles.length, 1);
+        var profile = profiles[0];
+        t.ok(profile.start <= profile.end);
+        t.ok(profile.samples > 0);
+        t.ok(profile.functions.some(function(f) {
+          return f.functionName === 'spin';
+        }), 'spin was sampled');
+        t.deepEqual(addon.takeStallProfiles(), [], 'taken profiles are gone');
+        // Within the cooldown, more stalls don't start another profile.
+        stall(3, 60, function() {
+          wait(200, function() {
+            t.deepEqual(addon.takeStallProfiles(), []);
+            addon.disarmStallProfiler();
+            t.equal(addon.takeStallProfiles(), undefined, 'disarmed');
+            t.end();
+          });
+        });
+      });
+    });
+  });
+});
+
+tap.test('isolated stalls do not start a profile', function(t) {
+  addon.armStallProfiler({ threshold: 30, count: 2, within: 100,
+                           duration: 100 });
+  stall(1, 60, function() {
+    wait(300, function() {
+      stall(1, 60, function() {
+        wait(200, function() {
+          t.deepEqual(addon.takeStallProfiles(), []);
+          addon.disarmStallProfiler();
+          t.end();
+        });
+      });
+    });
+  });
+});
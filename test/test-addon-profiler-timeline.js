@@ -0,0 +1,60 @@
+'use strict';
+
+var addon = require('../lib/addon');
+var tap = require('tap');
+
+if (!addon || !addon.startCpuProfiling) {
+  tap.test('sample timeline', {skip: 'add-on not built'}, function() {});
+  return;
+}
+
+function spin(ms) {
+  var end = Date.now() + ms;
+  var x = 0;
+  while (Date.now() < end) {
+    for (var i = 0; i < 1e4; i += 1) x += Math.sqrt(i);
+  }
+  return x;
+}
+
+// V8 3.14 doesn't record the samples, the timeline is always empty there.
+var recordsSamples = !/^v0\.10\./.test(process.version);
+
+tap.test('flat profile with a sample timeline', function(t) {
+  var before = Date.now();
+  addon.startCpuProfiling({ samples: true });
+  spin(300);
+  var flat = addon.stopCpuProfiling({ format: 'flat', samples: true });
+  var after = Date.now();
+  var timeline = flat.timeline;
+  t.ok(timeline, 'has a timeline');
+  t.equal(timeline.nodes.length, timeline.timeDeltas.length);
+  t.equal(timeline.nodes.buffer, timeline.timeDeltas.buffer);
+  t.ok(timeline.startTime >= before - 50 && timeline.startTime <= after);
+  if (!recordsSamples) {
+    t.equal(timeline.nodes.length, 0);
+    return t.end();
+  }
+  t.ok(timeline.nodes.length > 0);
+  var elapsed = 0;
+  var spinSamples = 0;
+  var spinIndex = flat.functions.indexOf('spin');
+  for (var i = 0; i < timeline.nodes.length; i += 1) {
+    var node = timeline.nodes[i];
+    if (node < 0 || node >= flat.parent.length) t.fail('node ' + node);
+    if (timeline.timeDeltas[i] < 0) t.fail('delta ' + timeline.timeDeltas[i]);
+    elapsed += timeline.timeDeltas[i];
+    if (flat.function[node] === spinIndex) spinSamples += 1;
+  }
+  // Deltas are in microseconds and add up to at most the profile's length.
+  t.ok(elapsed / 1e3 <= after - timeline.startTime + 50);
+  t.ok(spinSamples > 0, 'spin is on top of some samples');
+  t.end();
+});
+
+tap.test('no timeline unless asked for', function(t) {
+  addon.startCpuProfiling();
+  spin(50);
+  t.equal(addon.stopCpuProfiling({ format: 'flat' }).timeline, undefined);
+  t.end();
+});